@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "asset_pack.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t align_pack(uint64_t offset) {
+	return (offset + ASSET_PACK_ALIGNMENT - 1) & ~(uint64_t) (ASSET_PACK_ALIGNMENT - 1);
+}
+
+static bool entry_less(const AssetPackEntry &a, const AssetPackEntry &b) {
+	return strncmp(a.name, b.name, ASSET_NAME_LENGTH) < 0;
+}
+
+bool AssetPack::open(const std::string &fname) {
+	close();
+	if (!file.open(fname) || file.size < sizeof(AssetPackHeader)) {
+		file.close();
+		return false;
+	}
+	AssetPackHeader header;
+	memcpy(&header, file.data, sizeof(header));
+	if (header.magic != ASSET_PACK_MAGIC ||
+		header.version != ASSET_PACK_VERSION ||
+		header.entrySize != sizeof(AssetPackEntry) ||
+		header.tocOffset % sizeof(uint64_t) != 0 ||
+		header.tocOffset > file.size ||
+		(uint64_t) header.entryCount * sizeof(AssetPackEntry) > file.size - header.tocOffset) {
+		file.close();
+		return false;
+	}
+	// every payload inside the file, every name terminated and in order
+	const AssetPackEntry *toc = reinterpret_cast<const AssetPackEntry *>(file.data + header.tocOffset);
+	for (uint32_t i = 0; i < header.entryCount; i++) {
+		const AssetPackEntry &e = toc[i];
+		if (e.name[ASSET_NAME_LENGTH - 1] != '\0' ||
+			e.offset > file.size || e.size > file.size - e.offset ||
+			(i > 0 && !entry_less(toc[i - 1], e))) {
+			file.close();
+			return false;
+		}
+	}
+	entries = toc;
+	count = header.entryCount;
+	// the payloads are read front to back while the scene is set up
+	file.prefetch();
+	return true;
+}
+
+void AssetPack::close() {
+	file.close();
+	entries = NULL;
+	count = 0;
+}
+
+const AssetPackEntry *AssetPack::find(const std::string &name) const {
+	if (name.size() >= ASSET_NAME_LENGTH) {
+		return NULL;
+	}
+	AssetPackEntry key;
+	memset(key.name, 0, sizeof(key.name));
+	memcpy(key.name, name.data(), name.size());
+	const AssetPackEntry *end = entries + count;
+	const AssetPackEntry *found = std::lower_bound(entries, end, key, entry_less);
+	if (found == end || entry_less(key, *found)) {
+		return NULL;
+	}
+	return found;
+}
+
+bool AssetPackWriter::add(const std::string &name, uint32_t format, uint64_t sourceHash, std::vector<unsigned char> &bytes) {
+	if (name.empty() || name.size() >= ASSET_NAME_LENGTH) {
+		return false;
+	}
+	for (const Asset &a : assets) {
+		if (name == a.entry.name) {
+			return false;
+		}
+	}
+	assets.push_back(Asset());
+	Asset &a = assets.back();
+	memset(&a.entry, 0, sizeof(a.entry));
+	memcpy(a.entry.name, name.data(), name.size());
+	a.entry.size = bytes.size();
+	a.entry.sourceHash = sourceHash;
+	a.entry.format = format;
+	a.bytes.swap(bytes);
+	return true;
+}
+
+bool AssetPackWriter::write(const std::string &fname) {
+	std::sort(assets.begin(), assets.end(), [](const Asset &a, const Asset &b) {
+		return entry_less(a.entry, b.entry);
+	});
+	AssetPackHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = ASSET_PACK_MAGIC;
+	header.version = ASSET_PACK_VERSION;
+	header.entryCount = (uint32_t) assets.size();
+	header.entrySize = sizeof(AssetPackEntry);
+	header.tocOffset = sizeof(header);
+	// the payloads follow the table in the same order, so reading the
+	// entries one after the other walks the file front to back
+	uint64_t offset = align_pack(header.tocOffset + assets.size() * sizeof(AssetPackEntry));
+	for (Asset &a : assets) {
+		a.entry.offset = offset;
+		offset = align_pack(offset + a.entry.size);
+	}
+
+	// write next to the target and rename, so a reader never sees half a file
+	std::string tmp = fname + ".tmp";
+	FILE *out = fopen(tmp.c_str(), "wb");
+	if (out == NULL) {
+		return false;
+	}
+	bool ok = fwrite(&header, 1, sizeof(header), out) == sizeof(header);
+	for (const Asset &a : assets) {
+		ok = ok && fwrite(&a.entry, 1, sizeof(a.entry), out) == sizeof(a.entry);
+	}
+	const char zeros[ASSET_PACK_ALIGNMENT] = { 0 };
+	uint64_t position = header.tocOffset + assets.size() * sizeof(AssetPackEntry);
+	for (const Asset &a : assets) {
+		size_t padding = (size_t) (a.entry.offset - position);
+		ok = ok && fwrite(zeros, 1, padding, out) == padding;
+		ok = ok && fwrite(a.bytes.data(), 1, a.bytes.size(), out) == a.bytes.size();
+		position = a.entry.offset + a.entry.size;
+	}
+	ok = (fclose(out) == 0) && ok;
+	if (!ok || !replace_file(tmp, fname)) {
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
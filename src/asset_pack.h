@@ -0,0 +1,94 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "mapped_file.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+// One file holding every derived asset: a header, a table of contents sorted
+// by name, then the payloads, each ASSET_PACK_ALIGNMENT aligned. A payload is
+// laid out exactly like the cache file of its kind, so the same readers point
+// into either of them
+#define ASSET_PACK_MAGIC 0x4b434150 // "PACK"
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGNMENT 64
+
+// Longest name of an entry, with its terminating zero
+#define ASSET_NAME_LENGTH 48
+
+// Kinds of payloads
+#define ASSET_MESH 1 // a mesh cache, see mesh_cache.h
+#define ASSET_MIPS 2 // a mip chain cache, see mipmap.h
+#define ASSET_CUBE 3 // a skybox cache, see skybox.h
+#define ASSET_EPHEMERIS 4 // the Chebyshev tables of the orbits, see ephemeris_table.h
+
+struct AssetPackHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t entrySize; // sizeof(AssetPackEntry) of the writer
+	uint64_t tocOffset; // byte offset of the first entry
+	uint64_t reserved[2];
+};
+
+struct AssetPackEntry {
+	char name[ASSET_NAME_LENGTH]; // path of the source under the data folder
+	uint64_t offset; // byte offset of the payload from the start of the pack
+	uint64_t size;
+	uint64_t sourceHash; // hash of the source file, as the payload is keyed on it
+	uint32_t format; // ASSET_*
+	uint32_t reserved;
+};
+
+// A mapped pack, the entries and payloads are read in place
+class AssetPack {
+public:
+	AssetPack() : entries(NULL), count(0) { }
+
+	// Map a pack and check its table of contents, false if it is missing or broken
+	bool open(const std::string &fname);
+
+	void close();
+
+	bool is_open() const { return entries != NULL; }
+
+	// Entry of a source path under the data folder, NULL if it is not packed
+	const AssetPackEntry *find(const std::string &name) const;
+
+	// First byte of the payload of an entry
+	const unsigned char *data(const AssetPackEntry &entry) const { return file.data + entry.offset; }
+
+	// Number of entries
+	uint32_t size() const { return count; }
+
+	// Bytes of the whole pack
+	size_t bytes() const { return file.size; }
+
+private:
+	MappedFile file;
+	const AssetPackEntry *entries;
+	uint32_t count;
+
+	AssetPack(const AssetPack &);
+	AssetPack &operator=(const AssetPack &);
+};
+
+// Collects payloads and writes them out as a pack
+class AssetPackWriter {
+public:
+	// Queue a payload under name, its bytes are taken over; false if the
+	// name is too long or already taken
+	bool add(const std::string &name, uint32_t format, uint64_t sourceHash, std::vector<unsigned char> &bytes);
+
+	// Write every queued payload into a pack, sorting the entries by name
+	bool write(const std::string &fname);
+
+private:
+	struct Asset {
+		AssetPackEntry entry;
+		std::vector<unsigned char> bytes;
+	};
+	std::vector<Asset> assets;
+};
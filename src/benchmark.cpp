@@ -0,0 +1,440 @@
+#include "index.h"
+
+// the programs the bodies were drawn with before the uniform blocks, kept
+// so the benchmark mode replays the old uploads against real locations
+static void set_shaders_legacy(Program *program, Program *shadowMapProgram) {
+    const GLchar *vertex_shader = R"(
+		#version 150 core
+
+        in vec3 position;
+        in vec2 texcoord;
+        in vec3 normal;
+
+        uniform mat4 distort;
+        uniform mat4 model;
+        uniform mat4 view;
+        uniform mat4 proj;
+        uniform mat4 lightMVP;
+
+        out vec2 Texcoord;
+        out vec3 fragPosition;
+        out vec3 fragNormal;
+        out vec4 fragPosLightSpace;
+        out vec3 cloudPosition;
+
+		void main() {
+			gl_Position = distort * proj * view * model * vec4(position, 1.0);
+            fragPosition = vec3(model * vec4(position, 1.0));
+            fragNormal = transpose(inverse(mat3(model))) * normal;
+            Texcoord = texcoord;
+            fragPosLightSpace = lightMVP * vec4(position, 1.0);
+            cloudPosition = position;
+		}
+	)";
+
+    const GLchar *fragment_shader = R"(
+		#version 150 core
+
+        in vec2 Texcoord;
+        in vec3 fragPosition;
+        in vec3 fragNormal;
+        in vec4 fragPosLightSpace;
+        in vec3 cloudPosition;
+
+        uniform mat4 model;
+        uniform mat4 view;
+
+        uniform sampler2D tex;
+        uniform sampler2D shadowMap;
+
+        uniform vec3 lightPosition;
+        uniform vec3 cameraPosition;
+
+        // a flag to show whether should enable shading
+        uniform int enableShading;
+        // whether there is cloud
+        uniform int cloud;
+
+        uniform mat4 cloudModel;
+
+        out vec4 outColor;
+
+        vec3 hash(vec3 p) {
+	        p = vec3(
+                    dot(p, vec3(127.1, 311.7, 74.7)), 
+                    dot(p, vec3(269.5, 183.3, 246.1)), 
+                    dot(p, vec3(113.5, 271.9, 124.6))
+                );
+
+	        return -1.0 + 2.0 * fract(sin(p) * 43758.5453123);
+        }
+
+        float perlin(vec3 p) {
+            vec3 i = floor(p);
+	        vec3 f = fract(p);
+            vec3 u = smoothstep(0, 1, f);
+
+            float s000 = dot(hash(i + vec3(0, 0, 0)), f - vec3(0, 0, 0));
+            float s100 = dot(hash(i + vec3(1, 0, 0)), f - vec3(1, 0, 0));
+            float s110 = dot(hash(i + vec3(1, 1, 0)), f - vec3(1, 1, 0));
+            float s010 = dot(hash(i + vec3(0, 1, 0)), f - vec3(0, 1, 0));
+            float a = mix(mix(s000, s100, u.x), mix(s010, s110, u.x), u.y);
+
+            float s001 = dot(hash(i + vec3(0, 0, 1)), f - vec3(0, 0, 1));
+            float s101 = dot(hash(i + vec3(1, 0, 1)), f - vec3(1, 0, 1));
+            float s111 = dot(hash(i + vec3(1, 1, 1)), f - vec3(1, 1, 1));
+            float s011 = dot(hash(i + vec3(0, 1, 1)), f - vec3(0, 1, 1));
+            float b = mix(mix(s001, s101, u.x), mix(s011, s111, u.x), u.y);
+
+            return mix(a, b, u.z);
+        }
+
+        vec3 noise(vec3 position) {
+            vec3 p = position * 8;
+            float f = perlin(p);
+            f += 0.5000 * perlin(2 * p);
+            f += 0.2500 * perlin(4 * p);
+            f += 0.1250 * perlin(8 * p);
+            return vec3(0.5 * f + 0.5);
+        }
+
+		void main() {
+            vec3 color = texture(tex, Texcoord).rgb;
+
+            if (cloud == 1) {
+                vec3 cloudColor = noise(vec3(view * cloudModel * model * vec4(cloudPosition, 1.0)));
+                color = color + cloudColor;
+            }
+            
+            if (enableShading == 1) {
+                vec3 normal = normalize(fragNormal);
+                vec3 lightColor = vec3(1.0, 1.0, 1.0);
+
+                // ambient
+                vec3 ambient = 0.15 * color;
+
+                // Diffuse
+                vec3 lightDir = normalize(lightPosition - fragPosition);
+                float diff = max(dot(lightDir, normal), 0.0);
+                vec3 diffuse = diff * lightColor;
+
+                // Specular
+                vec3 viewDir = normalize(cameraPosition - fragPosition);
+                vec3 reflectDir = reflect(-lightDir, normal);
+                float spec = 0.0;
+                vec3 halfwayDir = normalize(lightDir + viewDir);  
+                spec = pow(max(dot(normal, halfwayDir), 0.0), 64.0);
+                vec3 specular = spec * lightColor;
+
+                // calculate shadow
+                vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+                projCoords = projCoords * 0.5 + 0.5;
+                float closestDepth = texture(shadowMap, projCoords.xy).r;
+                float currentDepth = projCoords.z;
+
+                float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
+                float shadow = 0.0;
+                vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
+                for (int x = -1; x <= 1; ++x) {
+                    for (int y = -1; y <= 1; ++y) {
+                        float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r; 
+                        shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;        
+                    }    
+                }
+                shadow /= 9.0;
+
+                vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * color;
+
+                outColor = vec4(lighting, 1.0);
+            } else {
+                outColor = vec4(color, 1.0);
+            }
+		}
+	)";
+
+    program->init(vertex_shader, fragment_shader, "outColor");
+
+    const GLchar *shadow_vertex_shader = R"(
+		#version 150 core
+
+        in vec3 position;
+
+        uniform mat4 mvp;
+
+		void main() {
+			gl_Position = mvp * vec4(position, 1.0f);
+		}
+	)";
+
+    const GLchar *shadow_fragment_shader = R"(
+		#version 150 core
+
+        out vec4 outColor;
+
+		void main() {
+            gl_FragDepth = gl_FragCoord.z;
+            outColor = vec4(0.0, 0.0, 0.0, 1.0);
+		}
+	)";
+
+    shadowMapProgram->init(shadow_vertex_shader, shadow_fragment_shader, "outColor");
+}
+
+// the uniform uploads of one frame, the way the baseline render loop issued
+// them: a glGetUniformLocation with a string temporary for every upload, on
+// the baseline programs so every lookup finds its uniform and every upload
+// lands; lookups that found nothing are counted apart
+static void legacy_frame(
+    Program *program,
+    Program *shadowMapProgram,
+    const Eigen::Matrix4f &distort,
+    const Eigen::Matrix4f &cloudModel,
+    unsigned long &calls,
+    unsigned long &missed
+) {
+    GLuint id = shadowMapProgram->program_shader;
+    #define LEGACY(call, name, ...) { \
+        GLint location = glGetUniformLocation(id, string(name).c_str()); \
+        call(location, __VA_ARGS__); \
+        calls += 2; \
+        missed += location < 0; \
+    }
+    const Eigen::Matrix4f lightProj = orthographic(SUN_RADIUS, -SUN_RADIUS, SUN_RADIUS, -SUN_RADIUS, 0.0f, 50.0f);
+    const Eigen::Vector3f up(0.0f, 1.0f, 0.0f);
+    Eigen::Matrix4f depthMVP;
+    // the shadow maps: the earth with mercury, venus and the moon, every
+    // other planet with the planets up to it
+    shadowMapProgram->bind();
+    for (int j : { 0, 1, 3 }) {
+        depthMVP = lightProj * lookAt(Sun.center, Planets[2].center, up) * Planets[j].model;
+        LEGACY(glUniformMatrix4fv, "mvp", 1, GL_FALSE, depthMVP.data());
+    }
+    for (int i = 0; i < Planets.size(); i++) {
+        if (i == 2) {
+            continue;
+        }
+        for (int j = 0; j <= i; j++) {
+            depthMVP = lightProj * lookAt(Sun.center, Planets[i].center, up) * Planets[j].model;
+            LEGACY(glUniformMatrix4fv, "mvp", 1, GL_FALSE, depthMVP.data());
+        }
+    }
+
+    program->bind();
+    id = program->program_shader;
+    LEGACY(glUniform1i, "enableShading", 1);
+    for (int i = 0; i < Planets.size(); i++) {
+        LEGACY(glUniform1i, "tex", 0);
+        LEGACY(glUniform1i, "shadowMap", 1);
+        depthMVP = lightProj * lookAt(Sun.center, Planets[i].center, up) * Planets[i].model;
+        if (i == 2) {
+            LEGACY(glUniform1i, "cloud", 1);
+            LEGACY(glUniformMatrix4fv, "cloudModel", 1, GL_FALSE, cloudModel.data());
+        } else {
+            LEGACY(glUniform1i, "cloud", 0);
+        }
+        LEGACY(glUniformMatrix4fv, "distort", 1, GL_FALSE, distort.data());
+        LEGACY(glUniformMatrix4fv, "model", 1, GL_FALSE, Planets[i].model.data());
+        LEGACY(glUniformMatrix4fv, "view", 1, GL_FALSE, VIEW.data());
+        LEGACY(glUniformMatrix4fv, "proj", 1, GL_FALSE, PROJ.data());
+        LEGACY(glUniformMatrix4fv, "lightMVP", 1, GL_FALSE, depthMVP.data());
+        LEGACY(glUniform3f, "lightPosition", 0.0f, 0.0f, 0.0f);
+        LEGACY(glUniform3f, "cameraPosition", CameraPosition[0], CameraPosition[1], CameraPosition[2]);
+    }
+    // the sun, then the background sphere with its identity model
+    const Eigen::Matrix4f identity = Eigen::Matrix4f::Identity();
+    LEGACY(glUniform1i, "enableShading", 0);
+    const Eigen::Matrix4f *models[] = { &Sun.model, &identity };
+    for (const Eigen::Matrix4f *model : models) {
+        LEGACY(glUniform1i, "tex", 0);
+        LEGACY(glUniformMatrix4fv, "distort", 1, GL_FALSE, distort.data());
+        LEGACY(glUniformMatrix4fv, "model", 1, GL_FALSE, model->data());
+        LEGACY(glUniformMatrix4fv, "view", 1, GL_FALSE, VIEW.data());
+        LEGACY(glUniformMatrix4fv, "proj", 1, GL_FALSE, PROJ.data());
+    }
+    #undef LEGACY
+}
+
+// uniform handles of the baseline programs
+struct UniformHandles {
+    GLint mvp;
+    GLint distort, model, view, proj, lightMVP, lightPosition, cameraPosition;
+    GLint tex, shadowMap, enableShading, cloud, cloudModel;
+};
+
+// the same frame on the same programs through reflected handles and typed
+// setters, the values shared by every body set once
+static void handle_frame(
+    Program *program,
+    Program *shadowMapProgram,
+    const UniformHandles &u,
+    const Eigen::Matrix4f &distort,
+    const Eigen::Matrix4f &cloudModel
+) {
+    const Eigen::Matrix4f lightProj = orthographic(SUN_RADIUS, -SUN_RADIUS, SUN_RADIUS, -SUN_RADIUS, 0.0f, 50.0f);
+    const Eigen::Vector3f up(0.0f, 1.0f, 0.0f);
+    shadowMapProgram->bind();
+    for (int j : { 0, 1, 3 }) {
+        shadowMapProgram->set(u.mvp, Eigen::Matrix4f(lightProj * lookAt(Sun.center, Planets[2].center, up) * Planets[j].model));
+    }
+    for (int i = 0; i < Planets.size(); i++) {
+        if (i == 2) {
+            continue;
+        }
+        for (int j = 0; j <= i; j++) {
+            shadowMapProgram->set(u.mvp, Eigen::Matrix4f(lightProj * lookAt(Sun.center, Planets[i].center, up) * Planets[j].model));
+        }
+    }
+
+    program->bind();
+    program->set(u.enableShading, 1);
+    program->set(u.tex, 0);
+    program->set(u.shadowMap, 1);
+    program->set(u.distort, distort);
+    program->set(u.view, VIEW);
+    program->set(u.proj, PROJ);
+    program->set(u.lightPosition, Eigen::Vector3f(0.0f, 0.0f, 0.0f));
+    program->set(u.cameraPosition, CameraPosition);
+    program->set(u.cloudModel, cloudModel);
+    for (int i = 0; i < Planets.size(); i++) {
+        program->set(u.cloud, i == 2 ? 1 : 0);
+        program->set(u.model, Planets[i].model);
+        program->set(u.lightMVP, Eigen::Matrix4f(lightProj * lookAt(Sun.center, Planets[i].center, up) * Planets[i].model));
+    }
+    program->set(u.enableShading, 0);
+    program->set(u.model, Sun.model);
+    program->set(u.model, Eigen::Matrix4f(Eigen::Matrix4f::Identity()));
+}
+
+// the same frame through the frame block and the instance buffer:
+// three uploads, whatever the number of bodies
+static void instance_frame(const Eigen::Matrix4f &distort, const Eigen::Matrix4f &cloudModel) {
+    update_uniform_blocks(distort, cloudModel);
+    update_instances(distort * PROJ * VIEW);
+}
+
+void benchmark_uniforms(int frames) {
+    typedef std::chrono::high_resolution_clock Clock;
+    Program legacy, legacyShadowMap;
+    set_shaders_legacy(&legacy, &legacyShadowMap);
+    Eigen::Matrix4f distort = Eigen::Matrix4f::Identity();
+    Eigen::Matrix4f cloudModel = Eigen::Matrix4f::Identity();
+
+    glFinish();
+    auto t0 = Clock::now();
+    unsigned long legacyCalls = 0, missed = 0;
+    for (int f = 0; f < frames; f++) {
+        legacy_frame(&legacy, &legacyShadowMap, distort, cloudModel, legacyCalls, missed);
+    }
+    glFinish();
+    double legacyMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+
+    UniformHandles u;
+    u.mvp = legacyShadowMap.uniform("mvp");
+    u.distort = legacy.uniform("distort");
+    u.model = legacy.uniform("model");
+    u.view = legacy.uniform("view");
+    u.proj = legacy.uniform("proj");
+    u.lightMVP = legacy.uniform("lightMVP");
+    u.lightPosition = legacy.uniform("lightPosition");
+    u.cameraPosition = legacy.uniform("cameraPosition");
+    u.tex = legacy.uniform("tex");
+    u.shadowMap = legacy.uniform("shadowMap");
+    u.enableShading = legacy.uniform("enableShading");
+    u.cloud = legacy.uniform("cloud");
+    u.cloudModel = legacy.uniform("cloudModel");
+    // the raw calls above bypassed the recorded values
+    legacy.invalidate_uniforms();
+    legacyShadowMap.invalidate_uniforms();
+    Program::upload_calls = 0;
+    Program::skipped_uploads = 0;
+    glFinish();
+    t0 = Clock::now();
+    for (int f = 0; f < frames; f++) {
+        handle_frame(&legacy, &legacyShadowMap, u, distort, cloudModel);
+        // the model matrices change every frame in the real loop
+        legacy.invalidate_uniforms();
+        legacyShadowMap.invalidate_uniforms();
+    }
+    glFinish();
+    double handleMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    unsigned long uploads = Program::upload_calls, skipped = Program::skipped_uploads;
+    legacy.free();
+    legacyShadowMap.free();
+
+    UniformBufferObject::update_calls = 0;
+    TextureBufferObject::update_calls = 0;
+    glFinish();
+    t0 = Clock::now();
+    for (int f = 0; f < frames; f++) {
+        instance_frame(distort, cloudModel);
+    }
+    glFinish();
+    double instanceMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    unsigned long updates = UniformBufferObject::update_calls + TextureBufferObject::update_calls;
+
+    printf("Uniform microbenchmark, %d frames of %d bodies:\n", frames, (int) Planets.size() + 1);
+    printf("  baseline:       %.1f driver calls/frame, %.2f us/frame, %.1f lookups/frame found nothing\n",
+        double(legacyCalls) / frames, 1000.0 * legacyMs / frames, double(missed) / frames);
+    printf("  handles:        %.1f uploads/frame, %.1f skipped, %.2f us/frame\n",
+        double(uploads) / frames, double(skipped) / frames, 1000.0 * handleMs / frames);
+    printf("  instances:      %.1f buffer uploads/frame, %.2f us/frame\n",
+        double(updates) / frames, 1000.0 * instanceMs / frames);
+    // start the frame statistics from a clean slate
+    Stats = FrameStats();
+    UniformBufferObject::update_calls = 0;
+    UniformBufferObject::bind_calls = 0;
+    TextureBufferObject::update_calls = 0;
+    Program::upload_calls = 0;
+    Program::skipped_uploads = 0;
+}
+
+void count_texture_traffic(int width, int height) {
+    int levels = Textures.level_count();
+    // pixels per unit of the projected radius at distance 1
+    float pixelScale = 0.5f * height * PROJ(1, 1);
+    for (int id : VisibleBodies) {
+        const Mesh &body = id == SUN_INSTANCE ? Sun : Planets[id - PLANET_INSTANCE(0)];
+        float distance = (body.center - CameraPosition).norm();
+        if (distance <= body.radius) {
+            continue;
+        }
+        float radius = max(pixelScale * body.radius / distance, 0.5f);
+        // the visible half of the layer spans the diameter of the disk
+        float texelsPerPixel = 0.5f * TEXTURE_LAYER_WIDTH / (2.0f * radius);
+        float lod = min(max(log2(texelsPerPixel), 0.0f), float(levels - 1));
+        int level = int(lod);
+        double texels = 0.5 * mip_size(TEXTURE_LAYER_WIDTH, level) * mip_size(TEXTURE_LAYER_HEIGHT, level);
+        // trilinear filtering reads the next level too
+        if (lod > level) {
+            texels += 0.5 * mip_size(TEXTURE_LAYER_WIDTH, level + 1) * mip_size(TEXTURE_LAYER_HEIGHT, level + 1);
+        }
+        Stats.texturePixels += min(double(M_PI * radius * radius), double(width) * height);
+        Stats.textureTexels += texels;
+    }
+}
+
+void print_frame_stats() {
+    if (Stats.frames == 0) {
+        return;
+    }
+    double frames = Stats.frames;
+    printf("Benchmark, %lu frames:\n", Stats.frames);
+    printf("  frame time:      %.3f ms\n", Stats.frameMs / frames);
+    printf("  draw calls:      %.1f/frame\n", Stats.drawCalls / frames);
+    printf("  instances:       %.1f/frame\n", Stats.instances / frames);
+    printf("  triangles:       %.0f/frame\n", Stats.triangles / frames);
+    printf("  lod switches:    %lu\n", Stats.lodSwitches);
+    printf("  visible bodies:  %.1f/frame (%.1f culled)\n", Stats.visible / frames, Stats.culled / frames);
+    printf("  shadow casters:  %.1f/frame (%.1f out of range)\n", Stats.shadowCasters / frames, Stats.shadowCulled / frames);
+    printf("  shadow cube:     %lu renders, %lu reuses\n", Stats.shadowRenders, Stats.shadowReuses);
+    printf("  buffer uploads:  %.1f/frame\n",
+        (UniformBufferObject::update_calls + TextureBufferObject::update_calls) / frames);
+    int format = Textures.texel_format();
+    // blocks of 4x4 texels
+    double texelBytes = texture_level_bytes(format, 4, 4) / 16.0;
+    printf("  textures:        %.1f MB %s in %d levels, %.0fx anisotropy\n",
+        Textures.bytes() / 1048576.0, texture_format_name(format), Textures.level_count(), Anisotropy);
+    printf("  texel reads:     %.1f MB/frame, %.1f texels/pixel (estimated)\n",
+        Stats.textureTexels * texelBytes / frames / 1048576.0,
+        Stats.texturePixels > 0 ? Stats.textureTexels / Stats.texturePixels : 0.0);
+}
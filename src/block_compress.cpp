@@ -0,0 +1,245 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "block_compress.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+const char *texture_format_name(int format) {
+	switch (format) {
+		case TEXTURE_FORMAT_BC1: return "bc1";
+		case TEXTURE_FORMAT_BC3: return "bc3";
+		default: return "rgba8";
+	}
+}
+
+static size_t block_bytes(int format) {
+	return format == TEXTURE_FORMAT_BC1 ? 8 : 16;
+}
+
+size_t texture_level_bytes(int format, int width, int height) {
+	if (format == TEXTURE_FORMAT_RGBA8) {
+		return 4 * (size_t) width * height;
+	}
+	return texture_block_row_bytes(format, width) * ((height + 3) / 4);
+}
+
+size_t texture_block_row_bytes(int format, int width) {
+	if (format == TEXTURE_FORMAT_RGBA8) {
+		return 0;
+	}
+	return block_bytes(format) * ((width + 3) / 4);
+}
+
+// 5:6:5 quantization, rounded to the nearest representable color
+static uint16_t pack_565(const float c[3]) {
+	int r = std::min(std::max(int(c[0] * 31.0f / 255.0f + 0.5f), 0), 31);
+	int g = std::min(std::max(int(c[1] * 63.0f / 255.0f + 0.5f), 0), 63);
+	int b = std::min(std::max(int(c[2] * 31.0f / 255.0f + 0.5f), 0), 31);
+	return (uint16_t) ((r << 11) | (g << 5) | b);
+}
+
+// the color a decoder expands 5:6:5 to
+static void unpack_565(uint16_t v, float c[3]) {
+	int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = float((r << 3) | (r >> 2));
+	c[1] = float((g << 2) | (g >> 4));
+	c[2] = float((b << 3) | (b >> 2));
+}
+
+static float distance2(const float a[3], const float b[3]) {
+	float dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+	return dr * dr + dg * dg + db * db;
+}
+
+// Indices of the 16 texels against the four colors of the endpoints,
+// returns the squared error
+static float color_indices(const float texels[16][3], uint16_t c0, uint16_t c1, uint32_t &indices) {
+	float palette[4][3];
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	for (int n = 0; n < 3; n++) {
+		palette[2][n] = (2.0f * palette[0][n] + palette[1][n]) / 3.0f;
+		palette[3][n] = (palette[0][n] + 2.0f * palette[1][n]) / 3.0f;
+	}
+	float error = 0.0f;
+	indices = 0;
+	for (int i = 0; i < 16; i++) {
+		int best = 0;
+		float bestDistance = distance2(texels[i], palette[0]);
+		for (int k = 1; k < 4; k++) {
+			float d = distance2(texels[i], palette[k]);
+			if (d < bestDistance) {
+				best = k;
+				bestDistance = d;
+			}
+		}
+		indices |= uint32_t(best) << (2 * i);
+		error += bestDistance;
+	}
+	return error;
+}
+
+// Endpoints minimizing the squared error for the given indices
+static bool fit_endpoints(const float texels[16][3], uint32_t indices, float e0[3], float e1[3]) {
+	// position of each index between the endpoints
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float aa = 0, ab = 0, bb = 0;
+	float ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		float a = weights[(indices >> (2 * i)) & 3], b = 1.0f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int n = 0; n < 3; n++) {
+			ax[n] += a * texels[i][n];
+			bx[n] += b * texels[i][n];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (std::fabs(det) < 1e-6f) {
+		return false;
+	}
+	for (int n = 0; n < 3; n++) {
+		e0[n] = std::min(std::max((bb * ax[n] - ab * bx[n]) / det, 0.0f), 255.0f);
+		e1[n] = std::min(std::max((aa * bx[n] - ab * ax[n]) / det, 0.0f), 255.0f);
+	}
+	return true;
+}
+
+// Four color block, c0 > c1 so that a bc1 decoder does not switch to three colors
+static void compress_color(const float texels[16][3], unsigned char *out) {
+	float mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		for (int n = 0; n < 3; n++) {
+			mean[n] += texels[i][n] / 16.0f;
+		}
+	}
+	float cov[6] = { 0, 0, 0, 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		float r = texels[i][0] - mean[0], g = texels[i][1] - mean[1], b = texels[i][2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+	// principal axis by power iteration
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+		if (length < 1e-6f) {
+			break;
+		}
+		axis[0] = x / length;
+		axis[1] = y / length;
+		axis[2] = z / length;
+	}
+	float lo = 1e30f, hi = -1e30f;
+	for (int i = 0; i < 16; i++) {
+		float t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] + (texels[i][2] - mean[2]) * axis[2];
+		lo = std::min(lo, t);
+		hi = std::max(hi, t);
+	}
+	float norm2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	float e0[3], e1[3];
+	for (int n = 0; n < 3; n++) {
+		e0[n] = std::min(std::max(mean[n] + axis[n] * hi / norm2, 0.0f), 255.0f);
+		e1[n] = std::min(std::max(mean[n] + axis[n] * lo / norm2, 0.0f), 255.0f);
+	}
+
+	uint16_t c0 = pack_565(e0), c1 = pack_565(e1);
+	uint32_t indices;
+	float error = color_indices(texels, c0, c1, indices);
+	// one least squares pass on the endpoints, kept if it helps
+	if (fit_endpoints(texels, indices, e0, e1)) {
+		uint16_t r0 = pack_565(e0), r1 = pack_565(e1);
+		uint32_t refined;
+		if (color_indices(texels, r0, r1, refined) < error) {
+			c0 = r0;
+			c1 = r1;
+			indices = refined;
+		}
+	}
+	if (c0 < c1) {
+		// swapping the endpoints swaps indices 0 and 1 and 2 and 3
+		std::swap(c0, c1);
+		indices ^= 0x55555555u;
+	} else if (c0 == c1) {
+		indices = 0;
+	}
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	for (int k = 0; k < 4; k++) {
+		out[4 + k] = (indices >> (8 * k)) & 0xff;
+	}
+}
+
+// Eight value alpha block between the smallest and the largest alpha
+static void compress_alpha(const unsigned char alpha[16], unsigned char *out) {
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++) {
+		a0 = std::max(a0, int(alpha[i]));
+		a1 = std::min(a1, int(alpha[i]));
+	}
+	out[0] = (unsigned char) a0;
+	out[1] = (unsigned char) a1;
+	uint64_t indices = 0;
+	if (a0 > a1) {
+		int values[8] = { a0, a1 };
+		for (int k = 2; k < 8; k++) {
+			values[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+		}
+		for (int i = 0; i < 16; i++) {
+			int best = 0;
+			for (int k = 1; k < 8; k++) {
+				if (std::abs(values[k] - alpha[i]) < std::abs(values[best] - alpha[i])) {
+					best = k;
+				}
+			}
+			indices |= uint64_t(best) << (3 * i);
+		}
+	}
+	for (int k = 0; k < 6; k++) {
+		out[2 + k] = (indices >> (8 * k)) & 0xff;
+	}
+}
+
+void compress_blocks(
+	int format,
+	const unsigned char *rgba,
+	int width,
+	int height,
+	int firstRow,
+	int lastRow,
+	unsigned char *out
+) {
+	size_t blockSize = block_bytes(format);
+	int blocksPerRow = (width + 3) / 4;
+	float texels[16][3];
+	unsigned char alpha[16];
+	for (int by = firstRow; by < lastRow; by++) {
+		unsigned char *block = out + (size_t) by * blocksPerRow * blockSize;
+		for (int bx = 0; bx < blocksPerRow; bx++, block += blockSize) {
+			// the edges of levels smaller than a block repeat the last texel
+			for (int i = 0; i < 16; i++) {
+				int x = std::min(4 * bx + (i & 3), width - 1);
+				int y = std::min(4 * by + (i >> 2), height - 1);
+				const unsigned char *p = rgba + 4 * ((size_t) y * width + x);
+				texels[i][0] = p[0];
+				texels[i][1] = p[1];
+				texels[i][2] = p[2];
+				alpha[i] = p[3];
+			}
+			if (format == TEXTURE_FORMAT_BC3) {
+				compress_alpha(alpha, block);
+				compress_color(texels, block + 8);
+			} else {
+				compress_color(texels, block);
+			}
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+////////////////////////////////////////////////////////////////////////////////
+
+// Texel formats of the texture caches and the texture array
+#define TEXTURE_FORMAT_RGBA8 0
+#define TEXTURE_FORMAT_BC1 1 // 4x4 blocks of 8 bytes, rgb
+#define TEXTURE_FORMAT_BC3 2 // 4x4 blocks of 16 bytes, rgb and alpha
+
+// EXT_texture_compression_s3tc, not in the GL 3.2 loader
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+
+// Short name of a format, "rgba8", "bc1" or "bc3"
+const char *texture_format_name(int format);
+
+// Bytes of a width x height image in the format, blocks are padded
+size_t texture_level_bytes(int format, int width, int height);
+
+// Bytes of one row of 4x4 blocks, 0 for RGBA8
+size_t texture_block_row_bytes(int format, int width);
+
+// Encode the rows of blocks [firstRow, lastRow) of a width x height RGBA8
+// image into the level out; the blocks are independent, so the rows can be
+// split between threads. Endpoints lie on the principal axis of each block's
+// colors and are refined by least squares once the indices are known
+void compress_blocks(
+	int format,
+	const unsigned char *rgba,
+	int width,
+	int height,
+	int firstRow,
+	int lastRow,
+	unsigned char *out
+);
@@ -83,6 +83,15 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
             focus_on_earth();
         } else if (key == GLFW_KEY_SPACE) {
             Pause = !Pause;
+        } else if (key == GLFW_KEY_S) {
+            // switch between the shadow cube and the analytic occluders
+            ShadowMode = ShadowMode == SHADOW_MODE_CUBE ? SHADOW_MODE_ANALYTIC : SHADOW_MODE_CUBE;
+        } else if (key == GLFW_KEY_LEFT || key == GLFW_KEY_RIGHT) {
+            // jump a year back or ahead, placed like any other frame
+            SimulationTime += key == GLFW_KEY_RIGHT ? TIME_SEEK_STEP : -TIME_SEEK_STEP;
+        } else if (key == GLFW_KEY_I) {
+            // switch between the sphere meshes and the ray cast impostors
+            Impostors = !Impostors;
         }
     }
 }
\ No newline at end of file
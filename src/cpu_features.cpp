@@ -0,0 +1,41 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "cpu_features.h"
+#if defined(CPU_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+static bool cpu_has_avx2() {
+#if defined(CPU_X86) && (defined(__GNUC__) || defined(__clang__))
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(CPU_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	__cpuidex(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+	// the OS must save the ymm registers too
+	return fma && avx2 && osxsave && (_xgetbv(0) & 6) == 6;
+#else
+	return false;
+#endif
+}
+
+int cpu_best_isa() {
+	static const int isa = cpu_has_avx2() ? CPU_ISA_AVX2 : CPU_ISA_SCALAR;
+	return isa;
+}
+
+int cpu_resolve_isa(int isa) {
+	if (isa == CPU_ISA_AUTO || (isa == CPU_ISA_AVX2 && cpu_best_isa() != CPU_ISA_AVX2)) {
+		return cpu_best_isa();
+	}
+	return isa;
+}
+
+const char *cpu_isa_name(int isa) {
+	return isa == CPU_ISA_AVX2 ? "avx2" : "scalar";
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Instruction sets the batched kernels, the Kepler solver and the N-body
+// forces, can run with, and which of them this processor has
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_X86 1
+#endif
+
+// GCC and Clang only emit AVX2 inside functions marked for it, the rest of
+// a file stays runnable on any x86
+#if defined(CPU_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define CPU_TARGET_AVX2
+#endif
+
+#define CPU_ISA_AUTO -1 // the best one the processor supports
+#define CPU_ISA_SCALAR 0
+#define CPU_ISA_AVX2 1 // with FMA
+
+// Best CPU_ISA_* of this processor
+int cpu_best_isa();
+
+// The instruction set a kernel asked for isa runs with: the best one for
+// CPU_ISA_AUTO, the scalar one for any the processor lacks
+int cpu_resolve_isa(int isa);
+
+// Short name of an instruction set, "scalar" or "avx2"
+const char *cpu_isa_name(int isa);
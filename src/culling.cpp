@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "culling.h"
+#include <cmath>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULLING_SSE
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+void SphereSet::clear() {
+	x.clear(); y.clear(); z.clear(); r.clear();
+	count = 0;
+}
+
+void SphereSet::push(const Eigen::Vector3f &center, float radius) {
+	// keep the arrays a multiple of four, the padding lanes are never reported
+	if (count % 4 == 0) {
+		for (std::vector<float> *a : { &x, &y, &z, &r }) {
+			a->resize(count + 4, 0.0f);
+		}
+	}
+	x[count] = center[0];
+	y[count] = center[1];
+	z[count] = center[2];
+	r[count] = radius;
+	count++;
+}
+
+void extract_frustum(const Eigen::Matrix4f &clip, Frustum &f) {
+	// left, right, bottom, top, near, far: row 3 +/- rows 0, 1 and 2
+	for (int i = 0; i < 6; i++) {
+		float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+		Eigen::Vector4f plane = clip.row(3) + sign * clip.row(i / 2);
+		float norm = plane.head<3>().norm();
+		for (int k = 0; k < 4; k++) {
+			f.planes[i][k] = plane[k] / norm;
+		}
+	}
+}
+
+int cull_spheres(const Frustum &f, const SphereSet &s, std::vector<int> &visible) {
+	visible.clear();
+#ifdef CULLING_SSE
+	// four spheres against one plane per step
+	for (int i = 0; i < s.count; i += 4) {
+		__m128 x = _mm_loadu_ps(&s.x[i]);
+		__m128 y = _mm_loadu_ps(&s.y[i]);
+		__m128 z = _mm_loadu_ps(&s.z[i]);
+		__m128 r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&s.r[i]));
+		__m128 inside = _mm_cmpeq_ps(x, x); // all lanes set
+		for (int p = 0; p < 6; p++) {
+			__m128 a = _mm_set1_ps(f.planes[p][0]);
+			__m128 b = _mm_set1_ps(f.planes[p][1]);
+			__m128 c = _mm_set1_ps(f.planes[p][2]);
+			__m128 d = _mm_set1_ps(f.planes[p][3]);
+			// signed distance of the centers
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, x), _mm_mul_ps(b, y)), _mm_add_ps(_mm_mul_ps(c, z), d));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, r));
+		}
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4 && i + k < s.count; k++) {
+			if (mask & (1 << k)) {
+				visible.push_back(i + k);
+			}
+		}
+	}
+#else
+	for (int i = 0; i < s.count; i++) {
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++) {
+			const float *n = f.planes[p];
+			inside = n[0] * s.x[i] + n[1] * s.y[i] + n[2] * s.z[i] + n[3] >= -s.r[i];
+		}
+		if (inside) {
+			visible.push_back(i);
+		}
+	}
+#endif
+	return (int) visible.size();
+}
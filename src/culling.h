@@ -0,0 +1,30 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <Eigen/Core>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// The six planes of a view frustum, normals pointing inside
+struct Frustum {
+	float planes[6][4]; // a * x + b * y + c * z + d >= 0 inside
+};
+
+// Bounding spheres stored as a structure of arrays, four at a time
+struct SphereSet {
+	std::vector<float> x, y, z, r;
+	int count;
+
+	SphereSet() : count(0) { }
+
+	void clear();
+
+	// Append a sphere
+	void push(const Eigen::Vector3f &center, float radius);
+};
+
+// Extract the normalized planes of a clip space matrix (proj * view)
+void extract_frustum(const Eigen::Matrix4f &clip, Frustum &f);
+
+// Write the index of every sphere touching the frustum, returns their count
+int cull_spheres(const Frustum &f, const SphereSet &spheres, std::vector<int> &visible);
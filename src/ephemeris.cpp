@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "ephemeris.h"
+#include <cmath>
+////////////////////////////////////////////////////////////////////////////////
+
+static const double TWO_PI = 6.28318530717958647692;
+
+static const double DEGREES = TWO_PI / 360.0;
+
+const BodyElements *solar_system_elements() {
+	// the shapes and orientations of the orbits at J2000, the mean anomaly
+	// being the mean longitude less the longitude of the periapsis; the
+	// distances and cycles are the ones of the scene
+	static const BodyElements elements[BODY_COUNT] = {
+		{ -1, SUN_DISTANCE, 0, 0, 0, 0, 0, 0, SUN_ROTATION_CYCLE },
+		{ BODY_SUN, MERCURY_DISTANCE, 0.20563593, 7.00497902 * DEGREES, 48.33076593 * DEGREES,
+			29.12703035 * DEGREES, 174.79252722 * DEGREES, MERCURY_REVOLUTION_CYCLE, MERCURY_ROTATION_CYCLE },
+		{ BODY_SUN, VENUS_DISTANCE, 0.00677672, 3.39467605 * DEGREES, 76.67984255 * DEGREES,
+			54.92262463 * DEGREES, 50.37663232 * DEGREES, VENUS_REVOLUTION_CYCLE, VENUS_ROTATION_CYCLE },
+		{ BODY_SUN, EARTH_DISTANCE, 0.01671123, 0, 0,
+			102.93768193 * DEGREES, -2.47311027 * DEGREES, EARTH_REVOLUTION_CYCLE, EARTH_ROTATION_CYCLE },
+		// the moon used to be carried around by the earth on top of its own
+		// cycle, seen from the stars it turns at the sum of both rates
+		{ BODY_EARTH, MOON_DISTANCE, 0.0549, 5.145 * DEGREES, 125.08 * DEGREES,
+			318.15 * DEGREES, 135.27 * DEGREES,
+			1.0 / (1.0 / MOON_REVOLUTION_CYCLE + 1.0 / EARTH_REVOLUTION_CYCLE), MOON_ROTATION_CYCLE },
+		{ BODY_SUN, MARS_DISTANCE, 0.09339410, 1.84969142 * DEGREES, 49.55953891 * DEGREES,
+			-73.50316850 * DEGREES, 19.39019754 * DEGREES, MARS_REVOLUTION_CYCLE, MARS_ROTATION_CYCLE },
+		{ BODY_SUN, JUPITER_DISTANCE, 0.04838624, 1.30439695 * DEGREES, 100.47390909 * DEGREES,
+			-85.74542926 * DEGREES, 19.66796068 * DEGREES, JUPITER_REVOLUTION_CYCLE, JUPITER_ROTATION_CYCLE },
+		{ BODY_SUN, SATURN_DISTANCE, 0.05386179, 2.48599187 * DEGREES, 113.66242448 * DEGREES,
+			-21.06354617 * DEGREES, -42.64463408 * DEGREES, SATURN_REVOLUTION_CYCLE, SATURN_ROTATION_CYCLE },
+		{ BODY_SUN, URANUS_DISTANCE, 0.04725744, 0.77263783 * DEGREES, 74.01692503 * DEGREES,
+			96.93735127 * DEGREES, 142.28382821 * DEGREES, URANUS_REVOLUTION_CYCLE, URANUS_ROTATION_CYCLE },
+		{ BODY_SUN, NEPTUNE_DISTANCE, 0.00859048, 1.77004347 * DEGREES, 131.78422574 * DEGREES,
+			-86.81946347 * DEGREES, -100.08479196 * DEGREES, NEPTUNE_REVOLUTION_CYCLE, NEPTUNE_ROTATION_CYCLE },
+		{ BODY_SUN, PLUTO_DISTANCE, 0.24882730, 17.14001206 * DEGREES, 110.30393684 * DEGREES,
+			113.76497945 * DEGREES, 14.86012204 * DEGREES, PLUTO_REVOLUTION_CYCLE, PLUTO_ROTATION_CYCLE },
+	};
+	return elements;
+}
+
+static double wrap_angle(double a) {
+	a = std::fmod(a, TWO_PI);
+	return a < 0.0 ? a + TWO_PI : a;
+}
+
+// the same angle in [-pi, pi), where solve_kepler() wants it
+static double wrap_half(double a) {
+	a = wrap_angle(a);
+	return a >= 0.5 * TWO_PI ? a - TWO_PI : a;
+}
+
+double cycle_angle(double t, double cycle) {
+	if (cycle == 0.0) {
+		return 0.0;
+	}
+	return wrap_angle(TWO_PI * (std::fmod(t, cycle) / cycle));
+}
+
+// a times the direction of the periapsis and b times the one a quarter turn
+// ahead, in the scene: the ecliptic x, y and north become x, -z and y
+static void orbit_axes(const BodyElements &e, double major[3], double minor[3]) {
+	double cw = std::cos(e.periapsis), sw = std::sin(e.periapsis);
+	double cn = std::cos(e.node), sn = std::sin(e.node);
+	double ci = std::cos(e.inclination), si = std::sin(e.inclination);
+	double a = e.semiMajorAxis;
+	double b = a * std::sqrt(1.0 - e.eccentricity * e.eccentricity);
+	major[0] = a * (cw * cn - sw * sn * ci);
+	major[1] = a * (sw * si);
+	major[2] = -a * (cw * sn + sw * cn * ci);
+	minor[0] = b * (-sw * cn - cw * sn * ci);
+	minor[1] = b * (cw * si);
+	minor[2] = -b * (-sw * sn + cw * cn * ci);
+}
+
+static double mean_anomaly(double anomaly, double cycle, double t) {
+	return wrap_half(anomaly + cycle_angle(t, cycle));
+}
+
+void orbit_position(const BodyElements &e, double t, double position[3]) {
+	double major[3], minor[3];
+	orbit_axes(e, major, minor);
+	double E = solve_kepler(mean_anomaly(e.meanAnomaly, e.revolutionCycle, t), e.eccentricity);
+	// the ellipse from its center, moved to the focus
+	double x = std::cos(E) - e.eccentricity, y = std::sin(E);
+	for (int k = 0; k < 3; k++) {
+		position[k] = x * major[k] + y * minor[k];
+	}
+}
+
+void orbit_velocity(const BodyElements &e, double t, double mu, double velocity[3]) {
+	velocity[0] = velocity[1] = velocity[2] = 0.0;
+	if (e.semiMajorAxis <= 0.0) {
+		return;
+	}
+	double major[3], minor[3];
+	orbit_axes(e, major, minor);
+	double E = solve_kepler(mean_anomaly(e.meanAnomaly, e.revolutionCycle, t), e.eccentricity);
+	// dE/dt from the mean motion of the ellipse under mu
+	double rate = std::sqrt(mu / (e.semiMajorAxis * e.semiMajorAxis * e.semiMajorAxis)) /
+		(1.0 - e.eccentricity * std::cos(E));
+	for (int k = 0; k < 3; k++) {
+		velocity[k] = rate * (-std::sin(E) * major[k] + std::cos(E) * minor[k]);
+	}
+}
+
+double body_spin(const BodyElements &e, double t) {
+	return wrap_angle(cycle_angle(t, e.revolutionCycle) + cycle_angle(t, e.rotationCycle));
+}
+
+BodyState body_state(const BodyElements *elements, int body, double t) {
+	const BodyElements &e = elements[body];
+	BodyState s;
+	orbit_position(e, t, s.position);
+	if (e.parent >= 0) {
+		BodyState parent = body_state(elements, e.parent, t);
+		for (int k = 0; k < 3; k++) {
+			s.position[k] += parent.position[k];
+		}
+	}
+	s.anomaly = mean_anomaly(e.meanAnomaly, e.revolutionCycle, t);
+	s.spin = body_spin(e, t);
+	return s;
+}
+
+void OrbitTable::init(const BodyElements *elements, int count, int isa) {
+	this->isa = isa;
+	parent.resize(count);
+	eccentricity.resize(count);
+	meanAnomaly.resize(count);
+	revolutionCycle.resize(count);
+	rotationCycle.resize(count);
+	major.resize(3 * (size_t) count);
+	minor.resize(3 * (size_t) count);
+	for (int i = 0; i < count; i++) {
+		const BodyElements &e = elements[i];
+		parent[i] = e.parent;
+		eccentricity[i] = e.eccentricity;
+		meanAnomaly[i] = e.meanAnomaly;
+		revolutionCycle[i] = e.revolutionCycle;
+		rotationCycle[i] = e.rotationCycle;
+		orbit_axes(e, &major[3 * (size_t) i], &minor[3 * (size_t) i]);
+	}
+}
+
+void OrbitTable::evaluate(double t, BodyState *states) const {
+	int count = size();
+	std::vector<double> turn(count), M(count), sinE(count), cosE(count);
+	for (int i = 0; i < count; i++) {
+		turn[i] = cycle_angle(t, revolutionCycle[i]);
+		M[i] = wrap_half(meanAnomaly[i] + turn[i]);
+	}
+	solve_kepler(M.data(), eccentricity.data(), count, sinE.data(), cosE.data(), isa);
+	for (int i = 0; i < count; i++) {
+		BodyState &s = states[i];
+		const double *a = &major[3 * (size_t) i];
+		const double *b = &minor[3 * (size_t) i];
+		double x = cosE[i] - eccentricity[i], y = sinE[i];
+		const double *origin = parent[i] >= 0 ? states[parent[i]].position : NULL;
+		for (int k = 0; k < 3; k++) {
+			s.position[k] = x * a[k] + y * b[k] + (origin != NULL ? origin[k] : 0.0);
+		}
+		s.anomaly = M[i];
+		s.spin = wrap_angle(turn[i] + cycle_angle(t, rotationCycle[i]));
+	}
+}
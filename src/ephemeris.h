@@ -0,0 +1,138 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "kepler.h"
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// Where every body is at a given time, evaluated in closed form: each one
+// follows a Kepler ellipse around its parent and spins about its own y axis.
+// The xz plane is the ecliptic, y its north
+
+// bodies of the scene, in the order of the instance buffer
+#define BODY_SUN 0
+#define BODY_MERCURY 1
+#define BODY_VENUS 2
+#define BODY_EARTH 3
+#define BODY_MOON 4
+#define BODY_MARS 5
+#define BODY_JUPITER 6
+#define BODY_SATURN 7
+#define BODY_URANUS 8
+#define BODY_NEPTUNE 9
+#define BODY_PLUTO 10
+#define BODY_COUNT 11
+
+// distance from each planet to the origin
+#define EARTH_DISTANCE 15.76
+#define SUN_DISTANCE 0
+#define MERCURY_DISTANCE 9.4
+#define VENUS_DISTANCE 12.28
+#define MARS_DISTANCE 18.71
+#define JUPITER_DISTANCE 22.66
+#define SATURN_DISTANCE 29.36
+#define URANUS_DISTANCE 33.86
+#define NEPTUNE_DISTANCE 37.46
+#define PLUTO_DISTANCE 41.06
+// moon's distance to the center of the earth
+#define MOON_DISTANCE 1
+
+// planet rotation and revolution cycle, in seconds, negative ones turn
+// the other way
+// rotation
+#define SUN_ROTATION_CYCLE 70
+#define EARTH_ROTATION_CYCLE 10
+#define MOON_ROTATION_CYCLE 54
+#define MERCURY_ROTATION_CYCLE 120
+#define VENUS_ROTATION_CYCLE -486
+#define MARS_ROTATION_CYCLE 10.06
+#define JUPITER_ROTATION_CYCLE 7.82
+#define SATURN_ROTATION_CYCLE 7.88
+#define URANUS_ROTATION_CYCLE -7.4
+#define NEPTUNE_ROTATION_CYCLE 7.34
+#define PLUTO_ROTATION_CYCLE -17.8
+// revolution
+#define EARTH_REVOLUTION_CYCLE 20
+#define MOON_REVOLUTION_CYCLE 5.79
+#define MERCURY_REVOLUTION_CYCLE 12.4
+#define VENUS_REVOLUTION_CYCLE 16.31
+#define MARS_REVOLUTION_CYCLE 23.64
+#define JUPITER_REVOLUTION_CYCLE 168.2
+#define SATURN_REVOLUTION_CYCLE 294.2
+#define URANUS_REVOLUTION_CYCLE 840
+#define NEPTUNE_REVOLUTION_CYCLE 1650
+#define PLUTO_REVOLUTION_CYCLE 2480
+
+// How a body moves, the angles in radians
+struct BodyElements {
+	int parent; // body it circles, listed before it; -1 if it stays put
+	double semiMajorAxis;
+	double eccentricity;
+	double inclination; // to the ecliptic
+	double node; // longitude of the ascending node
+	double periapsis; // argument of the periapsis, from the node
+	double meanAnomaly; // at time 0
+	double revolutionCycle; // seconds per turn around the parent, 0 for none
+	double rotationCycle; // seconds per turn about its axis, 0 for none
+};
+
+// Where a body is at some time
+struct BodyState {
+	double position[3];
+	// mean anomaly, radians in [-pi, pi)
+	double anomaly;
+	// turn of the body about its y axis, a turn a revolution included since
+	// the body is carried around its orbit, radians in [0, 2 pi)
+	double spin;
+};
+
+// The bodies of the scene, indexed by BODY_*
+const BodyElements *solar_system_elements();
+
+// Angle turned after t seconds of a cycle, radians in [0, 2 pi); the time is
+// wrapped to the cycle first, so the angle stays exact however large t gets
+double cycle_angle(double t, double cycle);
+
+// Position of a body relative to its parent at time t
+void orbit_position(const BodyElements &e, double t, double position[3]);
+
+// Velocity of a body relative to its parent at time t, were it held on its
+// ellipse by gravity alone: mu is G times the masses of both, in scene units
+void orbit_velocity(const BodyElements &e, double t, double mu, double velocity[3]);
+
+// Spin of a body at time t, see BodyState
+double body_spin(const BodyElements &e, double t);
+
+// State of one body at time t, walking up its parents
+BodyState body_state(const BodyElements *elements, int body, double t);
+
+// The elements of many bodies laid out for evaluating them all at once: the
+// ellipses are reduced to two axis vectors each and every Kepler equation of
+// a time goes through one batch of solve_kepler()
+class OrbitTable {
+public:
+	OrbitTable() : isa(CPU_ISA_AUTO) { }
+
+	// Lay out count bodies, the parents before their children, solved with
+	// the CPU_ISA_* instruction set isa
+	void init(const BodyElements *elements, int count, int isa = CPU_ISA_AUTO);
+
+	// Number of bodies
+	int size() const { return (int) parent.size(); }
+
+	// State of every body at time t; const and allocating its own scratch,
+	// so any number of threads can evaluate the same table
+	void evaluate(double t, BodyState *states) const;
+
+private:
+	int isa;
+	std::vector<int> parent;
+	std::vector<double> eccentricity;
+	std::vector<double> meanAnomaly;
+	std::vector<double> revolutionCycle;
+	std::vector<double> rotationCycle;
+	// a times the unit vector to the periapsis, b times the one a quarter
+	// turn ahead along the orbit
+	std::vector<double> major;
+	std::vector<double> minor;
+};
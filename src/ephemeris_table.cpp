@@ -0,0 +1,191 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "ephemeris_table.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+////////////////////////////////////////////////////////////////////////////////
+
+static const double PI = 3.14159265358979323846;
+
+static uint64_t align16(uint64_t offset) {
+	return (offset + 15) & ~(uint64_t) 15;
+}
+
+// series of the three coordinates at x in [-1, 1] by Clenshaw's recurrence,
+// side by side so their chains of multiply-adds overlap
+static inline void clenshaw3(const double *c, double x, double position[3]) {
+	const int n = EPHEMERIS_COEFFICIENTS;
+	double twoX = 2.0 * x;
+	double b1[3] = { 0.0, 0.0, 0.0 }, b2[3] = { 0.0, 0.0, 0.0 };
+	for (int k = n - 1; k >= 1; k--) {
+		for (int axis = 0; axis < 3; axis++) {
+			double b = twoX * b1[axis] + (c[axis * n + k] - b2[axis]);
+			b2[axis] = b1[axis];
+			b1[axis] = b;
+		}
+	}
+	for (int axis = 0; axis < 3; axis++) {
+		position[axis] = x * b1[axis] + (c[axis * n] - b2[axis]);
+	}
+}
+
+bool EphemerisTable::init(const unsigned char *data, size_t size, uint64_t sourceHash) {
+	clear();
+	if (size < sizeof(EphemerisCacheHeader)) {
+		return false;
+	}
+	const EphemerisCacheHeader *h = reinterpret_cast<const EphemerisCacheHeader *>(data);
+	if (h->magic != EPHEMERIS_CACHE_MAGIC ||
+		h->version != EPHEMERIS_CACHE_VERSION ||
+		h->sourceHash != sourceHash ||
+		h->coefficients != EPHEMERIS_COEFFICIENTS ||
+		h->bodyOffset % sizeof(double) != 0 ||
+		h->bodyOffset + (uint64_t) h->bodyCount * sizeof(EphemerisCacheBody) > size) {
+		return false;
+	}
+	// every series inside the file, every parent before its child
+	const EphemerisCacheBody *b = reinterpret_cast<const EphemerisCacheBody *>(data + h->bodyOffset);
+	for (uint32_t i = 0; i < h->bodyCount; i++) {
+		uint64_t bytes = (uint64_t) b[i].segmentCount * 3 * EPHEMERIS_COEFFICIENTS * sizeof(double);
+		if (b[i].parent >= (int32_t) i || b[i].segmentCount == 0 || !(b[i].segmentLength > 0.0) ||
+			b[i].coefficientOffset % sizeof(double) != 0 ||
+			b[i].coefficientOffset > size || bytes > size - b[i].coefficientOffset) {
+			return false;
+		}
+	}
+	header = h;
+	bodies = b;
+	base = data;
+	return true;
+}
+
+void EphemerisTable::relative_position(int body, double t, double position[3]) const {
+	const EphemerisCacheBody &b = bodies[body];
+	double offset = t - header->start;
+	uint32_t segment = std::min((uint32_t) std::max(offset / b.segmentLength, 0.0), b.segmentCount - 1);
+	// the segment mapped to [-1, 1]
+	double x = 2.0 * (offset - segment * b.segmentLength) / b.segmentLength - 1.0;
+	const double *c = reinterpret_cast<const double *>(base + b.coefficientOffset) +
+		(size_t) segment * 3 * EPHEMERIS_COEFFICIENTS;
+	clenshaw3(c, x, position);
+}
+
+void EphemerisTable::position(int body, double t, double position[3]) const {
+	relative_position(body, t, position);
+	for (int i = bodies[body].parent; i >= 0; i = bodies[i].parent) {
+		double p[3];
+		relative_position(i, t, p);
+		for (int k = 0; k < 3; k++) {
+			position[k] += p[k];
+		}
+	}
+}
+
+void EphemerisTable::positions(double t, double (*position)[3]) const {
+	for (int i = 0; i < size(); i++) {
+		relative_position(i, t, position[i]);
+		if (bodies[i].parent >= 0) {
+			for (int k = 0; k < 3; k++) {
+				position[i][k] += position[bodies[i].parent][k];
+			}
+		}
+	}
+}
+
+uint64_t ephemeris_hash(const BodyElements *elements, int count, double start, double span) {
+	std::vector<double> key;
+	for (int i = 0; i < count; i++) {
+		const BodyElements &e = elements[i];
+		double values[] = { (double) e.parent, e.semiMajorAxis, e.eccentricity, e.inclination,
+			e.node, e.periapsis, e.meanAnomaly, e.revolutionCycle };
+		key.insert(key.end(), values, values + 8);
+	}
+	double layout[] = { start, span, EPHEMERIS_COEFFICIENTS, EPHEMERIS_SEGMENTS_PER_TURN };
+	key.insert(key.end(), layout, layout + 4);
+	return hash_bytes(key.data(), key.size() * sizeof(double));
+}
+
+// the series of a coordinate through its values at the Chebyshev nodes
+static void fit_series(const double *values, double *c) {
+	const int n = EPHEMERIS_COEFFICIENTS;
+	for (int j = 0; j < n; j++) {
+		double sum = 0.0;
+		for (int k = 0; k < n; k++) {
+			sum += values[k] * std::cos(PI * j * (k + 0.5) / n);
+		}
+		c[j] = (j == 0 ? 1.0 : 2.0) * sum / n;
+	}
+}
+
+void encode_ephemeris_cache(
+	const BodyElements *elements,
+	int count,
+	double start,
+	double span,
+	std::vector<unsigned char> &bytes
+) {
+	const int n = EPHEMERIS_COEFFICIENTS;
+	EphemerisCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = EPHEMERIS_CACHE_MAGIC;
+	header.version = EPHEMERIS_CACHE_VERSION;
+	header.sourceHash = ephemeris_hash(elements, count, start, span);
+	header.start = start;
+	header.span = span;
+	header.bodyCount = count;
+	header.coefficients = n;
+	header.bodyOffset = align16(sizeof(header));
+
+	// a body that stays put needs a single segment
+	std::vector<EphemerisCacheBody> bodies(count);
+	uint64_t offset = align16(header.bodyOffset + count * sizeof(EphemerisCacheBody));
+	for (int i = 0; i < count; i++) {
+		double cycle = std::fabs(elements[i].revolutionCycle);
+		uint32_t segments = 1;
+		if (cycle > 0.0) {
+			segments = (uint32_t) std::max(1.0, std::ceil(span / cycle * EPHEMERIS_SEGMENTS_PER_TURN));
+		}
+		bodies[i].parent = elements[i].parent;
+		bodies[i].segmentCount = segments;
+		bodies[i].segmentLength = span > 0.0 ? span / segments : 1.0;
+		bodies[i].coefficientOffset = offset;
+		offset += (uint64_t) segments * 3 * n * sizeof(double);
+	}
+
+	bytes.assign(offset, 0);
+	memcpy(&bytes[0], &header, sizeof(header));
+	memcpy(&bytes[header.bodyOffset], bodies.data(), count * sizeof(EphemerisCacheBody));
+	for (int i = 0; i < count; i++) {
+		const EphemerisCacheBody &b = bodies[i];
+		double *c = reinterpret_cast<double *>(&bytes[b.coefficientOffset]);
+		double values[3][EPHEMERIS_COEFFICIENTS];
+		for (uint32_t s = 0; s < b.segmentCount; s++) {
+			double t0 = start + s * b.segmentLength;
+			for (int k = 0; k < n; k++) {
+				// the nodes from the end of the segment back to its start
+				double x = std::cos(PI * (k + 0.5) / n);
+				double p[3];
+				orbit_position(elements[i], t0 + 0.5 * (x + 1.0) * b.segmentLength, p);
+				values[0][k] = p[0];
+				values[1][k] = p[1];
+				values[2][k] = p[2];
+			}
+			for (int axis = 0; axis < 3; axis++) {
+				fit_series(values[axis], c + ((size_t) s * 3 + axis) * n);
+			}
+		}
+	}
+}
+
+bool write_ephemeris_cache(
+	const std::string &fname,
+	const BodyElements *elements,
+	int count,
+	double start,
+	double span
+) {
+	std::vector<unsigned char> bytes;
+	encode_ephemeris_cache(elements, count, start, span, bytes);
+	return write_file(fname, bytes);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "ephemeris.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+// Precomputed positions of the bodies over a span of time, the way the JPL
+// ephemerides store them: each body's position relative to its parent is cut
+// into segments of equal length and every coordinate of a segment is a
+// Chebyshev series. A lookup is a Clenshaw recurrence, one multiply-add per
+// coefficient. The file is mapped and read in place
+#define EPHEMERIS_CACHE_MAGIC 0x42454843 // "CHEB"
+#define EPHEMERIS_CACHE_VERSION 1
+
+// Coefficients of each coordinate of a segment, the series is of one less degree
+#define EPHEMERIS_COEFFICIENTS 11
+// Segments a revolution is cut into, shorter ones fit better
+#define EPHEMERIS_SEGMENTS_PER_TURN 8
+// Seconds covered from time 0 unless told otherwise, a hundred years of the earth
+#define EPHEMERIS_SPAN (100 * EARTH_REVOLUTION_CYCLE)
+
+struct EphemerisCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash; // of the elements and the span, see ephemeris_hash()
+	double start; // first second covered
+	double span; // seconds covered from start
+	uint32_t bodyCount;
+	uint32_t coefficients; // EPHEMERIS_COEFFICIENTS of the writer
+	uint64_t bodyOffset; // byte offset of the first EphemerisCacheBody
+	uint64_t reserved[2];
+};
+
+struct EphemerisCacheBody {
+	int32_t parent; // the positions are relative to it, -1 for none
+	uint32_t segmentCount;
+	double segmentLength; // seconds
+	// byte offset of the segments, each holding the series of x, y then z
+	uint64_t coefficientOffset;
+};
+
+// A validated table, pointing into a mapping or a packed copy
+class EphemerisTable {
+public:
+	EphemerisTable() : header(NULL), bodies(NULL), base(NULL) { }
+
+	// Validate the bytes of a table against the source hash and point into them
+	bool init(const unsigned char *data, size_t size, uint64_t sourceHash);
+
+	void clear() { header = NULL; bodies = NULL; base = NULL; }
+
+	bool is_valid() const { return header != NULL; }
+
+	// Whether time t is inside the span of the table
+	bool covers(double t) const {
+		return header != NULL && t >= header->start && t <= header->start + header->span;
+	}
+
+	int size() const { return header != NULL ? (int) header->bodyCount : 0; }
+
+	// Position of a body relative to its parent at a covered time t
+	void relative_position(int body, double t, double position[3]) const;
+
+	// Position of a body at a covered time t, its parents added in
+	void position(int body, double t, double position[3]) const;
+
+	// Position of every body at a covered time t, the parents added in
+	void positions(double t, double (*position)[3]) const;
+
+private:
+	const EphemerisCacheHeader *header;
+	const EphemerisCacheBody *bodies;
+	const unsigned char *base;
+};
+
+// Key of a table: the elements it was fit to, its span and its layout
+uint64_t ephemeris_hash(const BodyElements *elements, int count, double start, double span);
+
+// Fit the tables of count bodies from start to start + span and lay them out
+// as a cache file in memory
+void encode_ephemeris_cache(
+	const BodyElements *elements,
+	int count,
+	double start,
+	double span,
+	std::vector<unsigned char> &bytes
+);
+
+// Fit the tables and write them into a cache file
+bool write_ephemeris_cache(
+	const std::string &fname,
+	const BodyElements *elements,
+	int count,
+	double start,
+	double span
+);
@@ -2,6 +2,9 @@
 #include "helpers.h"
 #include <iostream>
 #include <fstream>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
 ////////////////////////////////////////////////////////////////////////////////
 
 void VertexBufferObject::init(GLenum st, GLenum bt) {
@@ -11,6 +14,22 @@ void VertexBufferObject::init(GLenum st, GLenum bt) {
 	check_gl_error();
 }
 
+void VertexBufferObject::update(const void *data, GLuint rows, GLuint cols) {
+	assert(id != 0);
+	// every supported scalar type is four bytes wide
+	assert(scalar_type == GL_FLOAT || scalar_type == GL_INT || scalar_type == GL_UNSIGNED_INT);
+	int current_vao;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &current_vao);
+	glBindVertexArray(0); // Make sure to not affect the current VAO
+	glBindBuffer(this->buffer_type, id);
+	glBufferData(this->buffer_type, 4 * (size_t) rows * cols, data, GL_DYNAMIC_DRAW);
+	glBindBuffer(this->buffer_type, 0);
+	this->rows = rows;
+	this->cols = cols;
+	check_gl_error();
+	glBindVertexArray(current_vao);
+}
+
 void VertexBufferObject::bind() {
 	glBindBuffer(this->buffer_type, id);
 	check_gl_error();
@@ -51,14 +70,102 @@ void VertexArrayObject::free() {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+unsigned long UniformBufferObject::update_calls = 0;
+unsigned long UniformBufferObject::bind_calls = 0;
+
+void UniformBufferObject::init() {
+	glGenBuffers(1, &id);
+	check_gl_error();
+}
+
+void UniformBufferObject::update(const void *data, GLsizeiptr bytes) {
+	assert(id != 0);
+	glBindBuffer(GL_UNIFORM_BUFFER, id);
+	// respecifying the storage lets the driver rename it instead of stalling
+	glBufferData(GL_UNIFORM_BUFFER, bytes, data, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	size = bytes;
+	update_calls++;
+	check_gl_error();
+}
+
+void UniformBufferObject::bind_range(GLuint binding, GLintptr offset, GLsizeiptr bytes) {
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, id, offset, bytes);
+	bind_calls++;
+	check_gl_error();
+}
+
+void UniformBufferObject::free() {
+	glDeleteBuffers(1, &id);
+	id = 0;
+	check_gl_error();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long TextureBufferObject::update_calls = 0;
+
+void TextureBufferObject::init(GLenum f) {
+	format = f;
+	glGenBuffers(1, &buffer);
+	glGenTextures(1, &texture);
+	// the texture keeps pointing at the buffer when its storage is respecified
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	check_gl_error();
+}
+
+void TextureBufferObject::update(const void *data, GLsizeiptr bytes) {
+	assert(buffer != 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	update_calls++;
+	check_gl_error();
+}
+
+void TextureBufferObject::bind(GLuint unit) {
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+	check_gl_error();
+}
+
+void TextureBufferObject::free() {
+	glDeleteTextures(1, &texture);
+	glDeleteBuffers(1, &buffer);
+	texture = buffer = 0;
+	check_gl_error();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool Program::init(
+	const std::string &vertex_shader_string,
+	const std::string &fragment_shader_string,
+	const std::string &fragment_data_name)
+{
+	return init(vertex_shader_string, "", fragment_shader_string, fragment_data_name);
+}
+
 bool Program::init(
 	const std::string &vertex_shader_string,
+	const std::string &geometry_shader_string,
 	const std::string &fragment_shader_string,
 	const std::string &fragment_data_name)
 {
 	using namespace std;
 	vertex_shader = create_shader_helper(GL_VERTEX_SHADER, vertex_shader_string);
 	fragment_shader = create_shader_helper(GL_FRAGMENT_SHADER, fragment_shader_string);
+	// the geometry stage is optional
+	if (!geometry_shader_string.empty()) {
+		geometry_shader = create_shader_helper(GL_GEOMETRY_SHADER, geometry_shader_string);
+		if (!geometry_shader) {
+			return false;
+		}
+	}
 
 	if (!vertex_shader || !fragment_shader) {
 		return false;
@@ -67,6 +174,9 @@ bool Program::init(
 	program_shader = glCreateProgram();
 
 	glAttachShader(program_shader, vertex_shader);
+	if (geometry_shader) {
+		glAttachShader(program_shader, geometry_shader);
+	}
 	glAttachShader(program_shader, fragment_shader);
 
 	glBindFragDataLocation(program_shader, 0, fragment_data_name.c_str());
@@ -83,21 +193,138 @@ bool Program::init(
 		return false;
 	}
 
+	reflect();
 	check_gl_error();
 	return true;
 }
 
+unsigned long Program::upload_calls = 0;
+unsigned long Program::skipped_uploads = 0;
+
+static bool variable_less(const Program::Variable &a, const Program::Variable &b) {
+	return a.name < b.name;
+}
+
+void Program::reflect() {
+	uniforms.clear();
+	attributes.clear();
+	char name[256];
+	GLint count;
+	GLint length;
+
+	glGetProgramiv(program_shader, GL_ACTIVE_UNIFORMS, &count);
+	for (GLint i = 0; i < count; i++) {
+		Variable v;
+		glGetActiveUniform(program_shader, i, sizeof(name), &length, &v.size, &v.type, name);
+		v.location = glGetUniformLocation(program_shader, name);
+		if (v.location < 0) {
+			continue; // members of uniform blocks have no location
+		}
+		v.name.assign(name, length);
+		// arrays are reported as "name[0]"
+		if (v.name.size() > 3 && v.name.compare(v.name.size() - 3, 3, "[0]") == 0) {
+			v.name.resize(v.name.size() - 3);
+		}
+		uniforms.push_back(v);
+	}
+
+	glGetProgramiv(program_shader, GL_ACTIVE_ATTRIBUTES, &count);
+	for (GLint i = 0; i < count; i++) {
+		Variable v;
+		glGetActiveAttrib(program_shader, i, sizeof(name), &length, &v.size, &v.type, name);
+		v.location = glGetAttribLocation(program_shader, name);
+		v.name.assign(name, length);
+		attributes.push_back(v);
+	}
+
+	std::sort(uniforms.begin(), uniforms.end(), variable_less);
+	std::sort(attributes.begin(), attributes.end(), variable_less);
+
+	// one value slot per location
+	GLint slots = 0;
+	for (const Variable &v : uniforms) {
+		slots = std::max(slots, v.location + v.size);
+	}
+	uniform_values.assign(16 * slots, 0.0f);
+	uniform_valid.assign(slots, 0);
+}
+
+static GLint find_location(const std::vector<Program::Variable> &table, const std::string &name) {
+	Program::Variable key;
+	key.name = name;
+	auto it = std::lower_bound(table.begin(), table.end(), key, variable_less);
+	if (it == table.end() || it->name != name) {
+		return -1;
+	}
+	return it->location;
+}
+
+bool Program::changed(GLint location, const void *value, size_t bytes) {
+	if (location < 0) {
+		return false; // optimized out, like glUniform with -1
+	}
+	if (location < (GLint) uniform_valid.size()) {
+		float *slot = &uniform_values[16 * location];
+		if (uniform_valid[location] && memcmp(slot, value, bytes) == 0) {
+			skipped_uploads++;
+			return false;
+		}
+		memcpy(slot, value, bytes);
+		uniform_valid[location] = 1;
+	}
+	upload_calls++;
+	return true;
+}
+
+void Program::set(GLint location, int value) {
+	if (changed(location, &value, sizeof(value))) {
+		glUniform1i(location, value);
+	}
+}
+
+void Program::set(GLint location, float value) {
+	if (changed(location, &value, sizeof(value))) {
+		glUniform1f(location, value);
+	}
+}
+
+void Program::set(GLint location, const Eigen::Vector3f &value) {
+	if (changed(location, value.data(), 3 * sizeof(float))) {
+		glUniform3fv(location, 1, value.data());
+	}
+}
+
+void Program::set(GLint location, const Eigen::Matrix4f &value) {
+	if (changed(location, value.data(), 16 * sizeof(float))) {
+		glUniformMatrix4fv(location, 1, GL_FALSE, value.data());
+	}
+}
+
+void Program::invalidate_uniforms() {
+	std::fill(uniform_valid.begin(), uniform_valid.end(), 0);
+}
+
 void Program::bind() {
 	glUseProgram(program_shader);
 	check_gl_error();
 }
 
 GLint Program::attrib(const std::string &name) const {
-	return glGetAttribLocation(program_shader, name.c_str());
+	return find_location(attributes, name);
 }
 
 GLint Program::uniform(const std::string &name) const {
-	return glGetUniformLocation(program_shader, name.c_str());
+	return find_location(uniforms, name);
+}
+
+bool Program::bindUniformBlock(const std::string &name, GLuint binding) const {
+	GLuint index = glGetUniformBlockIndex(program_shader, name.c_str());
+	if (index == GL_INVALID_INDEX) {
+		return false;
+	}
+	glUniformBlockBinding(program_shader, index, binding);
+	check_gl_error();
+	return true;
 }
 
 GLint Program::bindVertexAttribArray(const std::string &name, VertexBufferObject& VBO) const {
@@ -122,10 +349,18 @@ void Program::free() {
 		glDeleteProgram(program_shader);
 		program_shader = 0;
 	}
+	uniforms.clear();
+	attributes.clear();
+	uniform_values.clear();
+	uniform_valid.clear();
 	if (vertex_shader) {
 		glDeleteShader(vertex_shader);
 		vertex_shader = 0;
 	}
+	if (geometry_shader) {
+		glDeleteShader(geometry_shader);
+		geometry_shader = 0;
+	}
 	if (fragment_shader) {
 		glDeleteShader(fragment_shader);
 		fragment_shader = 0;
@@ -167,6 +402,34 @@ GLuint Program::create_shader_helper(GLint type, const std::string &shader_strin
 
 ////////////////////////////////////////////////////////////////////////////////
 
+bool has_gl_extension(const char *name) {
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char *extension = (const char *) glGetStringi(GL_EXTENSIONS, i);
+		if (extension != NULL && strcmp(extension, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+float set_anisotropy(GLenum target, float level) {
+	static const bool supported =
+		has_gl_extension("GL_EXT_texture_filter_anisotropic") ||
+		has_gl_extension("GL_ARB_texture_filter_anisotropic");
+	if (!supported || level <= 1.0f) {
+		return 1.0f;
+	}
+	GLfloat limit = 1.0f;
+	glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &limit);
+	level = std::min(level, limit);
+	glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY, level);
+	return level;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void _check_gl_error(const char *file, int line) {
 	GLenum err (glGetError());
 
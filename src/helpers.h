@@ -33,6 +33,9 @@ public:
 	template<typename Derived>
 	void update(const Eigen::PlainObjectBase<Derived>& M);
 
+	// Updates the VBO with rows x cols scalars of the VBO type, stored column by column
+	void update(const void *data, GLuint rows, GLuint cols);
+
 	// Select this VBO for subsequent draw calls
 	void bind();
 
@@ -66,23 +69,104 @@ public:
 
 // -----------------------------------------------------------------------------
 
+// A uniform buffer, attached to binding points shared by the programs
+class UniformBufferObject {
+public:
+	typedef unsigned int GLuint;
+
+	GLuint id;
+	GLsizeiptr size; // bytes allocated by the last update
+
+	UniformBufferObject() : id(0), size(0) { }
+
+	// Buffer uploads and range binds issued, for the benchmark mode
+	static unsigned long update_calls;
+	static unsigned long bind_calls;
+
+	// Create a new empty buffer
+	void init();
+
+	// Replace the whole content with a single upload
+	void update(const void *data, GLsizeiptr bytes);
+
+	// Attach a range of the buffer to a uniform block binding point
+	void bind_range(GLuint binding, GLintptr offset, GLsizeiptr bytes);
+
+	// Release the id
+	void free();
+};
+
+// -----------------------------------------------------------------------------
+
+// A buffer read by the shaders through a buffer texture (samplerBuffer)
+class TextureBufferObject {
+public:
+	typedef unsigned int GLuint;
+
+	GLuint buffer;
+	GLuint texture;
+	GLenum format; // texel format, see http://docs.gl/gl3/glTexBuffer
+
+	TextureBufferObject() : buffer(0), texture(0), format(GL_RGBA32F) { }
+
+	// Buffer uploads issued, for the benchmark mode
+	static unsigned long update_calls;
+
+	// Create a new empty buffer and its texture
+	void init(GLenum format);
+
+	// Replace the whole content with a single upload
+	void update(const void *data, GLsizeiptr bytes);
+
+	// Select the buffer texture on a texture unit
+	void bind(GLuint unit);
+
+	// Release the ids
+	void free();
+};
+
+// -----------------------------------------------------------------------------
+
 // This class wraps an OpenGL program composed of two shaders
 class Program {
 public:
 	typedef unsigned int GLuint;
 	typedef int GLint;
 
+	// An active uniform or attribute, reflected once after linking
+	struct Variable {
+		std::string name;
+		GLint location;
+		GLenum type;
+		GLint size; // number of array elements
+	};
+
 	GLuint vertex_shader;
+	GLuint geometry_shader;
 	GLuint fragment_shader;
 	GLuint program_shader;
 
-	Program() : vertex_shader(0), fragment_shader(0), program_shader(0) { }
+	// Active variables sorted by name
+	std::vector<Variable> uniforms;
+	std::vector<Variable> attributes;
+
+	// GL calls made through the uniform path of every program
+	static unsigned long upload_calls;
+	static unsigned long skipped_uploads;
+
+	Program() : vertex_shader(0), geometry_shader(0), fragment_shader(0), program_shader(0) { }
 
 	// Create a new shader from the specified source strings
 	bool init(const std::string &vertex_shader_string,
 		const std::string &fragment_shader_string,
 		const std::string &fragment_data_name);
 
+	// Same with a geometry shader between the vertex and the fragment stage
+	bool init(const std::string &vertex_shader_string,
+		const std::string &geometry_shader_string,
+		const std::string &fragment_shader_string,
+		const std::string &fragment_data_name);
+
 	// Select this shader for subsequent draw calls
 	void bind();
 
@@ -93,16 +177,54 @@ public:
 	GLint attrib(const std::string &name) const;
 
 	// Return the OpenGL handle of a uniform attribute (-1 if it does not exist)
+	// Looked up in the reflected table, look handles up once and keep them
 	GLint uniform(const std::string &name) const;
 
+	// Typed setters keyed by a handle from uniform(), the program must be bound
+	// Values equal to the last upload to the same handle are skipped
+	void set(GLint location, int value);
+	void set(GLint location, float value);
+	void set(GLint location, const Eigen::Vector3f &value);
+	void set(GLint location, const Eigen::Matrix4f &value);
+
+	// Forget the recorded uniform values, after uploads made with raw GL calls
+	void invalidate_uniforms();
+
+	// Read a named uniform block from a binding point (false if it does not exist)
+	bool bindUniformBlock(const std::string &name, GLuint binding) const;
+
 	// Bind a per-vertex array attribute
 	GLint bindVertexAttribArray(const std::string &name, VertexBufferObject& VBO) const;
 
 	GLuint create_shader_helper(GLint type, const std::string &shader_string);
+
+private:
+	// Last value uploaded per uniform location, 16 floats each
+	std::vector<float> uniform_values;
+	std::vector<char> uniform_valid;
+
+	// Read the active uniforms and attributes from the linked program
+	void reflect();
+
+	// Record the value of a uniform, false if the upload can be skipped
+	bool changed(GLint location, const void *value, size_t bytes);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// EXT/ARB_texture_filter_anisotropic, core only since 4.6
+#define GL_TEXTURE_MAX_ANISOTROPY 0x84FE
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY 0x84FF
+
+// True if the context lists the extension
+bool has_gl_extension(const char *name);
+
+// Set the anisotropy of the texture bound to target, clamped to what the
+// driver supports; returns the level set, 1 without the extension
+float set_anisotropy(GLenum target, float level);
+
+////////////////////////////////////////////////////////////////////////////////
+
 // From: https://blog.nobel-joergensen.com/2013/01/29/debugging-opengl-using-glgeterror/
 void _check_gl_error(const char *file, int line);
 
@@ -127,14 +249,5 @@ void VertexBufferObject::update(const Eigen::PlainObjectBase<Derived>& M) {
 		default:
 			throw std::runtime_error("OpenGL type not supported in VertexBufferObject class.");
 	}
-	int current_vao;
-	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &current_vao);
-	glBindVertexArray(0); // Make sure to not affect the current VAO
-	glBindBuffer(this->buffer_type, id);
-	glBufferData(this->buffer_type, sizeof(typename Derived::Scalar)*M.size(), M.data(), GL_DYNAMIC_DRAW);
-	glBindBuffer(this->buffer_type, 0);
-	rows = M.rows();
-	cols = M.cols();
-	check_gl_error();
-	glBindVertexArray(current_vao);
+	update(M.data(), M.rows(), M.cols());
 }
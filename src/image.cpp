@@ -4,29 +4,212 @@
 #define STB_IMAGE_IMPLEMENTATION // Do not include this line twice in your project!
 
 #include "stb_image.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <new>
+#include <stdexcept>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define IMAGE_SSSE3
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define IMAGE_SSE2
+#endif
 ////////////////////////////////////////////////////////////////////////////////
 
+// entries of the table encoding linear values back to srgb
+#define SRGB_ENCODE_STEPS 4096
+
+static unsigned char *allocate_aligned(size_t bytes) {
+#ifdef _WIN32
+    return (unsigned char *) _aligned_malloc(bytes, IMAGE_ALIGNMENT);
+#else
+    void *p = NULL;
+    return posix_memalign(&p, IMAGE_ALIGNMENT, bytes) == 0 ? (unsigned char *) p : NULL;
+#endif
+}
+
+static void free_aligned(unsigned char *p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+void Image::resize(int w, int h, int f) {
+    release();
+    width = w;
+    height = h;
+    format = f;
+    stride = (row_bytes() + IMAGE_ALIGNMENT - 1) & ~size_t(IMAGE_ALIGNMENT - 1);
+    buffer = allocate_aligned(stride * height);
+    if (buffer == NULL) {
+        throw std::bad_alloc();
+    }
+}
+
+void Image::release() {
+    free_aligned(buffer);
+    buffer = NULL;
+    width = height = 0;
+    stride = 0;
+}
+
+void Image::swap(Image &other) {
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    std::swap(stride, other.stride);
+    std::swap(format, other.format);
+    std::swap(buffer, other.buffer);
+}
+
 bool load_image(const std::string &fname, Image &pixels) {
-    int width, height, num_raw_channels;
-    unsigned char *data = stbi_load(fname.c_str(), &width, &height, &num_raw_channels, 4);
+    int width, height, channels;
+    if (!stbi_info(fname.c_str(), &width, &height, &channels)) {
+        return false;
+    }
+    // rgb is expanded on the copy, the decoder expands everything else
+    int wanted = channels == 3 ? 3 : 4;
+    unsigned char *data = stbi_load(fname.c_str(), &width, &height, &channels, wanted);
 
     // An error is indicated by stbi_load() returning NULL.
     if (data == 0) {
-        stbi_image_free(data);
         return false;
     }
 
+    // the file starts with the top row, flipped on the copy
     pixels.resize(width, height);
-    std::copy(data, data + width * height * sizeof(Pixel),
-              reinterpret_cast<unsigned char *> (pixels.data()));
-    pixels = pixels.rowwise().reverse().eval();
+    for (int y = 0; y < height; y++) {
+        const unsigned char *src = data + (size_t) (height - 1 - y) * width * wanted;
+        if (wanted == 3) {
+            rgb_to_rgba(src, pixels.row(y), width);
+        } else {
+            memcpy(pixels.row(y), src, (size_t) width * 4);
+        }
+    }
 
     stbi_image_free(data);
 
     return true;
 }
 
+void resample_image(const Image &src, Image &dst, int w, int h) {
+    dst.resize(w, h);
+    float sx = float(src.width) / w;
+    float sy = float(src.height) / h;
+    for (int y = 0; y < h; y++) {
+        float fy = std::min(std::max((y + 0.5f) * sy - 0.5f, 0.0f), float(src.height - 1));
+        int y0 = int(fy);
+        int y1 = std::min(y0 + 1, src.height - 1);
+        float ty = fy - y0;
+        const unsigned char *row0 = src.row(y0), *row1 = src.row(y1);
+        unsigned char *out = dst.row(y);
+        for (int x = 0; x < w; x++) {
+            float fx = std::min(std::max((x + 0.5f) * sx - 0.5f, 0.0f), float(src.width - 1));
+            int x0 = int(fx);
+            int x1 = std::min(x0 + 1, src.width - 1);
+            float tx = fx - x0;
+            for (int n = 0; n < 4; n++) {
+                float top = (1 - tx) * row0[4 * x0 + n] + tx * row0[4 * x1 + n];
+                float bottom = (1 - tx) * row1[4 * x0 + n] + tx * row1[4 * x1 + n];
+                out[4 * x + n] = (unsigned char) ((1 - ty) * top + ty * bottom + 0.5f);
+            }
+        }
+    }
+}
+
+void rgb_to_rgba(const unsigned char *rgb, unsigned char *rgba, size_t count) {
+    size_t i = 0;
+#ifdef IMAGE_SSSE3
+    // 4 pixels a step, the 16 byte load reads 4 bytes past them
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i opaque = _mm_set1_epi32(0xff000000);
+    for (; i + 6 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i *) (rgb + 3 * i));
+        _mm_storeu_si128((__m128i *) (rgba + 4 * i), _mm_or_si128(_mm_shuffle_epi8(p, spread), opaque));
+    }
+#endif
+    for (; i < count; i++) {
+        rgba[4 * i + 0] = rgb[3 * i + 0];
+        rgba[4 * i + 1] = rgb[3 * i + 1];
+        rgba[4 * i + 2] = rgb[3 * i + 2];
+        rgba[4 * i + 3] = 255;
+    }
+}
+
+static float srgb_decode(float c) {
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float srgb_encode(float c) {
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// an 8 bit channel indexes the decoded value exactly, the encoder rounds
+// to the closest of SRGB_ENCODE_STEPS linear values
+struct SrgbTables {
+    float decode[256];
+    unsigned char encode[SRGB_ENCODE_STEPS + 1];
+
+    SrgbTables() {
+        for (int i = 0; i < 256; i++) {
+            decode[i] = srgb_decode(i / 255.0f);
+        }
+        for (int i = 0; i <= SRGB_ENCODE_STEPS; i++) {
+            encode[i] = (unsigned char) (255.0f * srgb_encode(float(i) / SRGB_ENCODE_STEPS) + 0.5f);
+        }
+    }
+};
+
+static const SrgbTables &srgb_tables() {
+    static const SrgbTables tables;
+    return tables;
+}
+
+void srgb_to_linear(const unsigned char *rgba, float *linear, size_t count) {
+    const float *decode = srgb_tables().decode;
+    for (size_t i = 0; i < 4 * count; i += 4) {
+        linear[i + 0] = decode[rgba[i + 0]];
+        linear[i + 1] = decode[rgba[i + 1]];
+        linear[i + 2] = decode[rgba[i + 2]];
+        linear[i + 3] = rgba[i + 3] * (1.0f / 255.0f);
+    }
+}
+
+void linear_to_srgb(const float *linear, unsigned char *rgba, size_t count) {
+    const unsigned char *encode = srgb_tables().encode;
+#ifdef IMAGE_SSE2
+    // clamp, scale to table indices for rgb and to bytes for alpha, round
+    const __m128 scale = _mm_setr_ps(SRGB_ENCODE_STEPS, SRGB_ENCODE_STEPS, SRGB_ENCODE_STEPS, 255.0f);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    alignas(16) int index[4];
+    for (size_t i = 0; i < 4 * count; i += 4) {
+        __m128 c = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(linear + i), zero), one);
+        _mm_store_si128((__m128i *) index, _mm_cvtps_epi32(_mm_mul_ps(c, scale)));
+        rgba[i + 0] = encode[index[0]];
+        rgba[i + 1] = encode[index[1]];
+        rgba[i + 2] = encode[index[2]];
+        rgba[i + 3] = (unsigned char) index[3];
+    }
+#else
+    for (size_t i = 0; i < 4 * count; i += 4) {
+        for (int n = 0; n < 4; n++) {
+            float c = std::min(std::max(linear[i + n], 0.0f), 1.0f);
+            int index = int(c * (n < 3 ? SRGB_ENCODE_STEPS : 255) + 0.5f);
+            rgba[i + n] = n < 3 ? encode[index] : (unsigned char) index;
+        }
+    }
+#endif
+}
+
 std::string load_text(const std::string &fname) {
     std::ifstream file(fname);
     if (file.is_open()) {
@@ -1,14 +1,68 @@
+#pragma once
+
 // stb_image for loading textures
 #include "stb_image.h"
-// Linear Algebra Library
-#include <Eigen/Dense>
+#include <cstddef>
+#include <string>
+
+// Pixel layouts of an image
+#define IMAGE_FORMAT_RGBA8 0 // 4 bytes per pixel
+#define IMAGE_FORMAT_RGBA32F 1 // 4 floats per pixel, linear light
+
+// Every row starts on this boundary, for aligned SIMD loads and stores
+#define IMAGE_ALIGNMENT 64
+
+// A flat image buffer, rows from the bottom up as GL expects them
+class Image {
+public:
+    int width;
+    int height;
+    size_t stride; // bytes from one row to the next, a multiple of IMAGE_ALIGNMENT
+    int format;
+
+    Image() : width(0), height(0), stride(0), format(IMAGE_FORMAT_RGBA8), buffer(NULL) { }
+    ~Image() { release(); }
+
+    // Allocate width x height pixels, the previous content is lost
+    void resize(int width, int height, int format = IMAGE_FORMAT_RGBA8);
+
+    // Free the pixels
+    void release();
+
+    void swap(Image &other);
+
+    unsigned char *row(int y) { return buffer + y * stride; }
+    const unsigned char *row(int y) const { return buffer + y * stride; }
 
-// Type aliases for image textures
-typedef Eigen::Matrix<unsigned char, 4, 1> Pixel;
-typedef Eigen::Matrix<Pixel, Eigen::Dynamic, Eigen::Dynamic> Image;
+    // Bytes of one pixel
+    size_t pixel_bytes() const { return format == IMAGE_FORMAT_RGBA32F ? 16 : 4; }
 
-// Load an image from a file
+    // Bytes of one row without its padding
+    size_t row_bytes() const { return width * pixel_bytes(); }
+
+    bool empty() const { return buffer == NULL; }
+
+private:
+    unsigned char *buffer;
+
+    Image(const Image &);
+    Image &operator=(const Image &);
+};
+
+// Load an image from a file as RGBA8, decoded straight into its rows
 bool load_image(const std::string &fname, Image &pixels);
 
+// Bilinear resampling of an RGBA8 image into a w x h one
+void resample_image(const Image &src, Image &dst, int w, int h);
+
+// Expand count rgb pixels to rgba, opaque
+void rgb_to_rgba(const unsigned char *rgb, unsigned char *rgba, size_t count);
+
+// Decode count srgb rgba pixels to linear floats, alpha is linear already
+void srgb_to_linear(const unsigned char *rgba, float *linear, size_t count);
+
+// Encode count linear rgba pixels to srgb bytes, clamped and rounded
+void linear_to_srgb(const float *linear, unsigned char *rgba, size_t count);
+
 // Load text from a file
-std::string load_text(const std::string &fname);
\ No newline at end of file
+std::string load_text(const std::string &fname);
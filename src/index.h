@@ -6,6 +6,26 @@
 #include "helpers.h"
 // image loading helper
 #include "image.h"
+// memory mapped binary mesh cache
+#include "mesh_cache.h"
+// sphere mesh building, shared with the asset packer
+#include "sphere_mesh.h"
+// texture decoding on worker threads
+#include "texture_loader.h"
+// the packed asset archive
+#include "asset_pack.h"
+// closed form orbits and spins of the bodies
+#include "ephemeris.h"
+// the orbits fit to Chebyshev series ahead of time
+#include "ephemeris_table.h"
+// gravity between the bodies and a swarm of particles
+#include "nbody.h"
+// bounding sphere tests against the view frustum
+#include "culling.h"
+// equirectangular to cube map conversion and its cache
+#include "skybox.h"
+// gamma correct mip chains and their cache
+#include "mipmap.h"
 // GLFW is necessary to handle the OpenGL context
 #include <GLFW/glfw3.h>
 // Linear Algebra Library
@@ -17,7 +37,13 @@
 #include <fstream>
 #include <iostream>
 #include <cmath>
+#include <cfloat>
 #include <algorithm>
+#include <unordered_map>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
 ////////////////////////////////////////////////////////////////////////////////
 
 using namespace std;
@@ -26,24 +52,9 @@ using namespace std;
 // structs
 ///////////////////////////////////////
 
-// Mesh object, with both CPU data (Eigen::Matrix) and GPU data (the VBOs)
-struct Mesh {
-    Eigen::MatrixXf V; // vertices
-    Eigen::MatrixXf T; // store the texture uv coordinates
-    Eigen::MatrixXf N; // store vertex normals
-
-    // keep track of the translation
-    Eigen::Matrix4f model;
-    // keep track of the current center
-    Eigen::Vector3f center;
-
-    // store the texture
-    GLuint texture;
-
-    // store shadow map
-    GLuint depthMapFBO;
-    GLuint depthMap;
-
+// GPU data of a mesh, shared by every body drawing it
+// and released when the last of them lets go
+struct Geometry {
     // VBO storing vertex position attributes
     VertexBufferObject V_vbo;
 
@@ -53,8 +64,114 @@ struct Mesh {
     // VBO for vertex normal
     VertexBufferObject N_vbo;
 
-    // VAO storing the layout of the shader program for the object
+    // element buffer storing the triangle indices
+    VertexBufferObject F_vbo;
+
+    // VAO storing the layout of the shader programs for the mesh
     VertexArrayObject vao;
+
+    Geometry() { }
+    ~Geometry() {
+        vao.free();
+        V_vbo.free();
+        T_vbo.free();
+        N_vbo.free();
+        F_vbo.free();
+    }
+
+    // the buffers are owned, never copy them
+    Geometry(const Geometry &) = delete;
+    Geometry &operator=(const Geometry &) = delete;
+};
+
+// std140 layout of the per frame uniform block, camera and light
+struct FrameBlock {
+    float view[16];
+    float proj[16];
+    float distort[16];
+    float cloudModel[16];
+    float skyInverse[16]; // clip space back to world directions, for the skybox
+    float cameraPosition[4];
+    float lightPosition[4];
+    float lightFaces[6][16]; // view and projection of each shadow cube face
+    float shadowParams[4]; // cube near and far plane, shadow mode, sun radius
+};
+
+// per body data in the instance buffer, INSTANCE_TEXELS rgba32f texels
+struct InstanceData {
+    float model[16];
+    float params[4]; // texture layer, enable shading, clouds, radius
+    float occluders[4]; // first and count of the occluder ids in the draw list, LAYER_* of the texture
+};
+
+// a run of the draw list, drawn with one instanced call
+struct DrawRange {
+    int first;
+    int count;
+    // the geometry every instance of the run is drawn with
+    Geometry *geometry;
+
+    DrawRange() : first(0), count(0), geometry(NULL) { }
+};
+
+// the casters the shadow cube was last rendered with
+struct ShadowCache {
+    bool valid;
+    // the planets drawn into it
+    vector<int> ids;
+    // per caster, the center relative to the light and the radius
+    vector<Eigen::Vector4f> casters;
+
+    ShadowCache() : valid(false) { }
+};
+
+// counters reported by the benchmark mode
+struct FrameStats {
+    unsigned long frames;
+    unsigned long drawCalls;
+    unsigned long instances; // bodies drawn by the instanced calls
+    double triangles; // triangles submitted by the instanced calls
+    unsigned long visible; // bodies passing the frustum test of the main pass
+    unsigned long culled; // bodies outside of the view
+    unsigned long shadowCasters; // planets within the range of the shadow cube
+    unsigned long shadowCulled; // planets beyond it
+    unsigned long shadowRenders; // frames the shadow cube was rendered
+    unsigned long shadowReuses; // frames the cached shadow cube was still good
+    unsigned long lodSwitches; // bodies that changed level
+    double texturePixels; // pixels covered by the visible bodies
+    double textureTexels; // texels in the mip levels sampled for them, estimated
+    double frameMs; // CPU and GPU time of all measured frames
+
+    FrameStats()
+        : frames(0), drawCalls(0), instances(0), triangles(0), visible(0), culled(0),
+        shadowCasters(0), shadowCulled(0), shadowRenders(0), shadowReuses(0), lodSwitches(0),
+        texturePixels(0), textureTexels(0), frameMs(0)
+    { }
+};
+
+// Mesh object, a reference to its shared geometry plus the per body state
+struct Mesh {
+    // the geometry, shared between bodies
+    std::shared_ptr<Geometry> geometry;
+
+    // keep track of the translation
+    Eigen::Matrix4f model;
+    // keep track of the current center
+    Eigen::Vector3f center;
+    // radius of the bounding sphere
+    float radius;
+
+    // layer of the texture array
+    int layer;
+
+    // SPHERE_SOURCE_* the geometry comes from
+    int sphere;
+    // level of the sphere chain the geometry is, picked every frame
+    int lod;
+    // level the shadow cube draws it with, never finer than lod
+    int shadowLod;
+
+    Mesh() : radius(0.5f), layer(0), sphere(SPHERE_SOURCE_CHAIN), lod(0), shadowLod(0) { }
 };
 
 ///////////////////////////////////////
@@ -79,44 +196,30 @@ struct Mesh {
 #define NEPTUNE_RADIUS 0.8
 #define PLUTO_RADIUS 0.8
 
-// distance from each planet to the origin
-#define EARTH_DISTANCE 15.76
-#define SUN_DISTANCE 0
-#define MERCURY_DISTANCE 9.4
-#define VENUS_DISTANCE 12.28
-#define MARS_DISTANCE 18.71
-#define JUPITER_DISTANCE 22.66
-#define SATURN_DISTANCE 29.36
-#define URANUS_DISTANCE 33.86
-#define NEPTUNE_DISTANCE 37.46
-#define PLUTO_DISTANCE 41.06
-// moon's distance to the center of the earth
-#define MOON_DISTANCE 1
-
-// planet rotation and revolution cycle
-// rotation
-#define SUN_ROTATION_CYCLE 70
-#define EARTH_ROTATION_CYCLE 10
-#define MOON_ROTATION_CYCLE 54
-#define MERCURY_ROTATION_CYCLE 120
-#define VENUS_ROTATION_CYCLE -486
-#define MARS_ROTATION_CYCLE 10.06
-#define JUPITER_ROTATION_CYCLE 7.82
-#define SATURN_ROTATION_CYCLE 7.88
-#define URANUS_ROTATION_CYCLE -7.4
-#define NEPTUNE_ROTATION_CYCLE 7.34
-#define PLUTO_ROTATION_CYCLE -17.8
-// revolution
-#define EARTH_REVOLUTION_CYCLE 20
-#define MOON_REVOLUTION_CYCLE 5.79
-#define MERCURY_REVOLUTION_CYCLE 12.4
-#define VENUS_REVOLUTION_CYCLE 16.31
-#define MARS_REVOLUTION_CYCLE 23.64
-#define JUPITER_REVOLUTION_CYCLE 168.2
-#define SATURN_REVOLUTION_CYCLE 294.2
-#define URANUS_REVOLUTION_CYCLE 840
-#define NEPTUNE_REVOLUTION_CYCLE 1650
-#define PLUTO_REVOLUTION_CYCLE 2480
+// the sphere each body is drawn with, a SPHERE_SOURCE_*
+#define EARTH_SPHERE SPHERE_SOURCE_CHAIN
+#define MOON_SPHERE SPHERE_SOURCE_CHAIN
+#define SUN_SPHERE SPHERE_SOURCE_CHAIN
+#define MERCURY_SPHERE SPHERE_SOURCE_CHAIN
+#define VENUS_SPHERE SPHERE_SOURCE_CHAIN
+#define MARS_SPHERE SPHERE_SOURCE_CHAIN
+#define JUPITER_SPHERE SPHERE_SOURCE_CHAIN
+#define SATURN_SPHERE SPHERE_SOURCE_CHAIN
+#define URANUS_SPHERE SPHERE_SOURCE_CHAIN
+#define NEPTUNE_SPHERE SPHERE_SOURCE_CHAIN
+#define PLUTO_SPHERE SPHERE_SOURCE_CHAIN
+
+// seconds of simulation time the arrow keys jump, one year of the earth
+#define TIME_SEEK_STEP EARTH_REVOLUTION_CYCLE
+
+// gravity mode
+// steps a frame may take, past them the clock waits for the integrator
+#define NBODY_FRAME_STEPS 8
+// seconds ahead of the integrator a time may be before it counts as a
+// seek, which starts gravity over from the ellipses
+#define NBODY_SEEK_TIME 1.0
+// seed of the swarm of particles
+#define NBODY_SEED 1
 
 // camera settings
 #define CAMERA_NEAR_PLANE 0.2f
@@ -124,12 +227,46 @@ struct Mesh {
 #define CAMERA_FOV 45.0f
 #define CAMERA_RATIO 1.0f
 
-// universe background
-#define UNIVERSE_RADIUS 250
-
-// shadow map resolution
-#define SHADOW_WIDTH 1024
-#define SHADOW_HEIGHT 1024
+// shadow cube map resolution, per face
+#define SHADOW_SIZE 1024
+// depth range of the shadow cube, the casters are outside of the sun
+#define SHADOW_NEAR_PLANE 1.0f
+#define SHADOW_FAR_PLANE 50.0f
+// texels a caster may move before the shadow cube is rendered again
+#define SHADOW_TEXEL_THRESHOLD 0.5f
+
+// pixels the silhouette of a sphere level may stray from the true sphere
+#define LOD_PIXEL_ERROR 0.5f
+// a body only drops to a coarser level once it would stray less than this
+// fraction of the error, so it does not pop back and forth
+#define LOD_HYSTERESIS 0.5f
+// the same for the casters, in texels of the shadow cube
+#define LOD_SHADOW_TEXEL_ERROR 1.0f
+
+// maximum anisotropic filtering, clamped to what the driver supports
+#define TEXTURE_ANISOTROPY 8.0f
+
+// uniform block binding points
+#define FRAME_BLOCK_BINDING 0
+
+// texture units
+#define TEXTURE_UNIT 0
+#define SHADOW_CUBE_UNIT 1
+#define INSTANCE_UNIT 2
+#define DRAW_LIST_UNIT 3
+#define SKYBOX_UNIT 4
+#define PLACEHOLDER_UNIT 5
+
+// texels of one body in the instance buffer
+#define INSTANCE_TEXELS 6
+
+// position of each body in the instance buffer
+#define SUN_INSTANCE 0
+#define PLANET_INSTANCE(i) (1 + (i))
+
+// shadow modes
+#define SHADOW_MODE_CUBE 0 // depth cube map rendered from the sun
+#define SHADOW_MODE_ANALYTIC 1 // ray-sphere tests against each receiver's occluders
 
 // scenes
 #define SCENE_SOLAR_SYSTEM 0
@@ -141,12 +278,36 @@ struct Mesh {
 
 extern int Scene;
 
-extern bool Pause;
+// frames to render in benchmark mode, 0 when interactive
+extern int BenchmarkFrames;
+extern FrameStats Stats;
 
-// background
-// a huge sphere that contains everything
-// map the milky-way and stars images to its inside
-extern Mesh Universe;
+extern bool Pause;
+// seconds since the start of the orbits, the bodies are placed from it alone
+extern double SimulationTime;
+// seconds the Chebyshev tables cover from time 0, 0 for none
+extern double EphemerisSpan;
+// the tables, solved in closed form outside of them
+extern EphemerisTable Ephemeris;
+// light particles of the gravity mode, -1 while the bodies follow their ellipses
+extern int NBodyParticles;
+extern NBodySystem Gravity;
+
+extern int ShadowMode;
+extern float ShadowTexelThreshold;
+
+// pixels a sphere level may stray from the true sphere
+extern float LodPixelError;
+// every body drawn with data/sphere.off, whatever its SPHERE_SOURCE_*
+extern bool SphereOff;
+// ray cast each body on a quad instead of drawing its sphere level
+extern bool Impostors;
+
+// full mip chains for the textures, level 0 only without
+extern bool Mipmaps;
+extern float Anisotropy;
+// TEXTURE_FORMAT_* of the texture array
+extern int TextureFormat;
 
 // Sun
 // also the light source
@@ -155,8 +316,47 @@ extern Mesh Sun;
 // mercury, venus, earth, moon, mars, jupiter, saturn, uranus, neptune, pluto
 extern vector<Mesh> Planets; // a list of planets
 
-extern Mesh planetTemplate; // a unit sphere centered at origin as a template of planets
-extern bool planetTemplateFlag;
+// uniform buffer of the frame
+extern UniformBufferObject FrameBuffer;
+// data of every body, indexed by the instance ids in the draw list
+extern TextureBufferObject InstanceBuffer;
+extern TextureBufferObject DrawListBuffer;
+
+// every level of the sphere chain, any body may switch to any of them
+extern vector<std::shared_ptr<Geometry> > SphereLods;
+
+// instances drawn by the main pass, one range per geometry
+extern vector<DrawRange> MainDraws;
+// instances casting shadows, drawn once into all faces of the shadow cube
+extern vector<DrawRange> ShadowDraws;
+// the planets in ShadowDraws
+extern vector<int> ShadowCasters;
+// the instances in MainDraws
+extern vector<int> VisibleBodies;
+
+// the textures of every body, one layer each
+extern GLuint TextureArray;
+// a small version of each layer, shown until the layer is uploaded
+extern GLuint PlaceholderArray;
+// background
+// the milky-way and stars image as a cube map, drawn behind everything
+extern GLuint Skybox;
+extern VertexArrayObject SkyboxVAO;
+// the quads of the impostors have no attributes either
+extern VertexArrayObject ImpostorVAO;
+// distance from the sun to the closest caster, in every direction
+extern GLuint ShadowCube;
+extern GLuint ShadowCubeFBO;
+extern ShadowCache ShadowCubeCache;
+
+// decodes the planet textures in the background
+extern TextureLoader Textures;
+
+// every derived asset in one mapped file, looked up before the caches
+extern AssetPack Assets;
+// where the pack is mapped from, empty to go through the caches only
+extern string AssetPackPath;
+
 
 // view and proj matrix
 extern Eigen::Matrix4f VIEW;
@@ -168,6 +368,8 @@ extern double H_radian; // horizontal
 extern double V_radian; // vertical
 extern Eigen::Vector3f CameraLookAt;
 extern Eigen::Matrix4f CameraModel;
+// the camera model in the frame of the earth, while following it
+extern Eigen::Matrix4f CameraAnchor;
 // keep track of camera position and up
 extern Eigen::Vector3f CameraPosition;
 extern Eigen::Vector3f CameraUp;
@@ -183,7 +385,18 @@ extern double clicked_y;
 
 //-- shaders
 void set_shaders(Program *program);
+void set_shaders_impostor(Program *program);
 void set_shaders_shadow_map(Program *program);
+void set_shaders_skybox(Program *program);
+void set_shaders_particles(Program *program);
+// create the uniform and instance buffers and attach the programs to them
+void init_uniform_blocks(Program *program, Program *impostorProgram, Program *shadowMapProgram, Program *skyboxProgram,
+    Program *particleProgram);
+// upload the frame block, once per frame
+void update_uniform_blocks(const Eigen::Matrix4f &distort, const Eigen::Matrix4f &cloudModel);
+// upload every body and the draw lists of all passes, once per frame
+// the draw lists only keep what the clip space matrix can see
+void update_instances(const Eigen::Matrix4f &clip);
 
 //-- callback
 void get_canonical_position(GLFWwindow *window, double *xcanonical, double *ycanonical);
@@ -193,18 +406,45 @@ void cursor_position_callback(GLFWwindow* window, double xpos, double ypos);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
 //-- planet mesh generator
-// load file
-void load_sphere_off(const std::string &filename, Eigen::MatrixXf &V, Eigen::MatrixXi &F);
-// return the radius and set the center
-double find_radius_center(const Mesh &m, Eigen::Vector3f &c);
-// generate a planet
-Mesh generate_planet();
-// generate texture coordinates
-void generate_texcoord(Mesh * m, const Image &image);
-// generate a planet with texture
-Mesh generate_textured_planet(const string &fname);
-// finalized vao and vbo then push
-void finalized_planet(Program *program, Program *shadowMapProgram, Mesh *p);
+// upload mesh arrays into the buffers of a geometry
+void upload_geometry(Geometry *g, const MeshView &view);
+// load a level of the sphere chain from the pack or the binary mesh cache,
+// building it on a miss
+void load_sphere_lod(Geometry *g, int lod);
+// load data/sphere.off the same way, the cache rebuilt whenever the file changes
+void load_sphere_geometry(Geometry *g);
+// return the shared geometry registered under name, loading it on first use
+std::shared_ptr<Geometry> acquire_geometry(
+    const string &name,
+    const std::function<void(Geometry *)> &load
+);
+// load every level of the sphere chain into SphereLods, once
+void load_sphere_lods();
+// pick the level of every body from its radius in pixels and the level of
+// every caster from its radius in shadow cube texels
+void select_lods(const Eigen::Matrix4f &view, const Eigen::Matrix4f &proj, int height);
+// generate a planet drawn with a SPHERE_SOURCE_*, every body takes the
+// bundled sphere with --sphere-off
+Mesh generate_planet(int sphere);
+// generate a planet with texture, name is the image under the data folder
+Mesh generate_textured_planet(const string &name, int sphere);
+// finalized the vaos of every sphere geometry then push
+void finalized_planet(Program *program, Program *shadowMapProgram);
+// draw a range of the draw list with one instanced call
+void draw_instances(const Geometry &g, const DrawRange &range);
+// draw each range with its geometry, setting the drawOffset uniform of program
+void draw_buckets(Program *program, GLint drawOffset, const vector<DrawRange> &ranges);
+// draw the bodies of every range as impostors, one quad each, in a single call
+void draw_impostors(Program *program, GLint drawOffset, const vector<DrawRange> &ranges);
+// release the geometry reference of a planet
+void free_planet(Mesh *p);
+// allocate the shadow cube map of the sun
+void init_shadow_cube();
+// whether the casters changed or one of them moved past the texel threshold
+// since the cube was rendered, if so they are recorded for the render that follows
+bool shadow_cube_outdated(const vector<int> &casters);
+// release the texture array and the shadow cube
+void free_solar_system();
 
 //-- camera
 // generate orthographic projection matrix
@@ -228,23 +468,22 @@ Eigen::Matrix4f lookAt(
 void update_camera_view();
 
 //-- planets movements
-void move_planets(float seconds);
-void planet_rotation(
-    float seconds, 
-    float rotationCycle, 
-    Mesh * planet,
-    bool isEarth
-);
-void planet_revolution(
-    float seconds, 
-    float revolutionCycle, 
-    Mesh * planet, 
-    const Eigen::Vector3f &target,
-    bool isEarth
-);
+// place every body where it is at simulation time t, and the camera
+// with the earth when following it; in the gravity mode the bodies are
+// stepped toward t instead, a few steps a frame
+void place_bodies(double t);
+// translation and spin of a body at time t, without its scale
+Eigen::Matrix4f body_frame(int body, double t);
+// map the Chebyshev tables of the orbits from the pack or their cache,
+// fitting them on a miss
+void load_ephemeris();
+// start the gravity mode over from the ellipses at time t
+void seed_gravity(double t);
+// draw the light particles of the gravity mode as points
+void draw_particles(Program *program);
 
 //-- a task to create all planets in solar system
-void create_solar_system(Program *program, Program *shadowMapProgram);
+void create_solar_system(Program *program, Program *shadowMapProgram, GLFWwindow *loaderContext);
 void create_earth(Program *program, Program *shadowMapProgram);
 void create_moon(Program *program, Program *shadowMapProgram);
 void create_sun(Program *program, Program *shadowMapProgram);
@@ -258,7 +497,21 @@ void create_uranus(Program *program, Program *shadowMapProgram);
 void create_venus(Program *program, Program *shadowMapProgram);
 
 //-- create universe background
-void create_universe(Program *program, Program *shadowMapProgram);
+// convert the equirectangular image to a cube map, cached on disk
+void create_skybox();
+// upload the six size x size faces into the Skybox cube map
+void upload_skybox(int size, const unsigned char *faces);
+// a single triangle covering the screen on the far plane
+void draw_skybox();
+
+//-- benchmark mode
+// time the uniform uploads of a frame through name lookups on the baseline
+// programs and through the instance buffer
+void benchmark_uniforms(int frames);
+// estimate the texels read for the visible bodies at the size they are drawn
+void count_texture_traffic(int width, int height);
+// print the averages of the measured frames
+void print_frame_stats();
 
 //-- changing scene
 void focus_on_sun();
@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "kepler.h"
+#include <cmath>
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+// Danby's start, within reach of Newton for any eccentricity below one
+static double kepler_start(double M, double e) {
+	return M + (M < 0.0 ? -0.85 : 0.85) * e;
+}
+
+double solve_kepler(double M, double e) {
+	double E = kepler_start(M, e);
+	for (int i = 0; i < KEPLER_MAX_ITERATIONS; i++) {
+		double step = (E - e * std::sin(E) - M) / (1.0 - e * std::cos(E));
+		E -= step;
+		if (std::fabs(step) < KEPLER_TOLERANCE) {
+			break;
+		}
+	}
+	return E;
+}
+
+static void solve_kepler_scalar(const double *M, const double *e, int count, double *sinE, double *cosE) {
+	for (int i = 0; i < count; i++) {
+		double E = solve_kepler(M[i], e[i]);
+		sinE[i] = std::sin(E);
+		cosE[i] = std::cos(E);
+	}
+}
+
+#ifdef CPU_X86
+// sine and cosine of four angles of at most a few turns: reduced by quarter
+// turns in two parts, then the minimax polynomials of Cephes on [-pi/4, pi/4]
+CPU_TARGET_AVX2 static inline void sincos4(__m256d x, __m256d &s, __m256d &c) {
+	const __m256d twoOverPi = _mm256_set1_pd(0.63661977236758134308);
+	const __m256d pio2Hi = _mm256_set1_pd(1.57079632673412561417e+00);
+	const __m256d pio2Lo = _mm256_set1_pd(6.07710050650619224932e-11);
+	__m256d j = _mm256_round_pd(_mm256_mul_pd(x, twoOverPi), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_fnmadd_pd(j, pio2Hi, x);
+	r = _mm256_fnmadd_pd(j, pio2Lo, r);
+	__m256d r2 = _mm256_mul_pd(r, r);
+
+	__m256d ps = _mm256_set1_pd(1.58962301576546568060e-10);
+	ps = _mm256_fmadd_pd(ps, r2, _mm256_set1_pd(-2.50507477628578072866e-8));
+	ps = _mm256_fmadd_pd(ps, r2, _mm256_set1_pd(2.75573136213857245213e-6));
+	ps = _mm256_fmadd_pd(ps, r2, _mm256_set1_pd(-1.98412698295895385996e-4));
+	ps = _mm256_fmadd_pd(ps, r2, _mm256_set1_pd(8.33333333332211858878e-3));
+	ps = _mm256_fmadd_pd(ps, r2, _mm256_set1_pd(-1.66666666666666307295e-1));
+	__m256d sr = _mm256_fmadd_pd(_mm256_mul_pd(ps, r2), r, r);
+
+	__m256d pc = _mm256_set1_pd(-1.13585365213876817300e-11);
+	pc = _mm256_fmadd_pd(pc, r2, _mm256_set1_pd(2.08757008419747316778e-9));
+	pc = _mm256_fmadd_pd(pc, r2, _mm256_set1_pd(-2.75573141792967388112e-7));
+	pc = _mm256_fmadd_pd(pc, r2, _mm256_set1_pd(2.48015872888517045348e-5));
+	pc = _mm256_fmadd_pd(pc, r2, _mm256_set1_pd(-1.38888888888730564116e-3));
+	pc = _mm256_fmadd_pd(pc, r2, _mm256_set1_pd(4.16666666666665929218e-2));
+	__m256d cr = _mm256_fmadd_pd(_mm256_mul_pd(pc, r2), r2, _mm256_fnmadd_pd(_mm256_set1_pd(0.5), r2, _mm256_set1_pd(1.0)));
+
+	// quadrant 0: (s, c), 1: (c, -s), 2: (-s, -c), 3: (-c, s)
+	__m256d q = _mm256_sub_pd(j, _mm256_mul_pd(_mm256_set1_pd(4.0), _mm256_floor_pd(_mm256_mul_pd(j, _mm256_set1_pd(0.25)))));
+	__m256d q1 = _mm256_cmp_pd(q, _mm256_set1_pd(1.0), _CMP_EQ_OQ);
+	__m256d q2 = _mm256_cmp_pd(q, _mm256_set1_pd(2.0), _CMP_EQ_OQ);
+	__m256d q3 = _mm256_cmp_pd(q, _mm256_set1_pd(3.0), _CMP_EQ_OQ);
+	__m256d swap = _mm256_or_pd(q1, q3);
+	__m256d sign = _mm256_set1_pd(-0.0);
+	s = _mm256_xor_pd(_mm256_blendv_pd(sr, cr, swap), _mm256_and_pd(_mm256_or_pd(q2, q3), sign));
+	c = _mm256_xor_pd(_mm256_blendv_pd(cr, sr, swap), _mm256_and_pd(_mm256_or_pd(q1, q2), sign));
+}
+
+CPU_TARGET_AVX2 static void solve_kepler_avx2(const double *M, const double *e, int count, double *sinE, double *cosE) {
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d absMask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+	const __m256d tolerance = _mm256_set1_pd(KEPLER_TOLERANCE);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m256d m = _mm256_loadu_pd(M + i);
+		__m256d ecc = _mm256_loadu_pd(e + i);
+		// Danby's start, 0.85 e toward the sign of M
+		__m256d start = _mm256_or_pd(_mm256_mul_pd(_mm256_set1_pd(0.85), ecc),
+			_mm256_and_pd(m, _mm256_set1_pd(-0.0)));
+		__m256d E = _mm256_add_pd(m, start);
+		__m256d s, c, step;
+		for (int k = 0; k < KEPLER_MAX_ITERATIONS; k++) {
+			sincos4(E, s, c);
+			__m256d f = _mm256_sub_pd(_mm256_fnmadd_pd(ecc, s, E), m);
+			__m256d df = _mm256_fnmadd_pd(ecc, c, one);
+			step = _mm256_div_pd(f, df);
+			E = _mm256_sub_pd(E, step);
+			// the whole batch steps until its slowest lane converged
+			__m256d open = _mm256_cmp_pd(_mm256_and_pd(step, absMask), tolerance, _CMP_GE_OQ);
+			if (_mm256_movemask_pd(open) == 0) {
+				break;
+			}
+		}
+		// the last step is too small to need another sincos, first order is exact
+		_mm256_storeu_pd(sinE + i, _mm256_fnmadd_pd(step, c, s));
+		_mm256_storeu_pd(cosE + i, _mm256_fmadd_pd(step, s, c));
+	}
+	solve_kepler_scalar(M + i, e + i, count - i, sinE + i, cosE + i);
+}
+#endif
+
+void solve_kepler(const double *meanAnomaly, const double *eccentricity, int count, double *sinE, double *cosE, int isa) {
+#ifdef CPU_X86
+	if (cpu_resolve_isa(isa) == CPU_ISA_AVX2) {
+		solve_kepler_avx2(meanAnomaly, eccentricity, count, sinE, cosE);
+		return;
+	}
+#endif
+	solve_kepler_scalar(meanAnomaly, eccentricity, count, sinE, cosE);
+}
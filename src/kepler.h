@@ -0,0 +1,29 @@
+#pragma once
+#include "cpu_features.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Solves Kepler's equation E - e sin E = M for batches of orbits, four at a
+// time with AVX2 and FMA where the processor has them
+////////////////////////////////////////////////////////////////////////////////
+
+// Newton stops once every step of a batch is below this many radians
+#define KEPLER_TOLERANCE 1e-14
+// and gives up after this many steps, which no elliptic orbit needs
+#define KEPLER_MAX_ITERATIONS 32
+
+// Eccentric anomaly of a mean anomaly in [-pi, pi) and an eccentricity in
+// [0, 1), by Newton from the start of Danby
+double solve_kepler(double meanAnomaly, double eccentricity);
+
+// Sine and cosine of the eccentric anomalies of count orbits, the mean
+// anomalies in [-pi, pi); the sines and cosines are all the positions need.
+// The vector path evaluates them with its own polynomials, within a few
+// ulps of the scalar one
+void solve_kepler(
+	const double *meanAnomaly,
+	const double *eccentricity,
+	int count,
+	double *sinE,
+	double *cosE,
+	int isa = CPU_ISA_AUTO
+);
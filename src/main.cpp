@@ -2,26 +2,97 @@
 
 int Scene = SCENE_SOLAR_SYSTEM;
 bool Pause = false;
+double SimulationTime = 0;
+double EphemerisSpan = EPHEMERIS_SPAN;
+int ShadowMode = SHADOW_MODE_CUBE;
+float ShadowTexelThreshold = SHADOW_TEXEL_THRESHOLD;
+bool Mipmaps = true;
+float Anisotropy = TEXTURE_ANISOTROPY;
+// the shaders only read rgb, bc1 holds it in half a byte per texel
+int TextureFormat = TEXTURE_FORMAT_BC1;
+string AssetPackPath = CACHE_DIR "assets.pack";
+float LodPixelError = LOD_PIXEL_ERROR;
+bool SphereOff = false;
+bool Impostors = false;
+int NBodyParticles = -1;
 
 double CameraDistance = 2;
 double H_radian = 0;
 double V_radian = 0;
 Eigen::Vector3f CameraLookAt;
 Eigen::Matrix4f CameraModel;
+Eigen::Matrix4f CameraAnchor = Eigen::Matrix4f::Identity();
 Eigen::Vector3f CameraPosition;
 Eigen::Vector3f CameraUp;
 Eigen::Matrix4f VIEW;
 Eigen::Matrix4f PROJ;
 
-int main(void) {
+int BenchmarkFrames = 0;
+FrameStats Stats;
+
+int main(int argc, char **argv) {
     GLFWwindow *window;
     Program program;
     Program shadowMapProgram; // shadow mapping shaders
+    Program skyboxProgram; // background
+    Program impostorProgram; // the bodies ray cast on quads
+    Program particleProgram; // the swarm of the gravity mode
 
     Eigen::Matrix4f distort;
     float aspect_ratio;
     int width, height;
 
+    // --benchmark [frames] renders a fixed number of frames and prints statistics
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--benchmark") == 0) {
+            BenchmarkFrames = 600;
+            if (i + 1 < argc && isdigit(argv[i + 1][0])) {
+                BenchmarkFrames = max(1, atoi(argv[++i]));
+            }
+        } else if (strcmp(argv[i], "--shadow-threshold") == 0 && i + 1 < argc) {
+            // texels a caster may move before the shadow cube is redrawn, 0 redraws on any motion
+            ShadowTexelThreshold = max(0.0, atof(argv[++i]));
+        } else if (strcmp(argv[i], "--anisotropy") == 0 && i + 1 < argc) {
+            // 1 turns anisotropic filtering off
+            Anisotropy = max(1.0, atof(argv[++i]));
+        } else if (strcmp(argv[i], "--no-mipmaps") == 0) {
+            // level 0 only, to compare against
+            Mipmaps = false;
+        } else if (strcmp(argv[i], "--texture-format") == 0 && i + 1 < argc) {
+            // rgba8, bc1 or bc3
+            const char *name = argv[++i];
+            for (int format : { TEXTURE_FORMAT_RGBA8, TEXTURE_FORMAT_BC1, TEXTURE_FORMAT_BC3 }) {
+                if (strcmp(name, texture_format_name(format)) == 0) {
+                    TextureFormat = format;
+                }
+            }
+        } else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc) {
+            // pixels the sphere levels may stray, 0 draws the finest level everywhere
+            LodPixelError = max(0.0, atof(argv[++i]));
+        } else if (strcmp(argv[i], "--sphere-off") == 0) {
+            // the bundled sphere for every body instead of the generated levels
+            SphereOff = true;
+        } else if (strcmp(argv[i], "--impostors") == 0) {
+            // ray cast the bodies instead of drawing their meshes
+            Impostors = true;
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            // seconds of simulation time to start from
+            SimulationTime = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--nbody") == 0 && i + 1 < argc) {
+            // the bodies pulled along by gravity, with this many particles around them
+            NBodyParticles = max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--ephemeris-span") == 0 && i + 1 < argc) {
+            // seconds the orbit tables cover, 0 solves every frame in closed form
+            EphemerisSpan = max(0.0, atof(argv[++i]));
+        } else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+            // a pack written by solar-pack
+            AssetPackPath = argv[++i];
+        } else if (strcmp(argv[i], "--no-pack") == 0) {
+            // load every asset through its own cache
+            AssetPackPath.clear();
+        }
+    }
+
     // Initialize the GLFW library
     if (!glfwInit()) {
         return -1;
@@ -47,6 +118,12 @@ int main(void) {
         return -1;
     }
 
+    // a hidden window sharing the objects of the main context, current on
+    // the texture upload thread; without it the uploads happen between frames
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *loaderContext = glfwCreateWindow(1, 1, "Texture loader", NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
     // Make the window's context current
     glfwMakeContextCurrent(window);
 
@@ -69,7 +146,10 @@ int main(void) {
     // A program controls the OpenGL pipeline and it must contains
     // at least a vertex shader and a fragment shader to be valid
     set_shaders(&program);
+    set_shaders_impostor(&impostorProgram);
     set_shaders_shadow_map(&shadowMapProgram);
+    set_shaders_skybox(&skyboxProgram);
+    set_shaders_particles(&particleProgram);
 
     // Register the mouse callback
     glfwSetMouseButtonCallback(window, mouse_button_callback);
@@ -81,8 +161,7 @@ int main(void) {
     glEnable(GL_DEPTH_TEST);
 
     // initialize the scene
-    create_solar_system(&program, &shadowMapProgram);
-    create_universe(&program, &shadowMapProgram);
+    create_solar_system(&program, &shadowMapProgram, loaderContext);
     
     // initialize view proj matrices
     focus_on_sun();
@@ -93,6 +172,22 @@ int main(void) {
 		CAMERA_FAR_PLANE // far plane
     );
 
+    // frame data lives in a uniform buffer, bodies in the instance buffer
+    init_uniform_blocks(&program, &impostorProgram, &shadowMapProgram, &skyboxProgram, &particleProgram);
+    GLint uDrawOffset = program.uniform("drawOffset");
+    GLint uImpostorDrawOffset = impostorProgram.uniform("drawOffset");
+    GLint uShadowDrawOffset = shadowMapProgram.uniform("drawOffset");
+
+    if (BenchmarkFrames > 0) {
+        // measure with every texture in place
+        if (!Textures.wait()) {
+            return -1;
+        }
+        // do not wait for vsync while measuring
+        glfwSwapInterval(0);
+        benchmark_uniforms(BenchmarkFrames);
+    }
+
     // record the start time
     auto t_start = std::chrono::high_resolution_clock::now();
 
@@ -100,6 +195,11 @@ int main(void) {
 
     // Loop until the user closes the window
     while (!glfwWindowShouldClose(window)) {
+        auto t_frame = std::chrono::high_resolution_clock::now();
+
+        // swap in the textures uploaded since the last frame
+        Textures.poll();
+
         // Set the size of the viewport (canvas) to the size of the application window (framebuffer)
         glfwGetFramebufferSize(window, &width, &height);
 
@@ -120,157 +220,89 @@ int main(void) {
         float time_diff = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
         if (time_diff >= (float) (1/FPS)) {
             if (!Pause) {
-                // should update all positions
-                move_planets(time_diff);
-                // rotate cloud in counter clock wise
-                double rotationCycle = 1000 * EARTH_ROTATION_CYCLE;
-                Eigen::Matrix4f move1;
-                double radian = -M_PI * time_diff / rotationCycle;
-                move1 << cos(radian), 0.0f, sin(radian), 0.0f,
-                    0.0f, 1.0f, 0.0f, 0.0f,
-                    -sin(radian), 0.0f, cos(radian), 0.0f,
-                    0.0f, 0.0f, 0.0f, 1.0f;
-                Eigen::Matrix4f move2;
-                double amount = 0.1 * time_diff;
-                move2 << 1.0f, 0.0f, 0.0f, -amount,
-                    0.0f, 1.0f, 0.0f, 0.0f,
-                    0.0f, 0.0f, 1.0f, 0.0f,
-                    0.0f, 0.0f, 0.0f, 1.0f;
-                // update model matrix
-                cloudModel = move1 * cloudModel;
+                SimulationTime += time_diff;
             }
             // reset timer
             t_start = std::chrono::high_resolution_clock::now();
         }
-
-        Eigen::Matrix4f depthMVP;
-
-        shadowMapProgram.bind();
-        glCullFace(GL_FRONT);
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        // update depth map for earth
-        glBindFramebuffer(GL_FRAMEBUFFER, Planets[2].depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-
-        for (int i = 0; i < 2; i++) {
-            depthMVP = (
-                orthographic(SUN_RADIUS, -SUN_RADIUS, SUN_RADIUS, -SUN_RADIUS, 0.0f, 50.0f) *
-                lookAt(Sun.center, Planets[2].center, Eigen::Vector3f(0.0f, 1.0f, 0.0f)) *
-                Planets[i].model
-            );
-
-            Planets[i].vao.bind();
-            glUniformMatrix4fv(shadowMapProgram.uniform("mvp"), 1, GL_FALSE, depthMVP.data());
-            glDrawArrays(GL_TRIANGLES, 0, Planets[i].V.cols());
+        // every position straight from the time, so a seek costs what a frame does
+        place_bodies(SimulationTime);
+        // gravity only steps so far a frame, the clock waits for it
+        if (NBodyParticles >= 0) {
+            SimulationTime = min(SimulationTime, Gravity.time + NBODY_STEP);
         }
-        // update moon shadow on earth
-        depthMVP = (
-            orthographic(SUN_RADIUS, -SUN_RADIUS, SUN_RADIUS, -SUN_RADIUS, 0.0f, 50.0f) *
-            lookAt(Sun.center, Planets[2].center, Eigen::Vector3f(0.0f, 1.0f, 0.0f)) *
-            Planets[3].model
-        );
-
-        Planets[3].vao.bind();
-        glUniformMatrix4fv(shadowMapProgram.uniform("mvp"), 1, GL_FALSE, depthMVP.data());
-        glDrawArrays(GL_TRIANGLES, 0, Planets[3].V.cols());
-
-        // update depth map for other planets
-        for (int i = 0; i < Planets.size(); i++) {
-            if (i == 2) { // skip earth
-                continue;
-            }
-
-            glBindFramebuffer(GL_FRAMEBUFFER, Planets[i].depthMapFBO);
+        // the clouds turn counter clock wise, half as fast as a thousandth of the earth
+        double cloudRadian = -cycle_angle(SimulationTime, 2000 * EARTH_ROTATION_CYCLE);
+        cloudModel << cos(cloudRadian), 0.0f, sin(cloudRadian), 0.0f,
+            0.0f, 1.0f, 0.0f, 0.0f,
+            -sin(cloudRadian), 0.0f, cos(cloudRadian), 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f;
+
+        // the sphere level of each body from its size on screen
+        select_lods(VIEW, PROJ, height);
+
+        // one upload for the frame, one for all the bodies and their draw lists
+        update_uniform_blocks(distort, cloudModel);
+        update_instances(distort * PROJ * VIEW);
+        InstanceBuffer.bind(INSTANCE_UNIT);
+        DrawListBuffer.bind(DRAW_LIST_UNIT);
+
+        // every caster once, the geometry shader sends it to the six faces
+        // the analytic mode needs no shadow map at all, and the cube is
+        // kept while no caster moved past the texel threshold
+        if (ShadowMode == SHADOW_MODE_CUBE && shadow_cube_outdated(ShadowCasters)) {
+            shadowMapProgram.bind();
+            glViewport(0, 0, SHADOW_SIZE, SHADOW_SIZE);
+            glBindFramebuffer(GL_FRAMEBUFFER, ShadowCubeFBO);
             glClear(GL_DEPTH_BUFFER_BIT);
+            draw_buckets(&shadowMapProgram, uShadowDrawOffset, ShadowDraws);
 
-            for (int j = 0; j <= i; j++) {
-                depthMVP = (
-                    orthographic(SUN_RADIUS, -SUN_RADIUS, SUN_RADIUS, -SUN_RADIUS, 0.0f, 50.0f) *
-                    lookAt(Sun.center, Planets[i].center, Eigen::Vector3f(0.0f, 1.0f, 0.0f)) *
-                    Planets[j].model
-                );
-
-                Planets[j].vao.bind();
-                glUniformMatrix4fv(shadowMapProgram.uniform("mvp"), 1, GL_FALSE, depthMVP.data());
-                glDrawArrays(GL_TRIANGLES, 0, Planets[j].V.cols());
-            }
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
         }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        // draw all planets
+        // draw all bodies, one call per level of the sphere chain in view
+        // or a single one for the impostors
         glViewport(0, 0, width, height);
-        glCullFace(GL_BACK);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        program.bind();
-
-        glUniform1i(program.uniform("enableShading"), 1);
-
-        for (int i = 0; i < Planets.size(); i++) {
-            glUniform1i(program.uniform("tex"), 0);
-            glUniform1i(program.uniform("shadowMap"), 1);
-
-            Planets[i].vao.bind();
-            glActiveTexture(GL_TEXTURE0 + 0);
-            glBindTexture(GL_TEXTURE_2D, Planets[i].texture);
-            glActiveTexture(GL_TEXTURE0 + 1);
-            glBindTexture(GL_TEXTURE_2D, Planets[i].depthMap);
-
-            depthMVP = (
-                orthographic(SUN_RADIUS, -SUN_RADIUS, SUN_RADIUS, -SUN_RADIUS, 0.0f, 50.0f) *
-                lookAt(Sun.center, Planets[i].center, Eigen::Vector3f(0.0f, 1.0f, 0.0f)) *
-                Planets[i].model
-            );
-
-            if (i == 2) { // earth
-                glUniform1i(program.uniform("cloud"), 1);
-                glUniformMatrix4fv(program.uniform("cloudModel"), 1, GL_FALSE, cloudModel.data());
-            } else { // others
-                glUniform1i(program.uniform("cloud"), 0);
-            }
-
-            glUniformMatrix4fv(program.uniform("distort"), 1, GL_FALSE, distort.data());
-            glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, Planets[i].model.data());
-            glUniformMatrix4fv(program.uniform("view"), 1, GL_FALSE, VIEW.data());
-            glUniformMatrix4fv(program.uniform("proj"), 1, GL_FALSE, PROJ.data());
-            glUniformMatrix4fv(program.uniform("lightMVP"), 1, GL_FALSE, depthMVP.data());
-
-            glUniform3f(program.uniform("lightPosition"), 0.0f, 0.0f, 0.0f);
-            glUniform3f(program.uniform("cameraPosition"), CameraPosition[0], CameraPosition[1], CameraPosition[2]);
-
-            glDrawArrays(GL_TRIANGLES, 0, Planets[i].V.cols());
+        // bound every frame, so the uploads of the other context show up
+        glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, TextureArray);
+        glActiveTexture(GL_TEXTURE0 + PLACEHOLDER_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, PlaceholderArray);
+        glActiveTexture(GL_TEXTURE0 + SHADOW_CUBE_UNIT);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, ShadowCube);
+
+        if (Impostors) {
+            impostorProgram.bind();
+            draw_impostors(&impostorProgram, uImpostorDrawOffset, MainDraws);
+        } else {
+            program.bind();
+            draw_buckets(&program, uDrawOffset, MainDraws);
+        }
+        if (NBodyParticles >= 0) {
+            particleProgram.bind();
+            draw_particles(&particleProgram);
         }
 
-        // draw sun and universe
-        glUniform1i(program.uniform("enableShading"), 0);
-
-        // sun
-        glUniform1i(program.uniform("tex"), 0);
-
-        Sun.vao.bind();
-        glActiveTexture(GL_TEXTURE0 + 0);
-        glBindTexture(GL_TEXTURE_2D, Sun.texture);
-
-        glUniformMatrix4fv(program.uniform("distort"), 1, GL_FALSE, distort.data());
-        glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, Sun.model.data());
-        glUniformMatrix4fv(program.uniform("view"), 1, GL_FALSE, VIEW.data());
-        glUniformMatrix4fv(program.uniform("proj"), 1, GL_FALSE, PROJ.data());
-
-        glDrawArrays(GL_TRIANGLES, 0, Sun.V.cols());
-
-        // universe
-        glUniform1i(program.uniform("tex"), 0);
-
-        Universe.vao.bind();
-        glActiveTexture(GL_TEXTURE0 + 0);
-        glBindTexture(GL_TEXTURE_2D, Universe.texture);
-
-        glUniformMatrix4fv(program.uniform("distort"), 1, GL_FALSE, distort.data());
-        glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, Universe.model.data());
-        glUniformMatrix4fv(program.uniform("view"), 1, GL_FALSE, VIEW.data());
-        glUniformMatrix4fv(program.uniform("proj"), 1, GL_FALSE, PROJ.data());
-
-        glDrawArrays(GL_TRIANGLES, 0, Universe.V.cols());
+        // the background last, the depth test rejects it early behind the bodies
+        glDepthFunc(GL_LEQUAL);
+        skyboxProgram.bind();
+        glActiveTexture(GL_TEXTURE0 + SKYBOX_UNIT);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, Skybox);
+        draw_skybox();
+        glDepthFunc(GL_LESS);
+
+        if (BenchmarkFrames > 0) {
+            count_texture_traffic(width, height);
+            // include the GPU work in the frame time
+            glFinish();
+            Stats.frames++;
+            Stats.frameMs += std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - t_frame).count();
+            if (Stats.frames == (unsigned long) BenchmarkFrames) {
+                glfwSetWindowShouldClose(window, GL_TRUE);
+            }
+        }
 
         // Swap front and back buffers
         glfwSwapBuffers(window);
@@ -282,26 +314,30 @@ int main(void) {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     }
 
+    if (BenchmarkFrames > 0) {
+        print_frame_stats();
+    }
+
     // Deallocate opengl memory
     program.free();
-    for (Mesh m : Planets) {
-        m.vao.free();
-        m.V_vbo.free();
-        m.T_vbo.free();
-        m.N_vbo.free();
+    shadowMapProgram.free();
+    skyboxProgram.free();
+    impostorProgram.free();
+    particleProgram.free();
+    FrameBuffer.free();
+    InstanceBuffer.free();
+    DrawListBuffer.free();
+    for (Mesh &m : Planets) {
+        free_planet(&m);
     }
+    Planets.clear();
 
     // deallocate sun
-    Sun.vao.free();
-    Sun.V_vbo.free();
-    Sun.T_vbo.free();
-    Sun.N_vbo.free();
-
-    // deallocate universe background
-    Universe.vao.free();
-    Universe.V_vbo.free();
-    Universe.T_vbo.free();
-    Universe.N_vbo.free();
+    // the sphere levels go with the solar system
+    free_planet(&Sun);
+
+    // texture and shadow map arrays
+    free_solar_system();
 
     // Deallocate glfw internals
     glfwTerminate();
@@ -0,0 +1,141 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "mapped_file.h"
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+bool MappedFile::open(const std::string &fname) {
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		return false;
+	}
+	void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) {
+		CloseHandle(mapping);
+		return false;
+	}
+	handle = mapping;
+	data = static_cast<const unsigned char *>(view);
+	size = (size_t) length.QuadPart;
+#else
+	int fd = ::open(fname.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void *view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	handle = view;
+	data = static_cast<const unsigned char *>(view);
+	size = (size_t) st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close() {
+	if (handle == NULL) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE) handle);
+#else
+	munmap(handle, size);
+#endif
+	handle = NULL;
+	data = NULL;
+	size = 0;
+}
+
+void MappedFile::prefetch() const {
+	if (handle == NULL) {
+		return;
+	}
+#ifndef _WIN32
+	// one sequential read instead of a page fault per touched page
+	madvise(handle, size, MADV_SEQUENTIAL);
+	madvise(handle, size, MADV_WILLNEED);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool write_file(const std::string &fname, const std::vector<unsigned char> &bytes) {
+	std::string tmp = fname + ".tmp";
+	FILE *out = fopen(tmp.c_str(), "wb");
+	if (out == NULL) {
+		return false;
+	}
+	bool ok = fwrite(bytes.data(), 1, bytes.size(), out) == bytes.size();
+	ok = (fclose(out) == 0) && ok;
+	if (!ok || !replace_file(tmp, fname)) {
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool replace_file(const std::string &from, const std::string &to) {
+#ifdef _WIN32
+	// rename() refuses to overwrite on windows
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	// atomic, a reader opens either the old file or the new one
+	return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+unsigned long long hash_bytes(const void *data, size_t size) {
+	// FNV-1a style mixing, but eight bytes at a time
+	const unsigned long long prime = 0x100000001b3ULL;
+	const unsigned char *bytes = static_cast<const unsigned char *>(data);
+	unsigned long long h = 0xcbf29ce484222325ULL ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		unsigned long long word;
+		memcpy(&word, bytes + i, 8);
+		h = (h ^ word) * prime;
+		h ^= h >> 29;
+	}
+	for (; i < size; i++) {
+		h = (h ^ bytes[i]) * prime;
+	}
+	// final avalanche from MurmurHash3
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <string>
+#include <vector>
+#include <cstddef>
+////////////////////////////////////////////////////////////////////////////////
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+	const unsigned char *data;
+	size_t size;
+
+	MappedFile() : data(NULL), size(0), handle(NULL) { }
+	~MappedFile() { close(); }
+
+	// Map the file, returns false if it does not exist or is empty
+	bool open(const std::string &fname);
+
+	// Unmap the file
+	void close();
+
+	// Ask the OS to read the whole mapping ahead, front to back
+	void prefetch() const;
+
+private:
+	void *handle; // platform specific mapping handle
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+};
+
+// Fast 64-bit hash of a memory block, used to key caches on their source
+unsigned long long hash_bytes(const void *data, size_t size);
+
+// Write bytes into a file next to fname and rename it over fname, so a
+// reader never maps half a file
+bool write_file(const std::string &fname, const std::vector<unsigned char> &bytes);
+
+// Move a file over another in one step, so there is never a moment without
+// one of them at to
+bool replace_file(const std::string &from, const std::string &to);
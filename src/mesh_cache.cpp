@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "mesh_cache.h"
+#include <algorithm>
+#include <cstring>
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t align16(uint32_t offset) {
+	return (offset + 15) & ~15u;
+}
+
+bool read_mesh_cache(const unsigned char *data, size_t size, uint64_t sourceHash, MeshView &view) {
+	if (size < sizeof(MeshCacheHeader)) {
+		return false;
+	}
+	MeshCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != MESH_CACHE_MAGIC ||
+		header.version != MESH_CACHE_VERSION ||
+		header.sourceHash != sourceHash) {
+		return false;
+	}
+	// make sure every block lies inside the file
+	uint64_t vertexBytes = (uint64_t) header.vertexCount * sizeof(float);
+	if (header.positionOffset + 3 * vertexBytes > size ||
+		header.normalOffset + 3 * vertexBytes > size ||
+		header.texcoordOffset + 2 * vertexBytes > size ||
+		header.indexOffset + (uint64_t) header.indexCount * sizeof(uint32_t) > size) {
+		return false;
+	}
+	// and is aligned for what it holds
+	if ((header.positionOffset | header.normalOffset | header.texcoordOffset | header.indexOffset) & 3) {
+		return false;
+	}
+	view.positions = reinterpret_cast<const float *>(data + header.positionOffset);
+	view.normals = reinterpret_cast<const float *>(data + header.normalOffset);
+	view.texcoords = reinterpret_cast<const float *>(data + header.texcoordOffset);
+	view.indices = reinterpret_cast<const uint32_t *>(data + header.indexOffset);
+	view.vertexCount = header.vertexCount;
+	view.indexCount = header.indexCount;
+	return valid_mesh(view);
+}
+
+bool valid_mesh(const MeshView &view) {
+	if (view.indexCount % 3 != 0) {
+		return false;
+	}
+	// one pass over the indices, far cheaper than the upload they feed
+	uint32_t highest = 0;
+	for (uint32_t i = 0; i < view.indexCount; i++) {
+		highest = std::max(highest, view.indices[i]);
+	}
+	return view.indexCount == 0 || highest < view.vertexCount;
+}
+
+void encode_mesh_cache(
+	uint64_t sourceHash,
+	const Eigen::MatrixXf &V,
+	const Eigen::MatrixXf &N,
+	const Eigen::MatrixXf &T,
+	const Eigen::MatrixXi &F,
+	std::vector<unsigned char> &bytes
+) {
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	header.vertexCount = V.cols();
+	header.indexCount = F.size();
+	header.positionOffset = align16(sizeof(header));
+	header.normalOffset = align16(header.positionOffset + V.size() * sizeof(float));
+	header.texcoordOffset = align16(header.normalOffset + N.size() * sizeof(float));
+	header.indexOffset = align16(header.texcoordOffset + T.size() * sizeof(float));
+
+	// the padding between the blocks stays zero
+	bytes.assign(header.indexOffset + F.size() * sizeof(uint32_t), 0);
+	memcpy(&bytes[0], &header, sizeof(header));
+	memcpy(&bytes[header.positionOffset], V.data(), V.size() * sizeof(float));
+	memcpy(&bytes[header.normalOffset], N.data(), N.size() * sizeof(float));
+	memcpy(&bytes[header.texcoordOffset], T.data(), T.size() * sizeof(float));
+	memcpy(&bytes[header.indexOffset], F.data(), F.size() * sizeof(uint32_t));
+}
+
+bool write_mesh_cache(
+	const std::string &fname,
+	uint64_t sourceHash,
+	const Eigen::MatrixXf &V,
+	const Eigen::MatrixXf &N,
+	const Eigen::MatrixXf &T,
+	const Eigen::MatrixXi &F
+) {
+	std::vector<unsigned char> bytes;
+	encode_mesh_cache(sourceHash, V, N, T, F, bytes);
+	return write_file(fname, bytes);
+}
+
+MeshView mesh_view(
+	const Eigen::MatrixXf &V,
+	const Eigen::MatrixXf &N,
+	const Eigen::MatrixXf &T,
+	const Eigen::MatrixXi &F
+) {
+	MeshView view;
+	view.positions = V.data();
+	view.normals = N.data();
+	view.texcoords = T.data();
+	view.indices = reinterpret_cast<const uint32_t *>(F.data());
+	view.vertexCount = V.cols();
+	view.indexCount = F.size();
+	return view;
+}
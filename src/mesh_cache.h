@@ -0,0 +1,74 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "mapped_file.h"
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+// Binary mesh cache holding the arrays exactly as they are uploaded:
+// positions (3 floats), normals (3 floats), uvs (2 floats) and
+// triangle indices (3 unsigned ints), each block 16 bytes aligned
+#define MESH_CACHE_MAGIC 0x4853454d // "MESH"
+#define MESH_CACHE_VERSION 1
+
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash; // hash of the file the mesh was built from
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t positionOffset; // byte offsets from the start of the file
+	uint32_t normalOffset;
+	uint32_t texcoordOffset;
+	uint32_t indexOffset;
+	uint32_t reserved[6];
+};
+
+// Pointers to the mesh arrays, either inside a mapped cache or in memory
+struct MeshView {
+	const float *positions;
+	const float *normals;
+	const float *texcoords;
+	const uint32_t *indices;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+};
+
+// Validate a mapped cache, or a packed copy of one, against the source hash
+// and point view into it; a stale or corrupt one fails, see valid_mesh()
+bool read_mesh_cache(const unsigned char *data, size_t size, uint64_t sourceHash, MeshView &view);
+
+// Whether the indices form whole triangles of vertices the mesh has, so a
+// draw never reads past the vertex buffers
+bool valid_mesh(const MeshView &view);
+
+// Lay the mesh arrays out as a cache file in memory
+void encode_mesh_cache(
+	uint64_t sourceHash,
+	const Eigen::MatrixXf &V,
+	const Eigen::MatrixXf &N,
+	const Eigen::MatrixXf &T,
+	const Eigen::MatrixXi &F,
+	std::vector<unsigned char> &bytes
+);
+
+// Write the mesh arrays into a cache file
+bool write_mesh_cache(
+	const std::string &fname,
+	uint64_t sourceHash,
+	const Eigen::MatrixXf &V,
+	const Eigen::MatrixXf &N,
+	const Eigen::MatrixXf &T,
+	const Eigen::MatrixXi &F
+);
+
+// View of mesh arrays held in memory
+MeshView mesh_view(
+	const Eigen::MatrixXf &V,
+	const Eigen::MatrixXf &N,
+	const Eigen::MatrixXf &T,
+	const Eigen::MatrixXi &F
+);
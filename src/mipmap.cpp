@@ -0,0 +1,179 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "mipmap.h"
+#include <cmath>
+#include <cstring>
+////////////////////////////////////////////////////////////////////////////////
+
+// Lanczos kernel with 2 lobes
+static float lanczos2(float t) {
+	t = std::fabs(t);
+	if (t < 1e-5f) {
+		return 1.0f;
+	}
+	if (t >= 2.0f) {
+		return 0.0f;
+	}
+	const float pi = 3.14159265358979f;
+	return 2.0f * std::sin(pi * t) * std::sin(pi * t / 2.0f) / (pi * pi * t * t);
+}
+
+// Shrink each row of the w x h image src to dw texels and write them as the
+// columns of dst, an h x dw image; two calls shrink both axes
+static void shrink_transpose(const float *src, int w, int h, float *dst, int dw, bool wrap) {
+	// the taps are the same for every row
+	float scale = float(w) / dw;
+	std::vector<int> first(dw), count(dw);
+	std::vector<int> taps;
+	std::vector<float> weights;
+	for (int x = 0; x < dw; x++) {
+		float center = (x + 0.5f) * scale - 0.5f;
+		int i0 = (int) std::ceil(center - 2.0f * scale);
+		int i1 = (int) std::floor(center + 2.0f * scale);
+		first[x] = (int) taps.size();
+		float sum = 0.0f;
+		for (int i = i0; i <= i1; i++) {
+			float weight = lanczos2((i - center) / scale);
+			if (weight == 0.0f) {
+				continue;
+			}
+			int j = wrap ? ((i % w) + w) % w : std::min(std::max(i, 0), w - 1);
+			taps.push_back(j);
+			weights.push_back(weight);
+			sum += weight;
+		}
+		count[x] = (int) taps.size() - first[x];
+		for (int k = first[x]; k < (int) taps.size(); k++) {
+			weights[k] /= sum;
+		}
+	}
+
+	for (int y = 0; y < h; y++) {
+		const float *row = src + 4 * (size_t) y * w;
+		for (int x = 0; x < dw; x++) {
+			float c[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int k = first[x]; k < first[x] + count[x]; k++) {
+				const float *p = row + 4 * taps[k];
+				for (int n = 0; n < 4; n++) {
+					c[n] += weights[k] * p[n];
+				}
+			}
+			float *out = dst + 4 * ((size_t) x * h + y);
+			for (int n = 0; n < 4; n++) {
+				// the negative lobes may overshoot
+				out[n] = std::min(std::max(c[n], 0.0f), 1.0f);
+			}
+		}
+	}
+}
+
+int mip_levels(int width, int height) {
+	int levels = 1;
+	while ((width >> levels) > 0 || (height >> levels) > 0) {
+		levels++;
+	}
+	return levels;
+}
+
+size_t mip_chain_bytes(int width, int height, int levels, int format) {
+	size_t bytes = 0;
+	for (int l = 0; l < levels; l++) {
+		bytes += texture_level_bytes(format, mip_size(width, l), mip_size(height, l));
+	}
+	return bytes;
+}
+
+void build_mip_chain(const Image &base, int levels, std::vector<unsigned char> &chain) {
+	int w = base.width, h = base.height;
+	chain.resize(mip_chain_bytes(w, h, levels));
+
+	// the levels are filtered from each other in linear light
+	std::vector<float> level(4 * (size_t) w * h), rows, next;
+	for (int y = 0; y < h; y++) {
+		memcpy(&chain[4 * (size_t) y * w], base.row(y), 4 * (size_t) w);
+		srgb_to_linear(base.row(y), &level[4 * (size_t) y * w], w);
+	}
+	unsigned char *out = chain.data() + 4 * (size_t) w * h;
+	for (int l = 1; l < levels; l++) {
+		int dw = mip_size(w, 1), dh = mip_size(h, 1);
+		rows.resize(4 * (size_t) h * dw);
+		next.resize(4 * (size_t) dw * dh);
+		// longitude wraps around, latitude stops at the poles
+		shrink_transpose(level.data(), w, h, rows.data(), dw, true);
+		shrink_transpose(rows.data(), h, dw, next.data(), dh, false);
+		linear_to_srgb(next.data(), out, (size_t) dw * dh);
+		out += next.size();
+		level.swap(next);
+		w = dw;
+		h = dh;
+	}
+}
+
+bool read_mip_cache(
+	const unsigned char *data,
+	size_t size,
+	uint64_t sourceHash,
+	int format,
+	int width,
+	int height,
+	int levels,
+	const unsigned char *&chain
+) {
+	if (size < sizeof(MipCacheHeader)) {
+		return false;
+	}
+	MipCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != MIP_CACHE_MAGIC ||
+		header.version != MIP_CACHE_VERSION ||
+		header.sourceHash != sourceHash ||
+		header.format != (uint32_t) format ||
+		header.width != (uint32_t) width ||
+		header.height != (uint32_t) height ||
+		header.levels < (uint32_t) levels) {
+		return false;
+	}
+	if (header.levelOffset + mip_chain_bytes(width, height, levels, format) > size) {
+		return false;
+	}
+	chain = data + header.levelOffset;
+	return true;
+}
+
+void encode_mip_cache(
+	uint64_t sourceHash,
+	int format,
+	int width,
+	int height,
+	int levels,
+	const std::vector<unsigned char> &chain,
+	std::vector<unsigned char> &bytes
+) {
+	MipCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MIP_CACHE_MAGIC;
+	header.version = MIP_CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	header.width = width;
+	header.height = height;
+	header.levels = levels;
+	header.levelOffset = (sizeof(header) + 15) & ~15u;
+	header.format = format;
+
+	bytes.assign(header.levelOffset + chain.size(), 0);
+	memcpy(&bytes[0], &header, sizeof(header));
+	memcpy(&bytes[header.levelOffset], chain.data(), chain.size());
+}
+
+bool write_mip_cache(
+	const std::string &fname,
+	uint64_t sourceHash,
+	int format,
+	int width,
+	int height,
+	int levels,
+	const std::vector<unsigned char> &chain
+) {
+	std::vector<unsigned char> bytes;
+	encode_mip_cache(sourceHash, format, width, height, levels, chain, bytes);
+	return write_file(fname, bytes);
+}
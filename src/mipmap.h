@@ -0,0 +1,83 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "block_compress.h"
+#include "image.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+// Binary cache of a mip chain, levels packed one after the other from the
+// full size down, starting 16 bytes aligned, RGBA8 or compressed blocks
+#define MIP_CACHE_MAGIC 0x5350494d // "MIPS"
+#define MIP_CACHE_VERSION 2
+
+struct MipCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash; // hash of the image file the chain was built from
+	uint32_t width; // size of level 0
+	uint32_t height;
+	uint32_t levels;
+	uint32_t levelOffset; // byte offset of level 0
+	uint32_t format; // TEXTURE_FORMAT_*
+	uint32_t reserved[5];
+};
+
+// Every texture is resampled to the size of the texture array
+#define TEXTURE_LAYER_WIDTH 2048
+#define TEXTURE_LAYER_HEIGHT 1024
+
+// Number of levels of a full chain, down to 1 x 1
+int mip_levels(int width, int height);
+
+// Size of a level, halved and rounded down but never below 1
+inline int mip_size(int size, int level) {
+	return std::max(size >> level, 1);
+}
+
+// Bytes of the first levels of a packed chain, also the offset of the next one
+size_t mip_chain_bytes(int width, int height, int levels, int format = TEXTURE_FORMAT_RGBA8);
+
+// Pack base as level 0 and downsample it into the following levels,
+// filtering in linear light with a Lanczos kernel; wraps around horizontally
+// as the images are longitude / latitude maps
+void build_mip_chain(const Image &base, int levels, std::vector<unsigned char> &chain);
+
+// Validate a mapped cache, or a packed copy of one, against the source hash,
+// the format and the chain layout and point chain into it
+bool read_mip_cache(
+	const unsigned char *data,
+	size_t size,
+	uint64_t sourceHash,
+	int format,
+	int width,
+	int height,
+	int levels,
+	const unsigned char *&chain
+);
+
+// Lay a packed chain out as a cache file in memory
+void encode_mip_cache(
+	uint64_t sourceHash,
+	int format,
+	int width,
+	int height,
+	int levels,
+	const std::vector<unsigned char> &chain,
+	std::vector<unsigned char> &bytes
+);
+
+// Write a packed chain into a cache file
+bool write_mip_cache(
+	const std::string &fname,
+	uint64_t sourceHash,
+	int format,
+	int width,
+	int height,
+	int levels,
+	const std::vector<unsigned char> &chain
+);
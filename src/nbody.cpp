@@ -0,0 +1,805 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "nbody.h"
+#include "ephemeris.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+static const double TWO_PI = 6.28318530717958647692;
+
+// Run f(first, last) over [0, count) in pieces of grain, on the pool if any
+template <typename F>
+static void parallel_for(ThreadPool *pool, int count, int grain, const F &f) {
+	if (pool == NULL || count <= grain) {
+		f(0, count);
+		return;
+	}
+	for (int first = 0; first < count; first += grain) {
+		int last = std::min(count, first + grain);
+		pool->submit([&f, first, last] { f(first, last); });
+	}
+	pool->wait();
+}
+
+// the bits of a 21 bit value spread out to every third bit
+static uint64_t spread_bits(uint64_t v) {
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffull;
+	v = (v | v << 16) & 0x1f0000ff0000ffull;
+	v = (v | v << 8) & 0x100f00f00f00f00full;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+// octant of a key below a node of level, x in the high bit and z in the low one
+static int octant(uint64_t key, int level) {
+	return (int) (key >> (3 * (NBODY_TREE_LEVELS - 1 - level))) & 7;
+}
+
+struct SortKey {
+	uint64_t key;
+	int index;
+	bool operator<(const SortKey &o) const { return key < o.key || (key == o.key && index < o.index); }
+};
+
+void Octree::build(const double *x, const double *y, const double *z, const double *m, int count, ThreadPool *pool) {
+	nodes.clear();
+	keys.resize(count);
+	order.resize(count);
+	px.resize(count);
+	py.resize(count);
+	pz.resize(count);
+	pm.resize(count);
+	if (count == 0) {
+		return;
+	}
+	int threads = pool != NULL ? (int) pool->size() : 1;
+	int grain = std::max(4096, (count + threads - 1) / threads);
+
+	// the bounding cube
+	int parts = (count + grain - 1) / grain;
+	std::vector<double> bounds(6 * (size_t) parts);
+	parallel_for(pool, count, grain, [&](int first, int last) {
+		double *b = &bounds[6 * (size_t) (first / grain)];
+		b[0] = b[1] = x[first];
+		b[2] = b[3] = y[first];
+		b[4] = b[5] = z[first];
+		for (int i = first + 1; i < last; i++) {
+			b[0] = std::min(b[0], x[i]);
+			b[1] = std::max(b[1], x[i]);
+			b[2] = std::min(b[2], y[i]);
+			b[3] = std::max(b[3], y[i]);
+			b[4] = std::min(b[4], z[i]);
+			b[5] = std::max(b[5], z[i]);
+		}
+	});
+	double lo[3] = { bounds[0], bounds[2], bounds[4] }, hi[3] = { bounds[1], bounds[3], bounds[5] };
+	for (int p = 1; p < parts; p++) {
+		for (int k = 0; k < 3; k++) {
+			lo[k] = std::min(lo[k], bounds[6 * p + 2 * k]);
+			hi[k] = std::max(hi[k], bounds[6 * p + 2 * k + 1]);
+		}
+	}
+	double side = std::max(std::max(hi[0] - lo[0], hi[1] - lo[1]), hi[2] - lo[2]);
+	// a little larger, so the far corner still quantizes inside
+	side = side > 0.0 ? side * (1.0 + 1e-9) : 1.0;
+	double scale = (double) (1 << NBODY_TREE_LEVELS) / side;
+
+	// Morton keys, sorted in chunks and merged pairwise
+	std::vector<SortKey> sorted(count);
+	parallel_for(pool, count, grain, [&](int first, int last) {
+		const uint64_t top = (1 << NBODY_TREE_LEVELS) - 1;
+		for (int i = first; i < last; i++) {
+			uint64_t q[3] = {
+				std::min(top, (uint64_t) ((x[i] - lo[0]) * scale)),
+				std::min(top, (uint64_t) ((y[i] - lo[1]) * scale)),
+				std::min(top, (uint64_t) ((z[i] - lo[2]) * scale)) };
+			sorted[i].key = spread_bits(q[0]) << 2 | spread_bits(q[1]) << 1 | spread_bits(q[2]);
+			sorted[i].index = i;
+		}
+		std::sort(sorted.begin() + first, sorted.begin() + last);
+	});
+	for (int width = grain; width < count; width *= 2) {
+		parallel_for(pool, count, 2 * width, [&](int first, int last) {
+			int middle = std::min(last, first + width);
+			std::inplace_merge(sorted.begin() + first, sorted.begin() + middle, sorted.begin() + last);
+		});
+	}
+	parallel_for(pool, count, grain, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			int j = sorted[i].index;
+			keys[i] = sorted[i].key;
+			order[i] = j;
+			px[i] = x[j];
+			py[i] = y[j];
+			pz[i] = z[j];
+			pm[i] = m[j];
+		}
+	});
+
+	OctreeNode root;
+	root.half = 0.5 * side;
+	for (int k = 0; k < 3; k++) {
+		root.center[k] = lo[k] + root.half;
+	}
+	root.begin = 0;
+	root.count = count;
+	root.first = 0;
+	root.children = 0;
+	nodes.push_back(root);
+
+	// the top serially, down to ranges a worker each
+	std::vector<Subtree> subtrees;
+	std::vector<int> top;
+	build_top(0, 0, count, 0, std::max(NBODY_LEAF_SIZE, count / (8 * threads)), subtrees, top);
+	parallel_for(pool, (int) subtrees.size(), 1, [&](int first, int last) {
+		for (int s = first; s < last; s++) {
+			Subtree &sub = subtrees[s];
+			sub.nodes.push_back(nodes[sub.node]);
+			build_node(sub.nodes, 0, sub.first, sub.last, sub.level);
+		}
+	});
+	// the nodes of a subtree go to the end, its root where it was split off
+	for (Subtree &sub : subtrees) {
+		int base = (int) nodes.size() - 1;
+		for (size_t i = 0; i < sub.nodes.size(); i++) {
+			OctreeNode node = sub.nodes[i];
+			if (node.children > 0) {
+				node.first += base;
+			}
+			if (i == 0) {
+				nodes[sub.node] = node;
+			} else {
+				nodes.push_back(node);
+			}
+		}
+		std::vector<OctreeNode>().swap(sub.nodes);
+	}
+	// children are listed after their parents
+	for (size_t i = top.size(); i-- > 0;) {
+		finish_node(nodes, top[i]);
+	}
+}
+
+int Octree::split(std::vector<OctreeNode> &tree, int index, int first, int last, int level, int *bounds) const {
+	OctreeNode parent = tree[index];
+	double half = 0.5 * parent.half;
+	int base = (int) tree.size(), children = 0;
+	bounds[0] = first;
+	for (int d = 0; d < 8 && first < last; d++) {
+		int end = (int) (std::partition_point(keys.begin() + first, keys.begin() + last,
+			[level, d](uint64_t key) { return octant(key, level) <= d; }) - keys.begin());
+		if (end == first) {
+			continue;
+		}
+		OctreeNode child;
+		child.center[0] = parent.center[0] + (d & 4 ? half : -half);
+		child.center[1] = parent.center[1] + (d & 2 ? half : -half);
+		child.center[2] = parent.center[2] + (d & 1 ? half : -half);
+		child.half = half;
+		child.begin = first;
+		child.count = end - first;
+		child.first = 0;
+		child.children = 0;
+		tree.push_back(child);
+		bounds[++children] = end;
+		first = end;
+	}
+	tree[index].first = base;
+	tree[index].children = children;
+	return children;
+}
+
+void Octree::build_node(std::vector<OctreeNode> &tree, int index, int first, int last, int level) const {
+	if (last - first <= NBODY_LEAF_SIZE || level == NBODY_TREE_LEVELS) {
+		tree[index].first = 0;
+		tree[index].children = 0;
+	} else {
+		int bounds[9];
+		int children = split(tree, index, first, last, level, bounds);
+		int base = tree[index].first;
+		for (int c = 0; c < children; c++) {
+			build_node(tree, base + c, bounds[c], bounds[c + 1], level + 1);
+		}
+	}
+	finish_node(tree, index);
+}
+
+void Octree::build_top(int index, int first, int last, int level, int grain, std::vector<Subtree> &subtrees, std::vector<int> &top) {
+	if (last - first <= grain || level == NBODY_TREE_LEVELS) {
+		Subtree sub;
+		sub.node = index;
+		sub.first = first;
+		sub.last = last;
+		sub.level = level;
+		subtrees.push_back(sub);
+		return;
+	}
+	top.push_back(index);
+	int bounds[9];
+	int children = split(nodes, index, first, last, level, bounds);
+	int base = nodes[index].first;
+	for (int c = 0; c < children; c++) {
+		build_top(base + c, bounds[c], bounds[c + 1], level + 1, grain, subtrees, top);
+	}
+}
+
+void Octree::finish_node(std::vector<OctreeNode> &tree, int index) const {
+	OctreeNode &node = tree[index];
+	double mass = 0.0, com[3] = { 0.0, 0.0, 0.0 };
+	if (node.children == 0) {
+		for (int i = node.begin; i < node.begin + node.count; i++) {
+			mass += pm[i];
+			com[0] += pm[i] * px[i];
+			com[1] += pm[i] * py[i];
+			com[2] += pm[i] * pz[i];
+		}
+	} else {
+		for (int c = node.first; c < node.first + node.children; c++) {
+			const OctreeNode &child = tree[c];
+			mass += child.mass;
+			for (int k = 0; k < 3; k++) {
+				com[k] += child.mass * child.com[k];
+			}
+		}
+	}
+	node.mass = mass;
+	for (int k = 0; k < 3; k++) {
+		node.com[k] = mass > 0.0 ? com[k] / mass : node.center[k];
+	}
+}
+
+uint64_t Octree::accelerate(const double p[3], int self, double theta, double a[3]) const {
+	if (nodes.empty()) {
+		return 0;
+	}
+	double theta2 = theta * theta;
+	uint64_t interactions = 0;
+	int stack[8 * (NBODY_TREE_LEVELS + 1)];
+	int depth = 0;
+	stack[depth++] = 0;
+	while (depth > 0) {
+		const OctreeNode &node = nodes[stack[--depth]];
+		if (node.children == 0) {
+			for (int i = node.begin; i < node.begin + node.count; i++) {
+				if (i == self) {
+					continue;
+				}
+				double dx = px[i] - p[0], dy = py[i] - p[1], dz = pz[i] - p[2];
+				double r2 = dx * dx + dy * dy + dz * dz + NBODY_SOFTENING2;
+				double f = pm[i] / (r2 * std::sqrt(r2));
+				a[0] += f * dx;
+				a[1] += f * dy;
+				a[2] += f * dz;
+			}
+			interactions += node.count;
+			continue;
+		}
+		double dx = node.com[0] - p[0], dy = node.com[1] - p[1], dz = node.com[2] - p[2];
+		double r2 = dx * dx + dy * dy + dz * dz;
+		// a node around the point never counts as one mass, however far its center of mass
+		bool inside = std::fabs(p[0] - node.center[0]) <= node.half &&
+			std::fabs(p[1] - node.center[1]) <= node.half &&
+			std::fabs(p[2] - node.center[2]) <= node.half;
+		double size = 2.0 * node.half;
+		if (!inside && size * size < theta2 * r2) {
+			r2 += NBODY_SOFTENING2;
+			double f = node.mass / (r2 * std::sqrt(r2));
+			a[0] += f * dx;
+			a[1] += f * dy;
+			a[2] += f * dz;
+			interactions++;
+		} else {
+			for (int c = node.first; c < node.first + node.children; c++) {
+				stack[depth++] = c;
+			}
+		}
+	}
+	return interactions;
+}
+
+void Octree::groups(int size, std::vector<int> &found) const {
+	found.clear();
+	if (nodes.empty()) {
+		return;
+	}
+	int stack[8 * (NBODY_TREE_LEVELS + 1)];
+	int depth = 0;
+	stack[depth++] = 0;
+	while (depth > 0) {
+		int index = stack[--depth];
+		const OctreeNode &node = nodes[index];
+		if (node.count <= size || node.children == 0) {
+			found.push_back(index);
+			continue;
+		}
+		// the last child on top, so the groups come out in tree order
+		for (int c = node.first + node.children; c-- > node.first;) {
+			stack[depth++] = c;
+		}
+	}
+}
+
+void Octree::interactions(int group, double theta, InteractionList &list) const {
+	// the box around the particles of the group, tighter than its cube
+	const OctreeNode &g = nodes[group];
+	double lo[3] = { px[g.begin], py[g.begin], pz[g.begin] }, hi[3] = { lo[0], lo[1], lo[2] };
+	for (int i = g.begin + 1; i < g.begin + g.count; i++) {
+		lo[0] = std::min(lo[0], px[i]);
+		hi[0] = std::max(hi[0], px[i]);
+		lo[1] = std::min(lo[1], py[i]);
+		hi[1] = std::max(hi[1], py[i]);
+		lo[2] = std::min(lo[2], pz[i]);
+		hi[2] = std::max(hi[2], pz[i]);
+	}
+	double center[3], extent[3];
+	for (int k = 0; k < 3; k++) {
+		center[k] = 0.5 * (lo[k] + hi[k]);
+		extent[k] = 0.5 * (hi[k] - lo[k]);
+	}
+	double theta2 = theta * theta;
+	int stack[8 * (NBODY_TREE_LEVELS + 1)];
+	int depth = 0;
+	stack[depth++] = 0;
+	while (depth > 0) {
+		const OctreeNode &node = nodes[stack[--depth]];
+		if (node.children == 0) {
+			for (int i = node.begin; i < node.begin + node.count; i++) {
+				list.add(px[i], py[i], pz[i], pm[i]);
+			}
+			continue;
+		}
+		// distance from the center of mass to the nearest point of the box,
+		// and whether the cube reaches into the box at all
+		double d2 = 0.0;
+		bool overlaps = true;
+		for (int k = 0; k < 3; k++) {
+			double offset = std::fabs(node.com[k] - center[k]) - extent[k];
+			if (offset > 0.0) {
+				d2 += offset * offset;
+			}
+			overlaps = overlaps && std::fabs(node.center[k] - center[k]) <= node.half + extent[k];
+		}
+		double size = 2.0 * node.half;
+		if (!overlaps && size * size < theta2 * d2) {
+			list.add(node.com[0], node.com[1], node.com[2], node.mass);
+		} else {
+			for (int c = node.first; c < node.first + node.children; c++) {
+				stack[depth++] = c;
+			}
+		}
+	}
+}
+
+static void accelerate_scalar(const double *x, const double *y, const double *z, const double *m, int count,
+	const double p[3], double a[3]) {
+	double sx = 0.0, sy = 0.0, sz = 0.0;
+	for (int j = 0; j < count; j++) {
+		double dx = x[j] - p[0], dy = y[j] - p[1], dz = z[j] - p[2];
+		double r2 = dx * dx + dy * dy + dz * dz + NBODY_SOFTENING2;
+		double f = m[j] / (r2 * std::sqrt(r2));
+		sx += f * dx;
+		sy += f * dy;
+		sz += f * dz;
+	}
+	a[0] += sx;
+	a[1] += sy;
+	a[2] += sz;
+}
+
+#ifdef CPU_X86
+// four masses at a time, the square root and the division are most of it
+CPU_TARGET_AVX2 static void accelerate_avx2(const double *x, const double *y, const double *z, const double *m, int count,
+	const double p[3], double a[3]) {
+	const __m256d px = _mm256_set1_pd(p[0]), py = _mm256_set1_pd(p[1]), pz = _mm256_set1_pd(p[2]);
+	const __m256d softening = _mm256_set1_pd(NBODY_SOFTENING2);
+	__m256d sx = _mm256_setzero_pd(), sy = _mm256_setzero_pd(), sz = _mm256_setzero_pd();
+	int j = 0;
+	for (; j + 4 <= count; j += 4) {
+		__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), px);
+		__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), py);
+		__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), pz);
+		__m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_fmadd_pd(dz, dz, softening)));
+		__m256d f = _mm256_div_pd(_mm256_loadu_pd(m + j), _mm256_mul_pd(r2, _mm256_sqrt_pd(r2)));
+		sx = _mm256_fmadd_pd(f, dx, sx);
+		sy = _mm256_fmadd_pd(f, dy, sy);
+		sz = _mm256_fmadd_pd(f, dz, sz);
+	}
+	double lanes[3][4];
+	_mm256_storeu_pd(lanes[0], sx);
+	_mm256_storeu_pd(lanes[1], sy);
+	_mm256_storeu_pd(lanes[2], sz);
+	for (int k = 0; k < 3; k++) {
+		a[k] += (lanes[k][0] + lanes[k][1]) + (lanes[k][2] + lanes[k][3]);
+	}
+	accelerate_scalar(x + j, y + j, z + j, m + j, count - j, p, a);
+}
+#endif
+
+void InteractionList::accelerate(const double p[3], double a[3], int isa) const {
+#ifdef CPU_X86
+	if (cpu_resolve_isa(isa) == CPU_ISA_AVX2) {
+		accelerate_avx2(x.data(), y.data(), z.data(), m.data(), size(), p, a);
+		return;
+	}
+#endif
+	accelerate_scalar(x.data(), y.data(), z.data(), m.data(), size(), p, a);
+}
+
+void NBodySystem::clear() {
+	for (std::vector<double> *v : { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &mass, &wanted }) {
+		v->clear();
+	}
+	level.clear();
+	massive = 0;
+	time = 0.0;
+	interactions = 0;
+	evaluations = 0;
+	builds = 0;
+	accelerated = false;
+}
+
+void NBodySystem::add(const double position[3], const double velocity[3], double m) {
+	x.push_back(position[0]);
+	y.push_back(position[1]);
+	z.push_back(position[2]);
+	vx.push_back(velocity[0]);
+	vy.push_back(velocity[1]);
+	vz.push_back(velocity[2]);
+	ax.push_back(0.0);
+	ay.push_back(0.0);
+	az.push_back(0.0);
+	mass.push_back(m);
+	wanted.push_back(0.0);
+	level.clear();
+	accelerated = false;
+}
+
+void NBodySystem::to_barycenter() {
+	double total = 0.0, p[3] = { 0.0, 0.0, 0.0 }, v[3] = { 0.0, 0.0, 0.0 };
+	for (int i = 0; i < size(); i++) {
+		total += mass[i];
+		p[0] += mass[i] * x[i];
+		p[1] += mass[i] * y[i];
+		p[2] += mass[i] * z[i];
+		v[0] += mass[i] * vx[i];
+		v[1] += mass[i] * vy[i];
+		v[2] += mass[i] * vz[i];
+	}
+	if (total <= 0.0) {
+		return;
+	}
+	for (int i = 0; i < size(); i++) {
+		x[i] -= p[0] / total;
+		y[i] -= p[1] / total;
+		z[i] -= p[2] / total;
+		vx[i] -= v[0] / total;
+		vy[i] -= v[1] / total;
+		vz[i] -= v[2] / total;
+	}
+	accelerated = false;
+}
+
+double NBodySystem::massive_jerk(int i, const double a[3]) const {
+	double j[3] = { 0.0, 0.0, 0.0 };
+	for (int k = 0; k < massive; k++) {
+		if (k == i) {
+			continue;
+		}
+		double dx = x[k] - x[i], dy = y[k] - y[i], dz = z[k] - z[i];
+		double dvx = vx[k] - vx[i], dvy = vy[k] - vy[i], dvz = vz[k] - vz[i];
+		double r2 = dx * dx + dy * dy + dz * dz + NBODY_SOFTENING2;
+		double f = mass[k] / (r2 * std::sqrt(r2));
+		double g = 3.0 * (dx * dvx + dy * dvy + dz * dvz) / r2;
+		j[0] += f * (dvx - g * dx);
+		j[1] += f * (dvy - g * dy);
+		j[2] += f * (dvz - g * dz);
+	}
+	// the step that turns the acceleration by about sqrt(eta) of itself
+	double jerk = std::sqrt(j[0] * j[0] + j[1] * j[1] + j[2] * j[2]);
+	double acceleration = std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+	return jerk > 0.0 ? std::sqrt(eta * acceleration / jerk) : HUGE_VAL;
+}
+
+uint64_t NBodySystem::accelerate_massive() {
+	uint64_t count = 0;
+	for (int i = 0; i < massive; i++) {
+		if (!active.empty() && !active[i]) {
+			continue;
+		}
+		double p[3] = { x[i], y[i], z[i] }, a[3] = { 0.0, 0.0, 0.0 };
+		for (int j = 0; j < massive; j++) {
+			if (j == i) {
+				continue;
+			}
+			double dx = x[j] - p[0], dy = y[j] - p[1], dz = z[j] - p[2];
+			double r2 = dx * dx + dy * dy + dz * dz + NBODY_SOFTENING2;
+			double f = mass[j] / (r2 * std::sqrt(r2));
+			a[0] += f * dx;
+			a[1] += f * dy;
+			a[2] += f * dz;
+		}
+		count += massive - 1;
+		count += tree.accelerate(p, -1, theta, a);
+		ax[i] = a[0];
+		ay[i] = a[1];
+		az[i] = a[2];
+		wanted[i] = massive_jerk(i, a);
+	}
+	return count;
+}
+
+uint64_t NBodySystem::accelerate_groups(int first, int last, InteractionList &list) {
+	const std::vector<int> &order = tree.sorted();
+	uint64_t count = 0;
+	for (int g = first; g < last; g++) {
+		const OctreeNode &node = tree.node(groups[g]);
+		int targets = node.count;
+		if (!active.empty()) {
+			targets = 0;
+			for (int k = node.begin; k < node.begin + node.count; k++) {
+				targets += active[massive + order[k]];
+			}
+			if (targets == 0) {
+				continue;
+			}
+		}
+		// the massive bodies pull on every particle directly
+		list.clear();
+		for (int j = 0; j < massive; j++) {
+			list.add(x[j], y[j], z[j], mass[j]);
+		}
+		tree.interactions(groups[g], theta, list);
+		for (int k = node.begin; k < node.begin + node.count; k++) {
+			int i = massive + order[k];
+			if (!active.empty() && !active[i]) {
+				continue;
+			}
+			double p[3] = { x[i], y[i], z[i] }, a[3] = { 0.0, 0.0, 0.0 };
+			list.accelerate(p, a, isa);
+			ax[i] = a[0];
+			ay[i] = a[1];
+			az[i] = a[2];
+			wanted[i] = massive_jerk(i, a);
+		}
+		count += (uint64_t) targets * list.size();
+	}
+	return count;
+}
+
+void NBodySystem::evaluate(ThreadPool *pool) {
+	int n = size();
+	tree.build(x.data() + massive, y.data() + massive, z.data() + massive, mass.data() + massive, n - massive, pool);
+	tree.groups(NBODY_GROUP_SIZE, groups);
+	builds++;
+	// neighbouring groups see much the same nodes, so a task takes a run of them
+	int grain = std::max(1, NBODY_TASK_PARTICLES / NBODY_GROUP_SIZE);
+	int count = (int) groups.size();
+	std::vector<uint64_t> counts((count + grain - 1) / grain + 1, 0);
+	parallel_for(pool, count, grain, [&](int first, int last) {
+		InteractionList list;
+		counts[first / grain] = accelerate_groups(first, last, list);
+	});
+	counts.back() = accelerate_massive();
+	for (uint64_t c : counts) {
+		interactions += c;
+	}
+	evaluations += active.empty() ? n : std::count(active.begin(), active.end(), 1);
+}
+
+void NBodySystem::accelerate(ThreadPool *pool) {
+	active.clear();
+	evaluate(pool);
+	accelerated = true;
+}
+
+void NBodySystem::step(double dt, ThreadPool *pool) {
+	if (!accelerated) {
+		accelerate(pool);
+	}
+	int n = size();
+	for (int i = 0; i < n; i++) {
+		kick(i, 0.5 * dt);
+		x[i] += dt * vx[i];
+		y[i] += dt * vy[i];
+		z[i] += dt * vz[i];
+	}
+	accelerate(pool);
+	for (int i = 0; i < n; i++) {
+		kick(i, 0.5 * dt);
+	}
+	time += dt;
+}
+
+// the coarsest level whose step is within what a body asks for
+static int block_level(double dt, double wanted) {
+	int l = 0;
+	while (l < NBODY_LEVELS - 1 && dt > wanted) {
+		dt *= 0.5;
+		l++;
+	}
+	return l;
+}
+
+void NBodySystem::block_step(double dt, ThreadPool *pool) {
+	if (!accelerated) {
+		accelerate(pool);
+	}
+	int n = size();
+	if ((int) level.size() != n) {
+		level.resize(n);
+		for (int i = 0; i < n; i++) {
+			level[i] = block_level(dt, wanted[i]);
+		}
+	}
+	const int substeps = 1 << (NBODY_LEVELS - 1);
+	double start = time, h = dt / substeps;
+	// the massive bodies pull on everything, so they step no coarser than
+	// the finest particle: the tree is built that often anyway and there are
+	// only a few of them. A particle that refines takes them along from the
+	// next step they start
+	int swarm = 0;
+	for (int i = massive; i < n; i++) {
+		swarm = std::max(swarm, level[i]);
+	}
+	for (int i = 0; i < massive; i++) {
+		level[i] = std::max(level[i], swarm);
+	}
+	// every body opens its first step
+	int finest = 0;
+	for (int i = 0; i < n; i++) {
+		kick(i, 0.5 * std::ldexp(dt, -level[i]));
+		finest = std::max(finest, level[i]);
+	}
+	active.assign(n, 0);
+	int drifted = 0;
+	// only where a step of the finest level ends may any step end
+	for (int s = substeps >> finest; s <= substeps; s += substeps >> finest) {
+		// the bodies whose step ends here, every one of them at the end
+		for (int i = 0; i < n; i++) {
+			active[i] = s % (substeps >> level[i]) == 0;
+		}
+		// everything drifts to now, the others still need to be pulled from
+		// where they are
+		double d = (s - drifted) * h;
+		for (int i = 0; i < n; i++) {
+			x[i] += d * vx[i];
+			y[i] += d * vy[i];
+			z[i] += d * vz[i];
+		}
+		drifted = s;
+		time = start + s * h;
+		evaluate(pool);
+		finest = 0;
+		// the particles first, so the massive bodies whose steps end here too
+		// follow one that refines at once
+		for (int k = 0; k < n; k++) {
+			int i = (k + massive) % n;
+			if (!active[i]) {
+				finest = std::max(finest, level[i]);
+				continue;
+			}
+			kick(i, 0.5 * std::ldexp(dt, -level[i]));
+			// a finer step may start anywhere, a coarser one only where a
+			// step of its level starts
+			int l = block_level(dt, wanted[i]);
+			if (i < massive) {
+				l = std::max(l, swarm);
+			} else {
+				swarm = std::max(swarm, l);
+			}
+			while (l < level[i] && s % (substeps >> l) != 0) {
+				l++;
+			}
+			level[i] = l;
+			finest = std::max(finest, l);
+			if (s < substeps) {
+				kick(i, 0.5 * std::ldexp(dt, -l));
+			}
+		}
+	}
+	active.clear();
+	time = start + dt;
+	accelerated = true;
+}
+
+double solar_mu() {
+	// Kepler's third law on the orbit of the earth
+	return TWO_PI * TWO_PI * EARTH_DISTANCE * EARTH_DISTANCE * EARTH_DISTANCE /
+		(EARTH_REVOLUTION_CYCLE * EARTH_REVOLUTION_CYCLE);
+}
+
+// the real ratios of the planets to the sun, the moon's included in the
+// earth; the scene squeezes the orbits together, at these masses jupiter
+// throws mars off and saturn nearly so within decades, a tenth of them
+// keeps every orbit
+static const double PLANET_MASS_SCALE = 0.1;
+
+// G times the mass of each body
+static void body_masses(double masses[BODY_COUNT]) {
+	static const double ratios[BODY_COUNT] = {
+		1.0, 1.66e-7, 2.45e-6, 3.04e-6, 0.0, 3.23e-7, 9.55e-4, 2.86e-4, 4.37e-5, 5.15e-5, 6.6e-9 };
+	double mu = solar_mu();
+	for (int b = 0; b < BODY_COUNT; b++) {
+		masses[b] = (b == BODY_SUN ? 1.0 : PLANET_MASS_SCALE) * ratios[b] * mu;
+	}
+}
+
+// the velocity of a body at time t, walking up its parents
+static void body_velocity(const BodyElements *elements, const double *masses, int body, double t, double velocity[3]) {
+	const BodyElements &e = elements[body];
+	if (e.parent < 0) {
+		velocity[0] = velocity[1] = velocity[2] = 0.0;
+		return;
+	}
+	body_velocity(elements, masses, e.parent, t, velocity);
+	double v[3];
+	orbit_velocity(e, t, masses[e.parent] + masses[body], v);
+	for (int k = 0; k < 3; k++) {
+		velocity[k] += v[k];
+	}
+}
+
+int solar_nbody_index(int body) {
+	return body < BODY_MOON ? body : body == BODY_MOON ? -1 : body - 1;
+}
+
+void solar_nbody(int particles, double t, uint32_t seed, NBodySystem &system) {
+	const BodyElements *elements = solar_system_elements();
+	double masses[BODY_COUNT];
+	body_masses(masses);
+	system.clear();
+	system.time = t;
+	for (int b = 0; b < BODY_COUNT; b++) {
+		if (solar_nbody_index(b) < 0) {
+			continue;
+		}
+		BodyState s = body_state(elements, b, t);
+		double v[3];
+		body_velocity(elements, masses, b, t, v);
+		system.add(s.position, v, masses[b]);
+	}
+	system.massive = system.size();
+
+	// the swarm weighs a hundred millionth of the sun, each particle a share
+	double mu = masses[BODY_SUN];
+	double m = particles > 0 ? 1e-8 * mu / particles : 0.0;
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	const BodyElements &sun = elements[BODY_SUN];
+	for (int i = 0; i < particles; i++) {
+		// asteroids between mars and jupiter, dust inside the orbit of
+		// mercury, debris beyond pluto
+		double kind = unit(random);
+		BodyElements e = sun;
+		e.parent = BODY_SUN;
+		e.revolutionCycle = 0.0;
+		e.rotationCycle = 0.0;
+		if (kind < 0.7) {
+			e.semiMajorAxis = 19.4 + 1.6 * unit(random);
+			e.eccentricity = 0.1 * unit(random);
+			e.inclination = 0.1 * unit(random);
+		} else if (kind < 0.9) {
+			e.semiMajorAxis = 6.0 + 1.0 * unit(random);
+			e.eccentricity = 0.01 * unit(random);
+			e.inclination = 0.01 * unit(random);
+		} else {
+			e.semiMajorAxis = 43.0 + 7.0 * unit(random);
+			e.eccentricity = 0.2 * unit(random);
+			e.inclination = 0.3 * unit(random);
+		}
+		e.node = TWO_PI * unit(random);
+		e.periapsis = TWO_PI * unit(random);
+		e.meanAnomaly = TWO_PI * unit(random) - 0.5 * TWO_PI;
+		double p[3], v[3];
+		orbit_position(e, t, p);
+		orbit_velocity(e, t, mu, v);
+		system.add(p, v, m);
+	}
+	system.to_barycenter();
+}
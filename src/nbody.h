@@ -0,0 +1,218 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "cpu_features.h"
+#include "thread_pool.h"
+#include <vector>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+// Gravity between many particles: a few massive bodies pull on everything
+// directly, the swarm of light particles pulls through a Barnes-Hut octree,
+// and a leapfrog integrator moves them all. Scene units, G = 1, so a mass is
+// G times the mass
+
+// Largest size over distance a node may have to count as one point mass
+#define NBODY_THETA 0.5
+// Most particles a leaf holds
+#define NBODY_LEAF_SIZE 8
+// Levels of the octree, as many as a 63 bit Morton key holds
+#define NBODY_TREE_LEVELS 21
+// Added to every squared distance, scene units squared
+#define NBODY_SOFTENING2 1e-6
+// Seconds of simulation a step of the scene covers, some two hundred steps
+// to the shortest orbit
+#define NBODY_STEP 0.02
+// Levels of the block steps, the finest step is the block over 2^(NBODY_LEVELS - 1)
+#define NBODY_LEVELS 10
+// How far the acceleration of a body may turn in one of its steps: the step
+// is sqrt(eta |a| / |da/dt|)
+#define NBODY_ETA 1e-3
+// Most particles that share one interaction list
+#define NBODY_GROUP_SIZE 64
+// Particles a force task works through
+#define NBODY_TASK_PARTICLES 1024
+
+struct OctreeNode {
+	double com[3]; // center of mass
+	double mass;
+	double center[3]; // of the cube
+	double half; // half its side
+	int32_t begin; // first particle below, in tree order
+	int32_t count; // particles below
+	int32_t first; // first child node
+	int32_t children; // child nodes, 0 for a leaf
+};
+
+// Point masses some particles feel, laid out for one tight loop over them
+struct InteractionList {
+	std::vector<double> x, y, z, m;
+
+	void clear() { x.clear(); y.clear(); z.clear(); m.clear(); }
+
+	void add(double px, double py, double pz, double pm) {
+		x.push_back(px);
+		y.push_back(py);
+		z.push_back(pz);
+		m.push_back(pm);
+	}
+
+	int size() const { return (int) m.size(); }
+
+	// Add their pull at p to a, with the CPU_ISA_* instruction set isa; a mass
+	// right at p pulls on nothing
+	void accelerate(const double p[3], double a[3], int isa = CPU_ISA_AUTO) const;
+};
+
+// An octree over a set of particles, sorted along a Morton curve so that
+// every node holds a contiguous range of them
+class Octree {
+public:
+	// Sort the particles and build the tree over them; the sort, the copies
+	// and the subtrees are split between the workers of pool, if any
+	void build(const double *x, const double *y, const double *z, const double *m, int count, ThreadPool *pool);
+
+	// Add the pull of the particles at p to a, skipping the one at position
+	// self of the tree order (-1 for none); returns the interactions summed
+	uint64_t accelerate(const double p[3], int self, double theta, double a[3]) const;
+
+	// Nodes of at most size particles whose parents hold more, in tree
+	// order, so their particles cover every particle once
+	void groups(int size, std::vector<int> &found) const;
+
+	// What the particles of a node feel: every node far enough from all of
+	// them as one mass, the particles of the other leaves one by one,
+	// their own included
+	void interactions(int node, double theta, InteractionList &list) const;
+
+	const OctreeNode &node(int index) const { return nodes[index]; }
+
+	// Position and mass of the particle at a position of the tree order
+	void particle(int i, double p[3], double &m) const { p[0] = px[i]; p[1] = py[i]; p[2] = pz[i]; m = pm[i]; }
+
+	// Particles held
+	int size() const { return (int) order.size(); }
+
+	// Index of the particle at each position of the tree order
+	const std::vector<int> &sorted() const { return order; }
+
+private:
+	std::vector<OctreeNode> nodes;
+	std::vector<uint64_t> keys; // in tree order
+	std::vector<int> order;
+	std::vector<double> px, py, pz, pm; // in tree order
+
+	// A subtree built by a worker into its own nodes, stitched in afterwards
+	struct Subtree {
+		int node;
+		int first;
+		int last;
+		int level;
+		std::vector<OctreeNode> nodes;
+	};
+
+	// Add the children of a node over [first, last), bounds gets the range of each
+	int split(std::vector<OctreeNode> &tree, int index, int first, int last, int level, int *bounds) const;
+	// Build the node and everything below it
+	void build_node(std::vector<OctreeNode> &tree, int index, int first, int last, int level) const;
+	// Split the top of the tree until the ranges are small enough to hand out
+	void build_top(int index, int first, int last, int level, int grain, std::vector<Subtree> &subtrees, std::vector<int> &top);
+	// Mass and center of mass of a node from its children or particles
+	void finish_node(std::vector<OctreeNode> &tree, int index) const;
+};
+
+// Particles moved by their mutual gravity, the massive bodies first
+class NBodySystem {
+public:
+	std::vector<double> x, y, z;
+	std::vector<double> vx, vy, vz;
+	std::vector<double> ax, ay, az;
+	std::vector<double> mass;
+	// the first bodies, pulling on everything directly
+	int massive;
+	double time;
+	double theta;
+	// pairs and nodes summed so far
+	uint64_t interactions;
+	// forces evaluated so far, one a body each time it is pulled
+	uint64_t evaluations;
+	// octrees built so far, one each evaluation however few bodies it pulls
+	uint64_t builds;
+	// CPU_ISA_* instruction set the forces are summed with
+	int isa;
+	// block level of each body, see block_step()
+	std::vector<int> level;
+	double eta;
+
+	NBodySystem()
+		: massive(0), time(0.0), theta(NBODY_THETA), interactions(0), evaluations(0), builds(0), isa(CPU_ISA_AUTO),
+		eta(NBODY_ETA), accelerated(false) { }
+
+	int size() const { return (int) x.size(); }
+
+	void clear();
+
+	// Append a particle, the massive ones before any light one
+	void add(const double position[3], const double velocity[3], double m);
+
+	// Move the whole system so that its center of mass rests at the origin
+	void to_barycenter();
+
+	// Accelerations of every particle at the current positions
+	void accelerate(ThreadPool *pool);
+
+	// One kick-drift-kick leapfrog step of dt; the accelerations of the end
+	// of a step start the next one
+	void step(double dt, ThreadPool *pool);
+
+	// A block of dt in which each body takes steps of dt / 2^level, its
+	// level from its acceleration and jerk: bodies pulled hard and turning
+	// fast step finely, the others coarsely, and a force evaluation pulls
+	// only the bodies whose steps end then, though it builds the whole tree.
+	// The massive bodies step no coarser than the finest particle. Every
+	// body ends the block in step
+	void block_step(double dt, ThreadPool *pool);
+
+private:
+	Octree tree;
+	// whether ax, ay and az belong to the positions
+	bool accelerated;
+	// nodes of the tree whose particles share an interaction list
+	std::vector<int> groups;
+	// step each body asked for at its last evaluation
+	std::vector<double> wanted;
+	// bodies the next evaluation pulls, empty for all of them
+	std::vector<char> active;
+
+	// Pull the active bodies from where every body is
+	void evaluate(ThreadPool *pool);
+	// Accelerations of the massive bodies
+	uint64_t accelerate_massive();
+	// Accelerations of the particles of the groups [first, last)
+	uint64_t accelerate_groups(int first, int last, InteractionList &list);
+	// Step a body with acceleration a asks for, the jerk summed over the
+	// massive bodies only: the swarm adds next to nothing to it
+	double massive_jerk(int i, const double a[3]) const;
+
+	void kick(int i, double dt) {
+		vx[i] += dt * ax[i];
+		vy[i] += dt * ay[i];
+		vz[i] += dt * az[i];
+	}
+};
+
+// The bodies of the scene at time t as massive particles, moving as their
+// ellipses have them move, and that many light ones around the sun: seven
+// tenths in the asteroid belt, two in a dust ring inside the orbit of mercury
+// and one in a debris disk beyond pluto. The moon is left out: to keep its
+// cycle at the distance the scene puts it, the earth would need three
+// thousandths of the sun's mass, a thousand times its share, and the moon
+// would still sit at 0.63 of the earth's hill radius, past the half where
+// orbits stay bound; tried, it leaves within two years and throws mars
+void solar_nbody(int particles, double t, uint32_t seed, NBodySystem &system);
+
+// Particle of a BODY_* in solar_nbody(), -1 for the moon
+int solar_nbody_index(int body);
+
+// G times the mass of the sun, such that the earth keeps its cycle
+double solar_mu();
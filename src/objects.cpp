@@ -1,486 +1,515 @@
 #include "index.h"
 
-Mesh planetTemplate;
-bool planetTemplateFlag = false;
-
-Mesh Universe;
 Mesh Sun;
 
+TextureLoader Textures;
+AssetPack Assets;
+
+GLuint TextureArray = 0;
+GLuint PlaceholderArray = 0;
+GLuint Skybox = 0;
+VertexArrayObject SkyboxVAO;
+VertexArrayObject ImpostorVAO;
+GLuint ShadowCube = 0;
+GLuint ShadowCubeFBO = 0;
+ShadowCache ShadowCubeCache;
+
 vector<Mesh> Planets;
+vector<std::shared_ptr<Geometry> > SphereLods;
+EphemerisTable Ephemeris;
+// the tables are mapped from their cache, or held here right after a fit
+static MappedFile EphemerisFile;
+static vector<unsigned char> EphemerisBytes;
+NBodySystem Gravity;
+// the forces are summed on workers of their own, so waiting for them
+// never waits for a texture as well
+static std::unique_ptr<ThreadPool> GravityPool;
+static VertexBufferObject ParticleVBO;
+static VertexArrayObject ParticleVAO;
+static vector<float> ParticlePositions;
+
+// every geometry in use, by name
+static std::map<string, std::weak_ptr<Geometry> > GeometryRegistry;
+
+void upload_geometry(Geometry *g, const MeshView &view) {
+    g->V_vbo.init(GL_FLOAT, GL_ARRAY_BUFFER);
+    g->N_vbo.init(GL_FLOAT, GL_ARRAY_BUFFER);
+    g->T_vbo.init(GL_FLOAT, GL_ARRAY_BUFFER);
+    g->F_vbo.init(GL_UNSIGNED_INT, GL_ELEMENT_ARRAY_BUFFER);
+    g->V_vbo.update(view.positions, 3, view.vertexCount);
+    g->N_vbo.update(view.normals, 3, view.vertexCount);
+    g->T_vbo.update(view.texcoords, 2, view.vertexCount);
+    g->F_vbo.update(view.indices, 3, view.indexCount / 3);
+}
 
-Mesh generate_planet() {
-    // check if template is initialized
-    if (!planetTemplateFlag) {
-        // init
-        planetTemplate.V_vbo.init(GL_FLOAT, GL_ARRAY_BUFFER);
-        planetTemplate.N_vbo.init(GL_FLOAT, GL_ARRAY_BUFFER);
-        // load off
-        Eigen::MatrixXf vertices;
-        Eigen::MatrixXi faces;
-        load_sphere_off(DATA_DIR "sphere.off", vertices, faces);
-        // calculate normals
-        Eigen::MatrixXf normals = Eigen::MatrixXf::Zero(3, vertices.cols());
-        Eigen::Vector3f v1, v2, v3;
-        Eigen::Vector3f n;
-        for (int i = 0; i < faces.cols(); i++) {
-            // get three vertices
-            v1 = vertices.col(faces.col(i)[0]);
-            v2 = vertices.col(faces.col(i)[1]);
-            v3 = vertices.col(faces.col(i)[2]);
-            // calculate the surface normal
-            n = (v2 - v1).cross(v3 - v1).normalized();
-            // add to normals
-            normals.col(faces.col(i)[0])[0] += n[0];
-            normals.col(faces.col(i)[0])[1] += n[1];
-            normals.col(faces.col(i)[0])[2] += n[2];
-            normals.col(faces.col(i)[1])[0] += n[0];
-            normals.col(faces.col(i)[1])[1] += n[1];
-            normals.col(faces.col(i)[1])[2] += n[2];
-            normals.col(faces.col(i)[2])[0] += n[0];
-            normals.col(faces.col(i)[2])[1] += n[1];
-            normals.col(faces.col(i)[2])[2] += n[2];
-        }
-        // load vertices into V
-        planetTemplate.V.resize(3, 3 * faces.cols());
-        planetTemplate.N.resize(3, 3 * faces.cols());
-        for (int i = 0; i < faces.cols(); i++) {
-            int v1 = faces.col(i)[0];
-            int v2 = faces.col(i)[1];
-            int v3 = faces.col(i)[2];
-            planetTemplate.V.col(3 * i) << vertices.col(v1)[0], vertices.col(v1)[1], vertices.col(v1)[2];
-            planetTemplate.V.col(3 * i + 1) << vertices.col(v2)[0], vertices.col(v2)[1], vertices.col(v2)[2];
-            planetTemplate.V.col(3 * i + 2) << vertices.col(v3)[0], vertices.col(v3)[1], vertices.col(v3)[2];
-            // normals
-            planetTemplate.N.col(3 * i) = normals.col(v1).normalized();
-            planetTemplate.N.col(3 * i + 1) = normals.col(v2).normalized();
-            planetTemplate.N.col(3 * i + 2) = normals.col(v3).normalized();
-        }
-        planetTemplate.V_vbo.update(planetTemplate.V);
-        planetTemplate.N_vbo.update(planetTemplate.N);
-        // find radius and center
-        double radius = find_radius_center(planetTemplate, planetTemplate.center);
-        // scale the sphere to unit sphere and then move to origin
-        Eigen::Matrix4f m1; // from center to origin
-        m1 << 1.0f, 0.0f, 0.0f, -planetTemplate.center[0],
-            0.0f, 1.0f, 0.0f, -planetTemplate.center[1],
-            0.0f, 0.0f, 1.0f, -planetTemplate.center[2],
-            0.0f, 0.0f, 0.0f, 1.0f;
-        Eigen::Matrix4f m2; // scale to unit
-        double scale = 0.5 / radius;
-        m2 << scale, 0.0f, 0.0f, 0.0f,
-            0.0f, scale, 0.0f, 0.0f,
-            0.0f, 0.0f, scale, 0.0f,
-            0.0f, 0.0f, 0.0f, 1.0f;
-        planetTemplate.model = m2 * m1;
-        // set the center to origin
-        planetTemplate.center << 0.0f, 0.0f, 0.0f;
-        planetTemplateFlag = true;
-    }
-    return planetTemplate;
-}
-
-void generate_texcoord(Mesh * m, const Image &image) {
-    // init vbo
-    m->T_vbo.init(GL_FLOAT, GL_ARRAY_BUFFER);
-    // the image size
-    long width = image.rows();
-    long height = image.cols();
-    // useful elements
-    float radius = 0.5;
-    Eigen::Vector3f bottom(0.0f, -radius, 0.0f);
-    Eigen::Vector3f left(-radius, 0.0f, 0.0f);
-    Eigen::Vector3f center(0.0f, 0.0f, 0.0f);
-    // loop through each vertex
-    m->T.resize(2, m->V.cols());
-    double u, v;
-    int size = m->V.cols();
-    for (int i = 0; i < size; i++) {
-        // apply the transformation to it
-        Eigen::Vector4f origin(m->V.col(i)[0], m->V.col(i)[1], m->V.col(i)[2], 1.0f);
-        origin = m->model * origin;
-        Eigen::Vector3f current(origin[0], origin[1], origin[2]);
-        Eigen::Vector3f vec = current - center;
-        double radianBot = acos(bottom.dot(vec) / (bottom.norm() * vec.norm()));
-        v = radianBot / M_PI;
-        Eigen::Vector3f vec2(current[0], 0.0f, current[2]);
-        double radianLeft = acos(left.dot(vec2) / (left.norm() * vec2.norm()));
-        if (origin[2] > 0) {
-            radianLeft = 2 * M_PI - radianLeft;
-        }
-        u = radianLeft/(2*M_PI);
-        m->T.col(i) << u, v;
-    }
-    // check for the seam issue
-    for (int i = 0; i < (size/3); i++) {
-        double u1 = m->T.col(3*i)[0];
-        double u2 = m->T.col(3*i+1)[0];
-        double u3 = m->T.col(3*i+2)[0];
-        // check if there are vertices between 0.0 - 0.5
-        bool rightSide = false;
-        if (
-            (u1 >= 0 && u1 < 0.5) ||
-            (u2 >= 0 && u2 < 0.5) ||
-            (u3 >= 0 && u3 < 0.5)
-        ) {
-            rightSide = true;
+void load_sphere_lod(Geometry *g, int lod) {
+    string name = sphere_lod_name(lod);
+    uint64_t hash = sphere_lod_hash(lod);
+    MeshView view;
+    const AssetPackEntry *entry = Assets.find(name);
+    if (entry != NULL && entry->format == ASSET_MESH &&
+        read_mesh_cache(Assets.data(*entry), entry->size, hash, view)) {
+        upload_geometry(g, view);
+        return;
+    }
+    // the levels are procedural, the cache is keyed on the generator
+    MappedFile cache;
+    MeshData sphere;
+    string fname = CACHE_DIR + name + ".mesh";
+    if (!cache.open(fname) || !read_mesh_cache(cache.data, cache.size, hash, view)) {
+        build_icosphere(sphere_lod_subdivisions(lod), &sphere);
+        if (!write_mesh_cache(fname, hash, sphere.V, sphere.N, sphere.T, sphere.F)) {
+            cerr << "Failed to write the mesh cache " << fname << endl;
         }
-        // check if there are vertices between 0.5 - 1
-        bool leftSide = false;
-        if (
-            (u1 > 0.5 && u1 <= 1) ||
-            (u2 > 0.5 && u2 <= 1) ||
-            (u3 > 0.5 && u3 <= 1)
-        ) {
-            leftSide = true;
+        view = mesh_view(sphere.V, sphere.N, sphere.T, sphere.F);
+    }
+    // upload straight from the mapping, nothing stays on the CPU
+    upload_geometry(g, view);
+}
+
+void load_sphere_geometry(Geometry *g) {
+    MeshView view;
+    const AssetPackEntry *entry = Assets.find(SPHERE_OFF_NAME);
+    if (entry != NULL && entry->format == ASSET_MESH &&
+        read_mesh_cache(Assets.data(*entry), entry->size, entry->sourceHash, view)) {
+        upload_geometry(g, view);
+        return;
+    }
+    // the cache is keyed on the content of the .off file
+    MappedFile source;
+    if (!source.open(DATA_DIR SPHERE_OFF_NAME)) {
+        cerr << "Failed to open " SPHERE_OFF_NAME "!" << endl;
+        exit(-1);
+    }
+    uint64_t hash = hash_bytes(source.data, source.size);
+    source.close();
+    MappedFile cache;
+    MeshData sphere;
+    if (!cache.open(CACHE_DIR "sphere.mesh") || !read_mesh_cache(cache.data, cache.size, hash, view)) {
+        // missing or stale, rebuild it from the .off file
+        if (!build_sphere_mesh(DATA_DIR SPHERE_OFF_NAME, &sphere)) {
+            cerr << "Failed to read " SPHERE_OFF_NAME "!" << endl;
+            exit(-1);
         }
-        // see if this triangle is on the seam
-        if (rightSide && leftSide) {
-            if (u1 >= 0 && u1 < 0.5) {
-                double extra = u1;
-                m->T.col(3*i)[0] = u1 + 1.0f;
-            }
-            if (u2 >= 0 && u2 < 0.5) {
-                double extra = u2;
-                m->T.col(3*i+1)[0] = u2 + 1.0f;
-            }
-            if (u3 >= 0 && u3 < 0.5) {
-                double extra = u3;
-                m->T.col(3*i+2)[0] = u3 + 1.0f;
-            }
+        if (!write_mesh_cache(CACHE_DIR "sphere.mesh", hash, sphere.V, sphere.N, sphere.T, sphere.F)) {
+            cerr << "Failed to write the sphere mesh cache." << endl;
         }
+        view = mesh_view(sphere.V, sphere.N, sphere.T, sphere.F);
     }
+    upload_geometry(g, view);
+}
 
-    m->T_vbo.update(m->T);
+std::shared_ptr<Geometry> acquire_geometry(
+    const string &name,
+    const std::function<void(Geometry *)> &load
+) {
+    std::shared_ptr<Geometry> g = GeometryRegistry[name].lock();
+    if (!g) {
+        g = std::make_shared<Geometry>();
+        load(g.get());
+        GeometryRegistry[name] = g;
+    }
+    return g;
 }
 
-Mesh generate_textured_planet(const string &fname) {
-    // generate a mesh
-    Mesh p = generate_planet();
+void load_sphere_lods() {
+    if (!SphereLods.empty()) {
+        return;
+    }
+    for (int lod = 0; lod < SPHERE_LODS; lod++) {
+        SphereLods.push_back(acquire_geometry(sphere_lod_name(lod), [lod](Geometry *g) { load_sphere_lod(g, lod); }));
+    }
+}
 
-    // load earth texture image
-    Image image;
-    if (!load_image(fname, image)) {
-        cerr << "Failed to load earth texture image!" << endl;
-        exit(-1);
+// tangent of the angle a sphere covers seen from a point, unbounded from inside
+static float angular_radius(const Eigen::Vector3f &center, float radius, const Eigen::Vector3f &eye) {
+    float d2 = (center - eye).squaredNorm() - radius * radius;
+    return d2 > 0.0f ? radius / sqrt(d2) : FLT_MAX;
+}
+
+static void select_lod(Mesh *p, const Eigen::Vector3f &eye, float pixels, bool caster) {
+    if (p->sphere != SPHERE_SOURCE_CHAIN) {
+        return; // one mesh at every size
+    }
+    int lod = pick_sphere_lod(angular_radius(p->center, p->radius, eye) * pixels, p->lod, LodPixelError, LOD_HYSTERESIS);
+    if (lod != p->lod) {
+        Stats.lodSwitches++;
+        p->lod = lod;
+        p->geometry = SphereLods[lod];
+    }
+    if (caster) {
+        // each face of the shadow cube covers 90 degrees
+        float texels = angular_radius(p->center, p->radius, Sun.center) * SHADOW_SIZE / 2;
+        p->shadowLod = min(pick_sphere_lod(texels, p->shadowLod, LOD_SHADOW_TEXEL_ERROR, LOD_HYSTERESIS), lod);
+    }
+}
+
+void select_lods(const Eigen::Matrix4f &view, const Eigen::Matrix4f &proj, int height) {
+    // the camera in world space, and pixels per unit of tangent on screen
+    Eigen::Vector3f eye = view.inverse().block<3, 1>(0, 3);
+    float pixels = proj(1, 1) * height / 2;
+    select_lod(&Sun, eye, pixels, false);
+    for (Mesh &p : Planets) {
+        select_lod(&p, eye, pixels, true);
+    }
+}
+
+Mesh generate_planet(int sphere) {
+    Mesh p;
+    // the planets drawn from the same source share one sphere of radius 0.5
+    // at the origin, the chain starts at its coarsest level
+    p.sphere = SphereOff ? SPHERE_SOURCE_OFF : sphere;
+    if (p.sphere == SPHERE_SOURCE_OFF) {
+        p.geometry = acquire_geometry(SPHERE_OFF_NAME, load_sphere_geometry);
+    } else {
+        load_sphere_lods();
+        p.geometry = SphereLods[0];
     }
+    p.model = Eigen::Matrix4f::Identity();
+    p.center << 0.0f, 0.0f, 0.0f;
+    return p;
+}
+
+Mesh generate_textured_planet(const string &name, int sphere) {
+    // generate a mesh
+    Mesh p = generate_planet(sphere);
+
+    // decode the texture on a worker, streamed in by Textures.poll()
+    p.layer = Textures.request(DATA_DIR, name);
+
+    return p;
+}
 
-    // calculate texture coordinates
-    generate_texcoord(&p, image);
-
-    // generate texture
-    glGenTextures(1, &p.texture);
-    glBindTexture(GL_TEXTURE_2D, p.texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.rows(), image.cols(), 0, GL_RGBA, GL_UNSIGNED_BYTE, image.data());
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    // initialize depth map
-    p.depthMapFBO = Planets.size();
-    p.depthMap = Planets.size();
-    glGenFramebuffers(1, &p.depthMapFBO);
-    glGenTextures(1, &p.depthMap);
-    glGenTextures(1, &p.depthMap);
-    glBindTexture(GL_TEXTURE_2D, p.depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-
-    // bind FBO with depthMap
-    glBindFramebuffer(GL_FRAMEBUFFER, p.depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, p.depthMap, 0);
+void init_shadow_cube() {
+    // every face stores the distance to the sun, written by the shadow program
+    glGenTextures(1, &ShadowCube);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, ShadowCube);
+    for (int face = 0; face < 6; face++) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT32F, SHADOW_SIZE, SHADOW_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    // filter across the faces
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    // the geometry shader picks the face with gl_Layer
+    glGenFramebuffers(1, &ShadowCubeFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, ShadowCubeFBO);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, ShadowCube, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    return p;
+bool shadow_cube_outdated(const vector<int> &ids) {
+    ShadowCache &cache = ShadowCubeCache;
+    vector<Eigen::Vector4f> casters;
+    for (int i : ids) {
+        Eigen::Vector3f c = Planets[i].center - Sun.center;
+        casters.push_back(Eigen::Vector4f(c[0], c[1], c[2], Planets[i].radius));
+    }
+    // a planet may have entered or left the range of the cube
+    bool outdated = !cache.valid || ids != cache.ids;
+    for (int i = 0; !outdated && i < casters.size(); i++) {
+        // a texel of a 90 degrees face spans 2 * distance / SHADOW_SIZE
+        float distance = max(casters[i].head<3>().norm(), SHADOW_NEAR_PLANE);
+        float texel = 2.0f * distance / SHADOW_SIZE;
+        float moved = (casters[i] - cache.casters[i]).head<3>().norm();
+        float grown = fabs(casters[i][3] - cache.casters[i][3]);
+        outdated = moved + grown > ShadowTexelThreshold * texel;
+    }
+    if (outdated) {
+        cache.ids = ids;
+        cache.casters.swap(casters);
+        cache.valid = true;
+        Stats.shadowRenders++;
+    } else {
+        Stats.shadowReuses++;
+    }
+    return outdated;
+}
+
+static void finalized_geometry(Program *program, Program *shadowMapProgram, Geometry *g) {
+    if (g->vao.id != 0) {
+        return; // already set up by another planet
+    }
+    g->vao.init();
+    g->vao.bind();
+    program->bindVertexAttribArray("position", g->V_vbo);
+    program->bindVertexAttribArray("texcoord", g->T_vbo);
+    program->bindVertexAttribArray("normal", g->N_vbo);
+    shadowMapProgram->bindVertexAttribArray("position", g->V_vbo);
+    // the element buffer binding is part of the vao state
+    g->F_vbo.bind();
+    g->vao.unbind();
+}
+
+void finalized_planet(Program *program, Program *shadowMapProgram) {
+    // the body may switch to any level, or use the bundled sphere
+    for (auto &entry : GeometryRegistry) {
+        if (std::shared_ptr<Geometry> g = entry.second.lock()) {
+            finalized_geometry(program, shadowMapProgram, g.get());
+        }
+    }
+}
+
+void draw_instances(const Geometry &g, const DrawRange &range) {
+    if (range.count == 0) {
+        return;
+    }
+    GLsizei indices = g.F_vbo.rows * g.F_vbo.cols;
+    Stats.drawCalls++;
+    Stats.instances += range.count;
+    Stats.triangles += (double) range.count * indices / 3;
+    // the vertex shader reads its instance id from the draw list at drawOffset
+    glDrawElementsInstanced(GL_TRIANGLES, indices, GL_UNSIGNED_INT, 0, range.count);
+}
+
+void draw_buckets(Program *program, GLint drawOffset, const vector<DrawRange> &ranges) {
+    for (const DrawRange &range : ranges) {
+        range.geometry->vao.bind();
+        program->set(drawOffset, range.first);
+        draw_instances(*range.geometry, range);
+    }
+}
+
+void draw_impostors(Program *program, GLint drawOffset, const vector<DrawRange> &ranges) {
+    if (ranges.empty()) {
+        return;
+    }
+    // the buckets follow each other in the draw list
+    GLsizei count = 0;
+    for (const DrawRange &range : ranges) {
+        count += range.count;
+    }
+    Stats.drawCalls++;
+    Stats.instances += count;
+    Stats.triangles += 2.0 * count;
+    ImpostorVAO.bind();
+    program->set(drawOffset, ranges.front().first);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+}
+
+void free_planet(Mesh *p) {
+    // the geometry goes away with its last reference
+    p->geometry.reset();
 }
 
-void finalized_planet(Program *program, Program *shadowMapProgram, Mesh *p) {
-    p->vao.init();
-    p->vao.bind();
-    program->bindVertexAttribArray("position", p->V_vbo);
-    program->bindVertexAttribArray("texcoord", p->T_vbo);
-    program->bindVertexAttribArray("normal", p->N_vbo);
-    shadowMapProgram->bindVertexAttribArray("position", p->V_vbo);
-    p->vao.unbind();
+void free_solar_system() {
+    // the upload thread goes first, its context is about to be destroyed
+    Textures.stop();
+    Ephemeris.clear();
+    EphemerisFile.close();
+    EphemerisBytes.clear();
+    GravityPool.reset();
+    Gravity.clear();
+    ParticleVBO.free();
+    ParticleVAO.free();
+    ParticleVBO.id = ParticleVAO.id = 0;
+    Assets.close();
+    SphereLods.clear();
+    glDeleteTextures(1, &TextureArray);
+    glDeleteTextures(1, &PlaceholderArray);
+    glDeleteTextures(1, &ShadowCube);
+    glDeleteFramebuffers(1, &ShadowCubeFBO);
+    glDeleteTextures(1, &Skybox);
+    SkyboxVAO.free();
+    ImpostorVAO.free();
+    TextureArray = PlaceholderArray = ShadowCube = ShadowCubeFBO = Skybox = 0;
 }
 
 /////////////////////////////////////////////////////////////////////
 // add planets
 /////////////////////////////////////////////////////////////////////
 
-void create_solar_system(Program *program, Program *shadowMapProgram) {
+void create_solar_system(Program *program, Program *shadowMapProgram, GLFWwindow *loaderContext) {
+    auto t_start = std::chrono::high_resolution_clock::now();
+    // every texture is a layer of the same array
+    glGenTextures(1, &TextureArray);
+    glGenTextures(1, &PlaceholderArray);
+    int levels = Mipmaps ? mip_levels(TEXTURE_LAYER_WIDTH, TEXTURE_LAYER_HEIGHT) : 1;
+    if (TextureFormat != TEXTURE_FORMAT_RGBA8 && !has_gl_extension("GL_EXT_texture_compression_s3tc")) {
+        cerr << "S3TC texture compression is not supported, the textures stay uncompressed" << endl;
+        TextureFormat = TEXTURE_FORMAT_RGBA8;
+    }
+    // one mapping holds every asset, whatever it lacks goes through the caches
+    if (!AssetPackPath.empty()) {
+        if (Assets.open(AssetPackPath)) {
+            cout << "Mapped " << Assets.size() << " assets from " << AssetPackPath << endl;
+        } else {
+            cout << "No asset pack at " << AssetPackPath << ", loading through the caches" << endl;
+        }
+    }
+    Textures.init(TextureArray, PlaceholderArray, TEXTURE_LAYER_WIDTH, TEXTURE_LAYER_HEIGHT, levels, TextureFormat, CACHE_DIR, &Assets);
+    // the textures are decoded in the background while the meshes are set up
     create_sun(program, shadowMapProgram);
-    cout << "Sun loaded." << endl;
     create_mercury(program, shadowMapProgram);
-    cout << "Mercury loaded." << endl;
     create_venus(program, shadowMapProgram);
-    cout << "Venus loaded." << endl;
     create_earth(program, shadowMapProgram);
-    cout << "Earth loaded." << endl;
     create_moon(program, shadowMapProgram);
-    cout << "Moon loaded." << endl;
     create_mars(program, shadowMapProgram);
-    cout << "Mars loaded." << endl;
     create_jupiter(program, shadowMapProgram);
-    cout << "Jupiter loaded." << endl;
     create_saturn(program, shadowMapProgram);
-    cout << "Saturn loaded." << endl;
     create_uranus(program, shadowMapProgram);
-    cout << "Uranus loaded." << endl;
     create_neptune(program, shadowMapProgram);
-    cout << "Neptune loaded." << endl;
     create_pluto(program, shadowMapProgram);
-    cout << "Pluto loaded." << endl;
-    create_universe(program, shadowMapProgram);
-    cout << "Universe loaded." << endl;
+    load_ephemeris();
+    if (NBodyParticles >= 0) {
+        ParticleVBO.init(GL_FLOAT, GL_ARRAY_BUFFER);
+    }
+    place_bodies(SimulationTime);
+    create_skybox();
+    ImpostorVAO.init();
+    init_shadow_cube();
+    // stream each texture in as soon as its decode is done, the frames
+    // show the placeholders meanwhile
+    Textures.start(loaderContext);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, TextureArray);
+    Anisotropy = set_anisotropy(GL_TEXTURE_2D_ARRAY, Anisotropy);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    auto t_end = std::chrono::high_resolution_clock::now();
+    cout << "Solar system set up in "
+        << std::chrono::duration<double, std::milli>(t_end - t_start).count() << " ms." << endl;
 }
 
-void create_universe(Program *program, Program *shadowMapProgram) {
-    Universe = generate_textured_planet(DATA_DIR "textures/stars_milky_way.png");
-    // scale
-    double scale = UNIVERSE_RADIUS / 0.5;
-    Eigen::Matrix4f m;
-    m << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    Universe.model = m * Universe.model;
-    finalized_planet(program, shadowMapProgram, &Universe);
+void create_skybox() {
+    int size;
+    const unsigned char *faces;
+    const AssetPackEntry *entry = Assets.find("textures/stars_milky_way.png");
+    if (entry != NULL && entry->format == ASSET_CUBE &&
+        read_skybox_cache(Assets.data(*entry), entry->size, entry->sourceHash, size, faces)) {
+        upload_skybox(size, faces);
+        return;
+    }
+    // the cache is keyed on the content of the image file
+    MappedFile source;
+    if (!source.open(DATA_DIR "textures/stars_milky_way.png")) {
+        cerr << "Failed to open stars_milky_way.png!" << endl;
+        exit(-1);
+    }
+    uint64_t hash = hash_bytes(source.data, source.size);
+    source.close();
+    MappedFile cache;
+    vector<unsigned char> converted;
+    if (!cache.open(CACHE_DIR "skybox.cube") || !read_skybox_cache(cache.data, cache.size, hash, size, faces)) {
+        // missing or stale, convert the image once, a face per worker
+        Image image;
+        if (!load_image(DATA_DIR "textures/stars_milky_way.png", image)) {
+            cerr << "Failed to load texture image stars_milky_way.png!" << endl;
+            exit(-1);
+        }
+        ThreadPool pool;
+        equirect_to_cube(image, SKYBOX_SIZE, converted, pool);
+        if (!write_skybox_cache(CACHE_DIR "skybox.cube", hash, SKYBOX_SIZE, converted)) {
+            cerr << "Failed to write the skybox cache." << endl;
+        }
+        size = SKYBOX_SIZE;
+        faces = converted.data();
+    }
+    upload_skybox(size, faces);
+}
+
+void upload_skybox(int size, const unsigned char *faces) {
+    glGenTextures(1, &Skybox);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, Skybox);
+    for (int face = 0; face < 6; face++) {
+        const unsigned char *texels = faces + (size_t) face * size * size * 4;
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    // the triangle has no attributes, core profiles still want a vao
+    SkyboxVAO.init();
 }
 
+void draw_skybox() {
+    Stats.drawCalls++;
+    SkyboxVAO.bind();
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+// a body is only its geometry, texture and size until place_bodies() moves it
 void create_earth(Program *program, Program *shadowMapProgram) {
-    // generate mesh
-    Mesh p = generate_textured_planet(DATA_DIR "textures/earth_texture.png");
-    // scale to size
-    double scale = EARTH_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    p.center << EARTH_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, EARTH_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    p.model = m * s * p.model;
-    finalized_planet(program, shadowMapProgram, &p);
+    Mesh p = generate_textured_planet("textures/earth_texture.png", EARTH_SPHERE);
+    p.radius = EARTH_RADIUS;
+    finalized_planet(program, shadowMapProgram);
     Planets.push_back(p);
 }
 
 void create_moon(Program *program, Program *shadowMapProgram) {
-    Mesh p = generate_textured_planet(DATA_DIR "textures/moon_texture.png");
-    // scale to size
-    double scale = MOON_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    p.center << EARTH_DISTANCE + MOON_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, EARTH_DISTANCE + MOON_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    p.model = m * s * p.model;
-    finalized_planet(program, shadowMapProgram, &p);
+    Mesh p = generate_textured_planet("textures/moon_texture.png", MOON_SPHERE);
+    p.radius = MOON_RADIUS;
+    finalized_planet(program, shadowMapProgram);
     Planets.push_back(p);
 }
 
 void create_sun(Program *program, Program *shadowMapProgram) {
-    Sun = generate_textured_planet(DATA_DIR "textures/sun_texture.png");
-    // scale to size
-    double scale = SUN_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    Sun.center << SUN_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, SUN_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    Sun.model = m * s * Sun.model;
-    finalized_planet(program, shadowMapProgram, &Sun);
+    Sun = generate_textured_planet("textures/sun_texture.png", SUN_SPHERE);
+    Sun.radius = SUN_RADIUS;
+    finalized_planet(program, shadowMapProgram);
 }
 
 void create_jupiter(Program *program, Program *shadowMapProgram) {
-    Mesh p = generate_textured_planet(DATA_DIR "textures/jupiter_texture.png");
-    // scale to size
-    double scale = JUPITER_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    p.center << JUPITER_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, JUPITER_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    p.model = m * s * p.model;
-    finalized_planet(program, shadowMapProgram, &p);
+    Mesh p = generate_textured_planet("textures/jupiter_texture.png", JUPITER_SPHERE);
+    p.radius = JUPITER_RADIUS;
+    finalized_planet(program, shadowMapProgram);
     Planets.push_back(p);
 }
 
 void create_mars(Program *program, Program *shadowMapProgram) {
-    Mesh p = generate_textured_planet(DATA_DIR "textures/mars_texture.png");
-    // scale to size
-    double scale = MARS_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    p.center << MARS_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, MARS_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    p.model = m * s * p.model;
-    finalized_planet(program, shadowMapProgram, &p);
+    Mesh p = generate_textured_planet("textures/mars_texture.png", MARS_SPHERE);
+    p.radius = MARS_RADIUS;
+    finalized_planet(program, shadowMapProgram);
     Planets.push_back(p);
 }
 
 void create_mercury(Program *program, Program *shadowMapProgram) {
-    Mesh p = generate_textured_planet(DATA_DIR "textures/mercury_texture.png");
-    // scale to size
-    double scale = MERCURY_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    p.center << MERCURY_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, MERCURY_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    p.model = m * s * p.model;
-    finalized_planet(program, shadowMapProgram, &p);
+    Mesh p = generate_textured_planet("textures/mercury_texture.png", MERCURY_SPHERE);
+    p.radius = MERCURY_RADIUS;
+    finalized_planet(program, shadowMapProgram);
     Planets.push_back(p);
 }
 
 void create_neptune(Program *program, Program *shadowMapProgram) {
-    Mesh p = generate_textured_planet(DATA_DIR "textures/neptune_texture.png");
-    // scale to size
-    double scale = NEPTUNE_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    p.center << NEPTUNE_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, NEPTUNE_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    p.model = m * s * p.model;
-    finalized_planet(program, shadowMapProgram, &p);
+    Mesh p = generate_textured_planet("textures/neptune_texture.png", NEPTUNE_SPHERE);
+    p.radius = NEPTUNE_RADIUS;
+    finalized_planet(program, shadowMapProgram);
     Planets.push_back(p);
 }
 
 void create_pluto(Program *program, Program *shadowMapProgram) {
-    Mesh p = generate_textured_planet(DATA_DIR "textures/pluto_texture.png");
-    // scale to size
-    double scale = PLUTO_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    p.center << PLUTO_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, PLUTO_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    p.model = m * s * p.model;
-    finalized_planet(program, shadowMapProgram, &p);
+    Mesh p = generate_textured_planet("textures/pluto_texture.png", PLUTO_SPHERE);
+    p.radius = PLUTO_RADIUS;
+    finalized_planet(program, shadowMapProgram);
     Planets.push_back(p);
 }
 
 void create_saturn(Program *program, Program *shadowMapProgram) {
-    Mesh p = generate_textured_planet(DATA_DIR "textures/saturn_texture.png");
-    // scale to size
-    double scale = SATURN_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    p.center << SATURN_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, SATURN_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    p.model = m * s * p.model;
-    finalized_planet(program, shadowMapProgram, &p);
+    Mesh p = generate_textured_planet("textures/saturn_texture.png", SATURN_SPHERE);
+    p.radius = SATURN_RADIUS;
+    finalized_planet(program, shadowMapProgram);
     Planets.push_back(p);
 }
 
 void create_uranus(Program *program, Program *shadowMapProgram) {
-    Mesh p = generate_textured_planet(DATA_DIR "textures/uranus_texture.png");
-    // scale to size
-    double scale = URANUS_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    p.center << URANUS_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, URANUS_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    p.model = m * s * p.model;
-    finalized_planet(program, shadowMapProgram, &p);
+    Mesh p = generate_textured_planet("textures/uranus_texture.png", URANUS_SPHERE);
+    p.radius = URANUS_RADIUS;
+    finalized_planet(program, shadowMapProgram);
     Planets.push_back(p);
 }
 
 void create_venus(Program *program, Program *shadowMapProgram) {
-    Mesh p = generate_textured_planet(DATA_DIR "textures/venus_texture.png");
-    // scale to size
-    double scale = VENUS_RADIUS / 0.5;
-    Eigen::Matrix4f s;
-    s << scale, 0.0f, 0.0f, 0.0f,
-        0.0f, scale, 0.0f, 0.0f,
-        0.0f, 0.0f, scale, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // move to position
-    p.center << VENUS_DISTANCE, 0, 0;
-    Eigen::Matrix4f m;
-    m << 1.0f, 0.0f, 0.0f, VENUS_DISTANCE,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    p.model = m * s * p.model;
-    finalized_planet(program, shadowMapProgram, &p);
+    Mesh p = generate_textured_planet("textures/venus_texture.png", VENUS_SPHERE);
+    p.radius = VENUS_RADIUS;
+    finalized_planet(program, shadowMapProgram);
     Planets.push_back(p);
 }
 
@@ -488,120 +517,164 @@ void create_venus(Program *program, Program *shadowMapProgram) {
 // update planets positions
 /////////////////////////////////////////////////////////////////////
 
-void move_planets(float seconds) {
-    // mercury, venus, earth, moon, mars, jupiter, saturn, uranus, neptune, pluto
-    // rotation
-    planet_rotation(seconds, SUN_ROTATION_CYCLE, &Sun, false);
-    planet_rotation(seconds, MERCURY_ROTATION_CYCLE, &Planets[0], false);
-    planet_rotation(seconds, VENUS_ROTATION_CYCLE, &Planets[1], false);
-    planet_rotation(seconds, EARTH_ROTATION_CYCLE, &Planets[2], true);
-    planet_rotation(seconds, MOON_ROTATION_CYCLE, &Planets[3], false);
-    planet_rotation(seconds, MARS_ROTATION_CYCLE, &Planets[4], false);
-    planet_rotation(seconds, JUPITER_ROTATION_CYCLE, &Planets[5], false);
-    planet_rotation(seconds, SATURN_ROTATION_CYCLE, &Planets[6], false);
-    planet_rotation(seconds, URANUS_ROTATION_CYCLE, &Planets[7], false);
-    planet_rotation(seconds, NEPTUNE_ROTATION_CYCLE, &Planets[8], false);
-    planet_rotation(seconds, PLUTO_ROTATION_CYCLE, &Planets[9], false);
-    // revolution
-    Eigen::Vector3f origin(0.0f, 0.0f, 0.0f);
-    planet_revolution(seconds, MERCURY_REVOLUTION_CYCLE, &Planets[0], origin, false);
-    planet_revolution(seconds, VENUS_REVOLUTION_CYCLE, &Planets[1], origin, false);
-    planet_revolution(seconds, EARTH_REVOLUTION_CYCLE, &Planets[2], origin, true);
-    planet_revolution(seconds, MOON_REVOLUTION_CYCLE, &Planets[3], Planets[2].center, false);
-    planet_revolution(seconds, MARS_REVOLUTION_CYCLE, &Planets[4], origin, false);
-    planet_revolution(seconds, JUPITER_REVOLUTION_CYCLE, &Planets[5], origin, false);
-    planet_revolution(seconds, SATURN_REVOLUTION_CYCLE, &Planets[6], origin, false);
-    planet_revolution(seconds, URANUS_REVOLUTION_CYCLE, &Planets[7], origin, false);
-    planet_revolution(seconds, NEPTUNE_REVOLUTION_CYCLE, &Planets[8], origin, false);
-    planet_revolution(seconds, PLUTO_REVOLUTION_CYCLE, &Planets[9], origin, false);
-}
-
-void planet_rotation(
-    float seconds, 
-    float rotationCycle, 
-    Mesh * planet,
-    bool isEarth
-) {
-    // step 1: move to origin
-    Eigen::Matrix4f m1;
-    m1 << 1.0f, 0.0f, 0.0f, -planet->center[0],
-        0.0f, 1.0f, 0.0f, -planet->center[1],
-        0.0f, 0.0f, 1.0f, -planet->center[2],
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // step 2: rotate
-    Eigen::Matrix4f m2;
-    double radian = 2 * M_PI * seconds / rotationCycle;
-    m2 << cos(radian), 0.0f, sin(radian), 0.0f,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        -sin(radian), 0.0f, cos(radian), 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // step 3: move back to position
-    Eigen::Matrix4f m3;
-    m3 << 1.0f, 0.0f, 0.0f, planet->center[0],
-        0.0f, 1.0f, 0.0f, planet->center[1],
-        0.0f, 0.0f, 1.0f, planet->center[2],
+// the translation and spin of a state
+static Eigen::Matrix4f state_frame(const BodyState &s) {
+    Eigen::Matrix4f m;
+    m << cos(s.spin), 0.0f, sin(s.spin), s.position[0],
+        0.0f, 1.0f, 0.0f, s.position[1],
+        -sin(s.spin), 0.0f, cos(s.spin), s.position[2],
         0.0f, 0.0f, 0.0f, 1.0f;
-    // apply to model matrix
-    // center doesn't change
-    planet->model = m3 * m2 * m1 * planet->model;
+    return m;
+}
 
-    if (isEarth && Scene == SCENE_EARTH_FOCUS) {
-        // update camera
-        CameraModel = m3 * m2 * m1 * CameraModel;
-        update_camera_view();
+// where gravity has a body, the moon riding its ellipse around the earth
+static BodyState gravity_state(int body) {
+    const BodyElements *elements = solar_system_elements();
+    BodyState state;
+    int i = solar_nbody_index(body == BODY_MOON ? BODY_EARTH : body);
+    state.position[0] = Gravity.x[i];
+    state.position[1] = Gravity.y[i];
+    state.position[2] = Gravity.z[i];
+    if (body == BODY_MOON) {
+        double moon[3];
+        orbit_position(elements[BODY_MOON], Gravity.time, moon);
+        for (int k = 0; k < 3; k++) {
+            state.position[k] += moon[k];
+        }
     }
+    state.anomaly = 0.0;
+    state.spin = body_spin(elements[body], Gravity.time);
+    return state;
 }
 
-void planet_revolution(
-    float seconds, 
-    float revolutionCycle, 
-    Mesh * planet, 
-    const Eigen::Vector3f &target,
-    bool isEarth
-) {
-    // step 1: move from target to origin
-    Eigen::Matrix4f m1;
-    m1 << 1.0f, 0.0f, 0.0f, -target[0],
-        0.0f, 1.0f, 0.0f, -target[1],
-        0.0f, 0.0f, 1.0f, -target[2],
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // step 2: rotate
-    Eigen::Matrix4f m2;
-    double radian = 2 * M_PI * seconds / revolutionCycle;
-    m2 << cos(radian), 0.0f, sin(radian), 0.0f,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        -sin(radian), 0.0f, cos(radian), 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // step 3: move back from origin to target
-    Eigen::Matrix4f m3;
-    m3 << 1.0f, 0.0f, 0.0f, target[0],
-        0.0f, 1.0f, 0.0f, target[1],
-        0.0f, 0.0f, 1.0f, target[2],
-        0.0f, 0.0f, 0.0f, 1.0f;
-    // update center
-    Eigen::Vector4f center4;
-    center4 << planet->center[0], planet->center[1], planet->center[2], 1.0f;
-    center4 = m3 * m2 * m1 * center4;
-    planet->center << center4[0], center4[1], center4[2];
-    // apply to model
-    planet->model = m3 * m2 * m1 * planet->model;
-
-    // if this is the earth
-    // then need to apply to moon
-    // as well since moon is attached to the earth
-    if (isEarth) {
-        Eigen::Vector4f mooncenter4;
-        mooncenter4 << Planets[3].center[0], Planets[3].center[1], Planets[3].center[2], 1.0f;
-        mooncenter4 = m3 * m2 * m1 * mooncenter4;
-        Planets[3].center << mooncenter4[0], mooncenter4[1], mooncenter4[2];
-        // apply to model
-        Planets[3].model = m3 * m2 * m1 * Planets[3].model;
-
-        // also appy to camera since camera will follow the earth
-        // update camera
-        if (Scene == SCENE_EARTH_FOCUS) {
-            CameraModel = m3 * m2 * m1 * CameraModel;
-            update_camera_view();
+Eigen::Matrix4f body_frame(int body, double t) {
+    const BodyElements *elements = solar_system_elements();
+    if (NBodyParticles >= 0 && Gravity.size() > 0) {
+        return state_frame(gravity_state(body));
+    }
+    if (!Ephemeris.covers(t)) {
+        return state_frame(body_state(elements, body, t));
+    }
+    BodyState state;
+    Ephemeris.position(body, t, state.position);
+    state.spin = body_spin(elements[body], t);
+    return state_frame(state);
+}
+
+static void place_body(Mesh *body, const BodyState &state) {
+    body->center << state.position[0], state.position[1], state.position[2];
+    // the sphere levels have a radius of 0.5
+    Eigen::Matrix4f s = Eigen::Matrix4f::Identity();
+    s.diagonal() << body->radius / 0.5f, body->radius / 0.5f, body->radius / 0.5f, 1.0f;
+    body->model = state_frame(state) * s;
+}
+
+void seed_gravity(double t) {
+    if (!GravityPool) {
+        GravityPool.reset(new ThreadPool());
+    }
+    auto t_start = std::chrono::high_resolution_clock::now();
+    solar_nbody(NBodyParticles, t, NBODY_SEED, Gravity);
+    Gravity.accelerate(GravityPool.get());
+    auto t_end = std::chrono::high_resolution_clock::now();
+    cout << Gravity.size() << " bodies under gravity from " << t << " s, first forces in "
+        << std::chrono::duration<double, std::milli>(t_end - t_start).count() << " ms." << endl;
+}
+
+// step the gravity mode toward t, a seek starts it over
+static void step_gravity(double t) {
+    if (Gravity.size() == 0 || t < Gravity.time || t > Gravity.time + NBODY_SEEK_TIME) {
+        seed_gravity(t);
+    }
+    // blocks of a step, so every frame shows the bodies in step; whoever
+    // needs finer steps takes them inside the block without the swarm
+    for (int s = 0; s < NBODY_FRAME_STEPS && Gravity.time + NBODY_STEP <= t; s++) {
+        Gravity.block_step(NBODY_STEP, GravityPool.get());
+    }
+    if (ParticleVBO.id == 0) {
+        return;
+    }
+    int count = Gravity.size() - Gravity.massive;
+    ParticlePositions.resize(3 * (size_t) count);
+    for (int i = 0; i < count; i++) {
+        ParticlePositions[3 * i] = (float) Gravity.x[Gravity.massive + i];
+        ParticlePositions[3 * i + 1] = (float) Gravity.y[Gravity.massive + i];
+        ParticlePositions[3 * i + 2] = (float) Gravity.z[Gravity.massive + i];
+    }
+    ParticleVBO.update(ParticlePositions.data(), 3, count);
+}
+
+void draw_particles(Program *program) {
+    if (ParticleVBO.cols == 0) {
+        return;
+    }
+    if (ParticleVAO.id == 0) {
+        ParticleVAO.init();
+        ParticleVAO.bind();
+        program->bindVertexAttribArray("position", ParticleVBO);
+    }
+    ParticleVAO.bind();
+    glDrawArrays(GL_POINTS, 0, ParticleVBO.cols);
+}
+
+void place_bodies(double t) {
+    // mercury, venus, earth, moon, mars, jupiter, saturn, uranus, neptune, pluto
+    const BodyElements *elements = solar_system_elements();
+    BodyState states[BODY_COUNT];
+    if (NBodyParticles >= 0) {
+        step_gravity(t);
+        for (int i = 0; i < BODY_COUNT; i++) {
+            states[i] = gravity_state(i);
+        }
+    } else if (Ephemeris.covers(t)) {
+        double positions[BODY_COUNT][3];
+        Ephemeris.positions(t, positions);
+        for (int i = 0; i < BODY_COUNT; i++) {
+            memcpy(states[i].position, positions[i], sizeof(positions[i]));
+            states[i].spin = body_spin(elements[i], t);
         }
+    } else {
+        // solved in closed form past the end of the tables
+        static OrbitTable orbits;
+        if (orbits.size() == 0) {
+            orbits.init(elements, BODY_COUNT);
+        }
+        orbits.evaluate(t, states);
+    }
+    place_body(&Sun, states[BODY_SUN]);
+    for (size_t i = 0; i < Planets.size(); i++) {
+        place_body(&Planets[i], states[BODY_MERCURY + i]);
     }
-}
\ No newline at end of file
+    // the camera follows the earth
+    if (Scene == SCENE_EARTH_FOCUS) {
+        update_camera_view();
+    }
+}
+
+void load_ephemeris() {
+    Ephemeris.clear();
+    if (EphemerisSpan <= 0.0) {
+        return;
+    }
+    const BodyElements *elements = solar_system_elements();
+    uint64_t hash = ephemeris_hash(elements, BODY_COUNT, 0.0, EphemerisSpan);
+    const AssetPackEntry *entry = Assets.find("ephemeris");
+    if (entry != NULL && entry->format == ASSET_EPHEMERIS &&
+        Ephemeris.init(Assets.data(*entry), entry->size, hash)) {
+        return;
+    }
+    string fname = CACHE_DIR "ephemeris.cheb";
+    if (EphemerisFile.open(fname) && Ephemeris.init(EphemerisFile.data, EphemerisFile.size, hash)) {
+        return;
+    }
+    EphemerisFile.close();
+    auto t_start = std::chrono::high_resolution_clock::now();
+    encode_ephemeris_cache(elements, BODY_COUNT, 0.0, EphemerisSpan, EphemerisBytes);
+    if (!write_file(fname, EphemerisBytes)) {
+        cerr << "Failed to write the ephemeris cache " << fname << endl;
+    }
+    Ephemeris.init(EphemerisBytes.data(), EphemerisBytes.size(), hash);
+    cout << "Orbits fit over " << EphemerisSpan << " s in "
+        << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_start).count()
+        << " ms." << endl;
+}
@@ -1,61 +1,129 @@
 #include "index.h"
 
-void set_shaders(Program *program) {
-    const GLchar *vertex_shader = R"(
-		#version 150 core
+UniformBufferObject FrameBuffer;
+TextureBufferObject InstanceBuffer;
+TextureBufferObject DrawListBuffer;
+
+vector<DrawRange> MainDraws;
+vector<DrawRange> ShadowDraws;
+vector<int> ShadowCasters;
+vector<int> VisibleBodies;
+
+// the uniform block shared by the programs
+// the layout must match FrameBlock in index.h
+static const std::string frame_block_source = R"(
+        layout(std140) uniform Frame {
+            mat4 view;
+            mat4 proj;
+            mat4 distort;
+            mat4 cloudModel;
+            mat4 skyInverse;
+            vec4 cameraPosition;
+            vec4 lightPosition;
+            mat4 lightFaces[6];
+            vec4 shadowParams; // x: cube near, y: cube far, z: analytic mode, w: sun radius
+        } frame;
+)";
+
+// reads the body of an instance, the layout must match InstanceData in index.h
+static const std::string instance_source = R"(
+        const int INSTANCE_TEXELS = )" + std::to_string(INSTANCE_TEXELS) + R"(;
+
+        uniform samplerBuffer instances;
+        uniform isamplerBuffer drawList;
+
+        mat4 instance_matrix(int instance, int texel) {
+            int base = instance * INSTANCE_TEXELS + texel;
+            return mat4(
+                texelFetch(instances, base),
+                texelFetch(instances, base + 1),
+                texelFetch(instances, base + 2),
+                texelFetch(instances, base + 3)
+            );
+        }
 
-        in vec3 position;
-        in vec2 texcoord;
-        in vec3 normal;
+        mat4 instance_model(int instance) {
+            return instance_matrix(instance, 0);
+        }
 
-        uniform mat4 distort;
-        uniform mat4 model;
-        uniform mat4 view;
-        uniform mat4 proj;
-        uniform mat4 lightMVP;
+        // texture layer, enable shading, clouds, radius
+        vec4 instance_params(int instance) {
+            return texelFetch(instances, instance * INSTANCE_TEXELS + 4);
+        }
 
-        out vec2 Texcoord;
-        out vec3 fragPosition;
-        out vec3 fragNormal;
-        out vec4 fragPosLightSpace;
-        out vec3 cloudPosition;
+        // first and count of the occluder ids in the draw list
+        ivec2 instance_occluders(int instance) {
+            return ivec2(texelFetch(instances, instance * INSTANCE_TEXELS + 5).xy);
+        }
 
-		void main() {
-			gl_Position = distort * proj * view * model * vec4(position, 1.0);
-            fragPosition = vec3(model * vec4(position, 1.0));
-            fragNormal = transpose(inverse(mat3(model))) * normal;
-            Texcoord = texcoord;
-            fragPosLightSpace = lightMVP * vec4(position, 1.0);
-            cloudPosition = position;
-		}
-	)";
+        // how much of the texture layer is uploaded
+        int instance_layer_state(int instance) {
+            return int(texelFetch(instances, instance * INSTANCE_TEXELS + 5).z);
+        }
+)";
 
-    const GLchar *fragment_shader = R"(
-		#version 150 core
+// the body drawn by an instance, vertex shaders only
+static const std::string draw_list_source = R"(
+        uniform int drawOffset;
 
-        in vec2 Texcoord;
-        in vec3 fragPosition;
-        in vec3 fragNormal;
-        in vec4 fragPosLightSpace;
-        in vec3 cloudPosition;
+        int draw_instance() {
+            return texelFetch(drawList, drawOffset + gl_InstanceID).r;
+        }
+)";
 
-        uniform mat4 model;
-        uniform mat4 view;
+// the surface of the bodies, shared by the meshes and the impostors
+static const std::string body_source = R"(
+        const int LAYER_PLACEHOLDER = )" + std::to_string(LAYER_PLACEHOLDER) + R"(;
+        const int LAYER_RESIDENT = )" + std::to_string(LAYER_RESIDENT) + R"(;
 
-        uniform sampler2D tex;
-        uniform sampler2D shadowMap;
+        uniform sampler2DArray tex;
+        uniform sampler2DArray placeholders;
+        uniform samplerCube shadowCube;
 
-        uniform vec3 lightPosition;
-        uniform vec3 cameraPosition;
+        out vec4 outColor;
 
-        // a flag to show whether should enable shading
-        uniform int enableShading;
-        // whether there is cloud
-        uniform int cloud;
+        const float PI = 3.14159265;
 
-        uniform mat4 cloudModel;
+        // area shared by two disks of radius r1 and r2 whose centers are d apart
+        float disk_overlap(float r1, float r2, float d) {
+            if (d >= r1 + r2) {
+                return 0.0;
+            }
+            if (d <= abs(r1 - r2)) {
+                float r = min(r1, r2);
+                return PI * r * r;
+            }
+            float a1 = r1 * r1 * acos(clamp((d * d + r1 * r1 - r2 * r2) / (2.0 * d * r1), -1.0, 1.0));
+            float a2 = r2 * r2 * acos(clamp((d * d + r2 * r2 - r1 * r1) / (2.0 * d * r2), -1.0, 1.0));
+            float k = (-d + r1 + r2) * (d + r1 - r2) * (d - r1 + r2) * (d + r1 + r2);
+            return a1 + a2 - 0.5 * sqrt(max(k, 0.0));
+        }
 
-        out vec4 outColor;
+        // fraction of the sun disk seen from p past the occluders of this body,
+        // each disk measured by its angular radius
+        float sun_visibility(vec3 p, ivec2 occluders) {
+            vec3 toSun = frame.lightPosition.xyz - p;
+            float sunDistance = length(toSun);
+            toSun /= sunDistance;
+            float sunRadius = asin(min(frame.shadowParams.w / sunDistance, 1.0));
+            float sunArea = PI * sunRadius * sunRadius;
+            float visibility = 1.0;
+            for (int k = 0; k < occluders.y; k++) {
+                int id = texelFetch(drawList, occluders.x + k).r;
+                vec3 center = instance_matrix(id, 0)[3].xyz;
+                float radius = instance_params(id).w;
+                vec3 toOccluder = center - p;
+                float occluderDistance = length(toOccluder);
+                // only what lies between p and the sun
+                if (occluderDistance >= sunDistance || dot(toOccluder, toSun) <= 0.0) {
+                    continue;
+                }
+                float occluderRadius = asin(min(radius / occluderDistance, 1.0));
+                float angle = acos(clamp(dot(toOccluder / occluderDistance, toSun), -1.0, 1.0));
+                visibility *= 1.0 - min(disk_overlap(sunRadius, occluderRadius, angle) / sunArea, 1.0);
+            }
+            return visibility;
+        }
 
         vec3 hash(vec3 p) {
 	        p = vec3(
@@ -96,15 +164,26 @@ void set_shaders(Program *program) {
             return vec3(0.5 * f + 0.5);
         }
 
-		void main() {
-            vec3 color = texture(tex, Texcoord).rgb;
+        // the placeholder until the layer is uploaded, grey before that
+        vec3 body_color(vec2 texcoord, vec2 dx, vec2 dy, float layer, int layerState) {
+            if (layerState == LAYER_RESIDENT) {
+                return textureGrad(tex, vec3(texcoord, layer), dx, dy).rgb;
+            } else if (layerState == LAYER_PLACEHOLDER) {
+                return textureGrad(placeholders, vec3(texcoord, layer), dx, dy).rgb;
+            }
+            return vec3(0.5);
+        }
 
-            if (cloud == 1) {
-                vec3 cloudColor = noise(vec3(view * cloudModel * model * vec4(cloudPosition, 1.0)));
+        // clouds, lighting and shadows of a point of a body
+        vec4 shade_body(vec3 color, vec3 fragPosition, vec3 fragNormal, vec3 cloudPosition, vec4 params, ivec2 occluders) {
+            // whether there is cloud
+            if (params.z > 0.5) {
+                vec3 cloudColor = noise(cloudPosition);
                 color = color + cloudColor;
             }
             
-            if (enableShading == 1) {
+            // a flag to show whether should enable shading
+            if (params.y > 0.5) {
                 vec3 normal = normalize(fragNormal);
                 vec3 lightColor = vec3(1.0, 1.0, 1.0);
 
@@ -112,41 +191,97 @@ void set_shaders(Program *program) {
                 vec3 ambient = 0.15 * color;
 
                 // Diffuse
-                vec3 lightDir = normalize(lightPosition - fragPosition);
+                vec3 lightDir = normalize(frame.lightPosition.xyz - fragPosition);
                 float diff = max(dot(lightDir, normal), 0.0);
                 vec3 diffuse = diff * lightColor;
 
                 // Specular
-                vec3 viewDir = normalize(cameraPosition - fragPosition);
+                vec3 viewDir = normalize(frame.cameraPosition.xyz - fragPosition);
                 vec3 reflectDir = reflect(-lightDir, normal);
                 float spec = 0.0;
                 vec3 halfwayDir = normalize(lightDir + viewDir);  
                 spec = pow(max(dot(normal, halfwayDir), 0.0), 64.0);
                 vec3 specular = spec * lightColor;
 
-                // calculate shadow
-                vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-                projCoords = projCoords * 0.5 + 0.5;
-                float closestDepth = texture(shadowMap, projCoords.xy).r;
-                float currentDepth = projCoords.z;
-
-                float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
                 float shadow = 0.0;
-                vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
-                for (int x = -1; x <= 1; ++x) {
-                    for (int y = -1; y <= 1; ++y) {
-                        float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r; 
-                        shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;        
-                    }    
+                if (frame.shadowParams.z > 0.5) {
+                    // exact umbra and penumbra of the spheres in front of the sun
+                    shadow = 1.0 - sun_visibility(fragPosition, occluders);
+                } else {
+                    // the cube stores the distance to the closest caster
+                    vec3 fromLight = fragPosition - frame.lightPosition.xyz;
+                    float currentDepth = length(fromLight);
+
+                    float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
+                    // one texel at this distance
+                    float texelSize = 2.0 * currentDepth / float(textureSize(shadowCube, 0).x);
+                    for (int x = -1; x <= 1; x += 2) {
+                        for (int y = -1; y <= 1; y += 2) {
+                            for (int z = -1; z <= 1; z += 2) {
+                                vec3 dir = fromLight + vec3(x, y, z) * texelSize;
+                                float pcfDepth = texture(shadowCube, dir).r * frame.shadowParams.y;
+                                shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
+                            }
+                        }
+                    }
+                    float centerDepth = texture(shadowCube, fromLight).r * frame.shadowParams.y;
+                    shadow += currentDepth - bias > centerDepth ? 1.0 : 0.0;
+                    shadow /= 9.0;
                 }
-                shadow /= 9.0;
 
                 vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * color;
 
-                outColor = vec4(lighting, 1.0);
-            } else {
-                outColor = vec4(color, 1.0);
+                return vec4(lighting, 1.0);
             }
+            return vec4(color, 1.0);
+        }
+)";
+
+void set_shaders(Program *program) {
+    const std::string vertex_shader = std::string(R"(
+		#version 150 core
+
+        in vec3 position;
+        in vec2 texcoord;
+        in vec3 normal;
+)") + frame_block_source + instance_source + draw_list_source + R"(
+        out vec2 Texcoord;
+        out vec3 fragPosition;
+        out vec3 fragNormal;
+        out vec3 cloudPosition;
+        flat out vec4 params;
+        flat out ivec2 occluders;
+        flat out int layerState;
+
+		void main() {
+            int instance = draw_instance();
+            mat4 model = instance_model(instance);
+			gl_Position = frame.distort * frame.proj * frame.view * model * vec4(position, 1.0);
+            fragPosition = vec3(model * vec4(position, 1.0));
+            fragNormal = transpose(inverse(mat3(model))) * normal;
+            Texcoord = texcoord;
+            // the noise is sampled in view space, affine so it interpolates exactly
+            cloudPosition = vec3(frame.view * frame.cloudModel * model * vec4(position, 1.0));
+            params = instance_params(instance);
+            occluders = instance_occluders(instance);
+            layerState = instance_layer_state(instance);
+		}
+	)";
+
+    const std::string fragment_shader = std::string(R"(
+		#version 150 core
+
+        in vec2 Texcoord;
+        in vec3 fragPosition;
+        in vec3 fragNormal;
+        in vec3 cloudPosition;
+        flat in vec4 params;
+        flat in ivec2 occluders;
+        flat in int layerState;
+)") + frame_block_source + instance_source + body_source + R"(
+		void main() {
+            vec3 color = body_color(Texcoord, dFdx(Texcoord), dFdy(Texcoord), params.x, layerState);
+            outColor = shade_body(color, fragPosition, fragNormal, cloudPosition, params, occluders);
 		}
 	)";
 
@@ -156,29 +291,411 @@ void set_shaders(Program *program) {
     program->init(vertex_shader, fragment_shader, "outColor");
 }
 
+// one quad a body facing the camera, the sphere is ray cast in the fragment shader
+void set_shaders_impostor(Program *program) {
+    const std::string vertex_shader = std::string(R"(
+		#version 150 core
+)") + frame_block_source + instance_source + draw_list_source + R"(
+        out vec3 fragPosition;
+        flat out vec3 center;
+        flat out mat3 toLocal;
+        flat out vec4 params;
+        flat out ivec2 occluders;
+        flat out int layerState;
+
+		void main() {
+            int instance = draw_instance();
+            mat4 model = instance_model(instance);
+            params = instance_params(instance);
+            occluders = instance_occluders(instance);
+            layerState = instance_layer_state(instance);
+            center = model[3].xyz;
+            // the scale is uniform, the transpose turns a direction back into the body
+            toLocal = transpose(mat3(model));
+
+            float radius = params.w;
+            vec3 toCenter = center - frame.cameraPosition.xyz;
+            float d2 = dot(toCenter, toCenter);
+            if (d2 <= radius * radius) {
+                // the camera is inside, nothing to draw
+                gl_Position = vec4(0.0);
+                fragPosition = center;
+                return;
+            }
+            // the cone of the rays grazing the sphere cuts the plane through its center in this radius
+            float extent = radius * sqrt(d2 / (d2 - radius * radius));
+            vec3 forward = toCenter * inversesqrt(d2);
+            vec3 right = normalize(cross(forward, abs(forward.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+            vec3 up = cross(right, forward);
+            // a strip of (-1, -1), (1, -1), (-1, 1) and (1, 1)
+            vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+            fragPosition = center + extent * (corner.x * right + corner.y * up);
+            gl_Position = frame.distort * frame.proj * frame.view * vec4(fragPosition, 1.0);
+		}
+	)";
+
+    const std::string fragment_shader = std::string(R"(
+		#version 150 core
+
+        in vec3 fragPosition;
+        flat in vec3 center;
+        flat in mat3 toLocal;
+        flat in vec4 params;
+        flat in ivec2 occluders;
+        flat in int layerState;
+)") + frame_block_source + instance_source + body_source + R"(
+		void main() {
+            // the closer hit of the ray from the camera through the quad
+            vec3 eye = frame.cameraPosition.xyz;
+            vec3 dir = normalize(fragPosition - eye);
+            vec3 oc = eye - center;
+            float b = dot(oc, dir);
+            float disc = b * b - dot(oc, oc) + params.w * params.w;
+            // clamped so the misses still give the derivatives of their neighbours
+            vec3 p = eye + (-b - sqrt(max(disc, 0.0))) * dir;
+            vec3 normal = (p - center) / params.w;
+
+            // the mapping of the sphere meshes, see build_icosphere
+            vec3 local = normalize(toLocal * normal);
+            float u = atan(-local.z, -local.x) / (2.0 * PI);
+            float v = acos(clamp(-local.y, -1.0, 1.0)) / PI;
+            // u jumps by one across the seam, take its derivatives from
+            // a copy turned by half that jumps on the other side
+            float u1 = fract(u);
+            float u2 = fract(u + 0.5) - 0.5;
+            vec2 dx = vec2(dFdx(u1), dFdx(v));
+            vec2 dy = vec2(dFdy(u1), dFdy(v));
+            float dx2 = dFdx(u2), dy2 = dFdy(u2);
+            if (abs(dx2) + abs(dy2) < abs(dx.x) + abs(dy.x)) {
+                dx.x = dx2;
+                dy.x = dy2;
+            }
+            if (disc < 0.0) {
+                discard;
+            }
+
+            // the depth of the sphere, not of the quad
+            vec4 clip = frame.distort * frame.proj * frame.view * vec4(p, 1.0);
+            gl_FragDepth = 0.5 * clip.z / clip.w + 0.5;
+
+            vec3 color = body_color(vec2(u1, v), dx, dy, params.x, layerState);
+            vec3 cloudPosition = vec3(frame.view * frame.cloudModel * vec4(p, 1.0));
+            outColor = shade_body(color, p, normal, cloudPosition, params, occluders);
+		}
+	)";
+
+    program->init(vertex_shader, fragment_shader, "outColor");
+}
+
 void set_shaders_shadow_map(Program *program) {
-    const GLchar *vertex_shader = R"(
+    const std::string vertex_shader = std::string(R"(
 		#version 150 core
 
         in vec3 position;
+)") + instance_source + draw_list_source + R"(
+		void main() {
+			gl_Position = instance_model(draw_instance()) * vec4(position, 1.0f);
+		}
+	)";
 
-        uniform mat4 mvp;
+    // send every triangle to the six faces of the cube in a single draw
+    const std::string geometry_shader = std::string(R"(
+		#version 150 core
+
+        layout(triangles) in;
+        layout(triangle_strip, max_vertices = 18) out;
+)") + frame_block_source + R"(
+        out vec3 fragPosition;
 
 		void main() {
-			gl_Position = mvp * vec4(position, 1.0f);
+            for (int face = 0; face < 6; face++) {
+                gl_Layer = face;
+                for (int i = 0; i < 3; i++) {
+                    fragPosition = gl_in[i].gl_Position.xyz;
+                    gl_Position = frame.lightFaces[face] * gl_in[i].gl_Position;
+                    EmitVertex();
+                }
+                EndPrimitive();
+            }
 		}
 	)";
 
-    const GLchar *fragment_shader = R"(
+    // a linear distance, the same in every face
+    const std::string fragment_shader = std::string(R"(
 		#version 150 core
 
+        in vec3 fragPosition;
+)") + frame_block_source + R"(
         out vec4 outColor;
 
 		void main() {
-            gl_FragDepth = gl_FragCoord.z;
+            gl_FragDepth = length(fragPosition - frame.lightPosition.xyz) / frame.shadowParams.y;
             outColor = vec4(0.0, 0.0, 0.0, 1.0);
 		}
 	)";
 
+    program->init(vertex_shader, geometry_shader, fragment_shader, "outColor");
+}
+
+void set_shaders_skybox(Program *program) {
+    const std::string vertex_shader = std::string(R"(
+		#version 150 core
+)") + frame_block_source + R"(
+        out vec4 direction;
+
+		void main() {
+            // one triangle covering the screen, (-1, -1), (3, -1) and (-1, 3)
+            vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+            // on the far plane, wherever it is
+            gl_Position = vec4(corner, 1.0, 1.0);
+            direction = frame.skyInverse * gl_Position;
+		}
+	)";
+
+    const std::string fragment_shader = R"(
+		#version 150 core
+
+        in vec4 direction;
+
+        uniform samplerCube sky;
+
+        out vec4 outColor;
+
+		void main() {
+            outColor = vec4(texture(sky, direction.xyz / direction.w).rgb, 1.0);
+		}
+	)";
+
+    program->init(vertex_shader, fragment_shader, "outColor");
+}
+
+void set_shaders_particles(Program *program) {
+    const std::string vertex_shader = std::string(R"(
+		#version 150 core
+)") + frame_block_source + R"(
+        in vec3 position;
+
+		void main() {
+            gl_Position = frame.distort * frame.proj * frame.view * vec4(position, 1.0);
+		}
+	)";
+
+    const std::string fragment_shader = R"(
+		#version 150 core
+
+        out vec4 outColor;
+
+		void main() {
+            // dust, one pixel a particle
+            outColor = vec4(0.75, 0.72, 0.68, 1.0);
+		}
+	)";
+
     program->init(vertex_shader, fragment_shader, "outColor");
-}
\ No newline at end of file
+}
+
+void init_uniform_blocks(Program *program, Program *impostorProgram, Program *shadowMapProgram, Program *skyboxProgram,
+    Program *particleProgram) {
+    FrameBuffer.init();
+    InstanceBuffer.init(GL_RGBA32F);
+    DrawListBuffer.init(GL_R32I);
+    program->bindUniformBlock("Frame", FRAME_BLOCK_BINDING);
+    impostorProgram->bindUniformBlock("Frame", FRAME_BLOCK_BINDING);
+    shadowMapProgram->bindUniformBlock("Frame", FRAME_BLOCK_BINDING);
+    skyboxProgram->bindUniformBlock("Frame", FRAME_BLOCK_BINDING);
+    particleProgram->bindUniformBlock("Frame", FRAME_BLOCK_BINDING);
+    // the samplers never change
+    for (Program *p : { program, impostorProgram }) {
+        p->bind();
+        p->set(p->uniform("tex"), TEXTURE_UNIT);
+        p->set(p->uniform("placeholders"), PLACEHOLDER_UNIT);
+        p->set(p->uniform("shadowCube"), SHADOW_CUBE_UNIT);
+        p->set(p->uniform("instances"), INSTANCE_UNIT);
+        p->set(p->uniform("drawList"), DRAW_LIST_UNIT);
+    }
+    shadowMapProgram->bind();
+    shadowMapProgram->set(shadowMapProgram->uniform("instances"), INSTANCE_UNIT);
+    shadowMapProgram->set(shadowMapProgram->uniform("drawList"), DRAW_LIST_UNIT);
+    skyboxProgram->bind();
+    skyboxProgram->set(skyboxProgram->uniform("sky"), SKYBOX_UNIT);
+}
+
+void update_uniform_blocks(const Eigen::Matrix4f &distort, const Eigen::Matrix4f &cloudModel) {
+    // camera and light
+    FrameBlock frame;
+    memcpy(frame.view, VIEW.data(), sizeof(frame.view));
+    memcpy(frame.proj, PROJ.data(), sizeof(frame.proj));
+    memcpy(frame.distort, distort.data(), sizeof(frame.distort));
+    memcpy(frame.cloudModel, cloudModel.data(), sizeof(frame.cloudModel));
+    // the sky only turns with the camera, drop the translation of the view
+    Eigen::Matrix4f skyView = VIEW;
+    skyView.block<3, 1>(0, 3).setZero();
+    Eigen::Matrix4f skyInverse = (distort * PROJ * skyView).inverse();
+    memcpy(frame.skyInverse, skyInverse.data(), sizeof(frame.skyInverse));
+    frame.cameraPosition[0] = CameraPosition[0];
+    frame.cameraPosition[1] = CameraPosition[1];
+    frame.cameraPosition[2] = CameraPosition[2];
+    frame.cameraPosition[3] = 1.0f;
+    frame.lightPosition[0] = Sun.center[0];
+    frame.lightPosition[1] = Sun.center[1];
+    frame.lightPosition[2] = Sun.center[2];
+    frame.lightPosition[3] = 1.0f;
+    // the six faces of the shadow cube, in the order of the cube map targets
+    static const float faces[6][6] = {
+        { 1, 0, 0, 0, -1, 0 },
+        { -1, 0, 0, 0, -1, 0 },
+        { 0, 1, 0, 0, 0, 1 },
+        { 0, -1, 0, 0, 0, -1 },
+        { 0, 0, 1, 0, -1, 0 },
+        { 0, 0, -1, 0, -1, 0 },
+    };
+    Eigen::Matrix4f faceProj = perspective(90.0f, 1.0f, SHADOW_NEAR_PLANE, SHADOW_FAR_PLANE);
+    for (int face = 0; face < 6; face++) {
+        Eigen::Vector3f dir(faces[face][0], faces[face][1], faces[face][2]);
+        Eigen::Vector3f up(faces[face][3], faces[face][4], faces[face][5]);
+        Eigen::Matrix4f faceVP = faceProj * lookAt(Sun.center, Sun.center + dir, up);
+        memcpy(frame.lightFaces[face], faceVP.data(), sizeof(frame.lightFaces[face]));
+    }
+    frame.shadowParams[0] = SHADOW_NEAR_PLANE;
+    frame.shadowParams[1] = SHADOW_FAR_PLANE;
+    frame.shadowParams[2] = ShadowMode == SHADOW_MODE_ANALYTIC ? 1.0f : 0.0f;
+    frame.shadowParams[3] = Sun.radius;
+    FrameBuffer.update(&frame, sizeof(frame));
+    FrameBuffer.bind_range(FRAME_BLOCK_BINDING, 0, sizeof(frame));
+}
+
+static void fill_instance(InstanceData *instance, const Mesh &m, int enableShading, int cloud) {
+    memcpy(instance->model, m.model.data(), sizeof(instance->model));
+    instance->params[0] = m.layer;
+    instance->params[1] = enableShading;
+    instance->params[2] = cloud;
+    instance->params[3] = m.radius;
+    instance->occluders[0] = 0.0f;
+    instance->occluders[1] = 0.0f;
+    instance->occluders[2] = Textures.layer_state(m.layer);
+    instance->occluders[3] = 0.0f;
+}
+
+// whether a sphere cuts the hull of the sun and the receiver, the region
+// any ray from the sun to the receiver goes through
+static bool in_sun_cone(const Mesh &occluder, const Mesh &receiver) {
+    Eigen::Vector3f axis = receiver.center - Sun.center;
+    float length2 = axis.squaredNorm();
+    if (length2 == 0.0f) {
+        return false;
+    }
+    float t = (occluder.center - Sun.center).dot(axis) / length2;
+    if (t <= 0.0f || t >= 1.0f) {
+        return false; // behind the sun or behind the receiver
+    }
+    // the hull narrows linearly from the sun to the receiver
+    float hull = Sun.radius + (receiver.radius - Sun.radius) * t;
+    float distance = (occluder.center - (Sun.center + t * axis)).norm();
+    return distance < hull + occluder.radius;
+}
+
+// append a range of instance ids to the draw list
+static DrawRange push_range(vector<GLint> &list, const vector<GLint> &ids) {
+    DrawRange range;
+    range.first = list.size();
+    range.count = ids.size();
+    list.insert(list.end(), ids.begin(), ids.end());
+    return range;
+}
+
+static const Mesh &instance_body(int id) {
+    return id == SUN_INSTANCE ? Sun : Planets[id - PLANET_INSTANCE(0)];
+}
+
+// the bucket a body falls in: its level of the chain, the bundled sphere
+// after every level
+static int bucket(const Mesh &m, int Mesh::*lod) {
+    return m.sphere == SPHERE_SOURCE_CHAIN ? m.*lod : SPHERE_LODS;
+}
+
+// append the instance ids to the draw list grouped by the sphere geometry
+// the pass draws them with, one range per geometry, coarsest level first
+static void push_buckets(vector<GLint> &list, vector<GLint> &ids, int Mesh::*lod, vector<DrawRange> &ranges) {
+    std::stable_sort(ids.begin(), ids.end(), [lod](GLint a, GLint b) {
+        return bucket(instance_body(a), lod) < bucket(instance_body(b), lod);
+    });
+    ranges.clear();
+    for (size_t i = 0; i < ids.size(); i++) {
+        const Mesh &body = instance_body(ids[i]);
+        Geometry *geometry = body.sphere == SPHERE_SOURCE_CHAIN ? SphereLods[body.*lod].get() : body.geometry.get();
+        if (ranges.empty() || ranges.back().geometry != geometry) {
+            ranges.push_back(DrawRange());
+            ranges.back().first = list.size();
+            ranges.back().geometry = geometry;
+        }
+        list.push_back(ids[i]);
+        ranges.back().count++;
+    }
+}
+
+void update_instances(const Eigen::Matrix4f &clip) {
+    // kept between frames to avoid reallocating
+    static vector<InstanceData> instances;
+    static vector<GLint> drawList;
+    static SphereSet spheres;
+    static vector<int> visible;
+    instances.resize(PLANET_INSTANCE(Planets.size()));
+    drawList.clear();
+
+    fill_instance(&instances[SUN_INSTANCE], Sun, 0, 0);
+    for (int i = 0; i < Planets.size(); i++) {
+        // only the earth has clouds
+        fill_instance(&instances[PLANET_INSTANCE(i)], Planets[i], 1, i == 2 ? 1 : 0);
+    }
+
+    Frustum frustum;
+    extract_frustum(clip, frustum);
+
+    // the main pass draws the bodies in view, the instance id is the sphere index
+    spheres.clear();
+    spheres.push(Sun.center, Sun.radius);
+    for (const Mesh &p : Planets) {
+        spheres.push(p.center, p.radius);
+    }
+    cull_spheres(frustum, spheres, visible);
+    VisibleBodies = visible;
+    vector<GLint> ids(visible.begin(), visible.end());
+    push_buckets(drawList, ids, &Mesh::lod, MainDraws);
+    Stats.visible += visible.size();
+    Stats.culled += spheres.count - visible.size();
+
+    // the planets cast into the shadow cube, the sun does not
+    // the casters are the planets within the range of the cube, whatever the
+    // camera sees, so moving the camera alone never outdates the cube
+    visible.clear();
+    for (int i = 0; i < Planets.size(); i++) {
+        float distance = (Planets[i].center - Sun.center).norm();
+        if (distance - Planets[i].radius < SHADOW_FAR_PLANE && distance + Planets[i].radius > SHADOW_NEAR_PLANE) {
+            visible.push_back(i);
+        }
+    }
+    ShadowCasters = visible;
+    ids.clear();
+    for (int i : visible) {
+        ids.push_back(PLANET_INSTANCE(i));
+    }
+    push_buckets(drawList, ids, &Mesh::shadowLod, ShadowDraws);
+    Stats.shadowCasters += visible.size();
+    Stats.shadowCulled += Planets.size() - visible.size();
+
+    // the occluders of each planet, for the analytic shadows
+    for (int i = 0; i < Planets.size(); i++) {
+        ids.clear();
+        for (int j = 0; j < Planets.size(); j++) {
+            if (j != i && in_sun_cone(Planets[j], Planets[i])) {
+                ids.push_back(PLANET_INSTANCE(j));
+            }
+        }
+        DrawRange range = push_range(drawList, ids);
+        instances[PLANET_INSTANCE(i)].occluders[0] = range.first;
+        instances[PLANET_INSTANCE(i)].occluders[1] = range.count;
+    }
+
+    InstanceBuffer.update(instances.data(), instances.size() * sizeof(InstanceData));
+    DrawListBuffer.update(drawList.data(), drawList.size() * sizeof(GLint));
+}
@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "skybox.h"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+////////////////////////////////////////////////////////////////////////////////
+
+// direction through texel (sc, tc) in [-1, 1] of a face, as GL samples cube maps
+static Eigen::Vector3f face_direction(int face, float sc, float tc) {
+	switch (face) {
+		case 0: return Eigen::Vector3f(1.0f, -tc, -sc);
+		case 1: return Eigen::Vector3f(-1.0f, -tc, sc);
+		case 2: return Eigen::Vector3f(sc, 1.0f, tc);
+		case 3: return Eigen::Vector3f(sc, -1.0f, -tc);
+		case 4: return Eigen::Vector3f(sc, -tc, 1.0f);
+		default: return Eigen::Vector3f(-sc, -tc, -1.0f);
+	}
+}
+
+static Eigen::Vector4f texel(const Image &src, int x, int y) {
+	const unsigned char *p = src.row(y) + 4 * x;
+	return Eigen::Vector4f(p[0], p[1], p[2], p[3]);
+}
+
+// bilinear sample, wrapping around horizontally
+static Eigen::Vector4f sample(const Image &src, float u, float v) {
+	int w = src.width, h = src.height;
+	float fx = u * w - 0.5f;
+	float fy = std::min(std::max(v * h - 0.5f, 0.0f), float(h - 1));
+	int x0 = int(std::floor(fx));
+	int y0 = int(fy);
+	float tx = fx - x0;
+	float ty = fy - y0;
+	int y1 = std::min(y0 + 1, h - 1);
+	int x1 = ((x0 + 1) % w + w) % w;
+	x0 = (x0 % w + w) % w;
+	Eigen::Vector4f top = (1 - tx) * texel(src, x0, y0) + tx * texel(src, x1, y0);
+	Eigen::Vector4f bottom = (1 - tx) * texel(src, x0, y1) + tx * texel(src, x1, y1);
+	return (1 - ty) * top + ty * bottom;
+}
+
+void equirect_to_cube(
+	const Image &src,
+	int size,
+	std::vector<unsigned char> &faces,
+	ThreadPool &pool
+) {
+	size_t faceBytes = (size_t) size * size * 4;
+	faces.resize(6 * faceBytes);
+	for (int face = 0; face < 6; face++) {
+		unsigned char *out = &faces[face * faceBytes];
+		pool.submit([&src, size, face, out] {
+			for (int t = 0; t < size; t++) {
+				for (int s = 0; s < size; s++) {
+					Eigen::Vector3f d = face_direction(face, 2.0f * (s + 0.5f) / size - 1.0f, 2.0f * (t + 0.5f) / size - 1.0f).normalized();
+					// the uv of the point in direction d on the old background sphere,
+					// v from the bottom pole and u around y starting at -x
+					float v = std::acos(std::min(std::max(-d[1], -1.0f), 1.0f)) / M_PI;
+					float u = std::atan2(-d[2], -d[0]) / (2 * M_PI);
+					if (u < 0) {
+						u += 1.0f;
+					}
+					Eigen::Vector4f c = sample(src, u, v);
+					for (int k = 0; k < 4; k++) {
+						out[4 * (t * size + s) + k] = (unsigned char) std::min(c[k] + 0.5f, 255.0f);
+					}
+				}
+			}
+		});
+	}
+	pool.wait();
+}
+
+bool read_skybox_cache(
+	const unsigned char *data,
+	size_t fileSize,
+	uint64_t sourceHash,
+	int &size,
+	const unsigned char *&faces
+) {
+	if (fileSize < sizeof(SkyboxCacheHeader)) {
+		return false;
+	}
+	SkyboxCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != SKYBOX_CACHE_MAGIC ||
+		header.version != SKYBOX_CACHE_VERSION ||
+		header.sourceHash != sourceHash) {
+		return false;
+	}
+	if (header.faceOffset + 6 * (uint64_t) header.faceSize * header.faceSize * 4 > fileSize) {
+		return false;
+	}
+	size = header.faceSize;
+	faces = data + header.faceOffset;
+	return true;
+}
+
+void encode_skybox_cache(
+	uint64_t sourceHash,
+	int size,
+	const std::vector<unsigned char> &faces,
+	std::vector<unsigned char> &bytes
+) {
+	SkyboxCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = SKYBOX_CACHE_MAGIC;
+	header.version = SKYBOX_CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	header.faceSize = size;
+	header.faceOffset = (sizeof(header) + 15) & ~15u;
+
+	bytes.assign(header.faceOffset + faces.size(), 0);
+	memcpy(&bytes[0], &header, sizeof(header));
+	memcpy(&bytes[header.faceOffset], faces.data(), faces.size());
+}
+
+bool write_skybox_cache(
+	const std::string &fname,
+	uint64_t sourceHash,
+	int size,
+	const std::vector<unsigned char> &faces
+) {
+	std::vector<unsigned char> bytes;
+	encode_skybox_cache(sourceHash, size, faces, bytes);
+	return write_file(fname, bytes);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "image.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+// Universe background, the size of each face
+#define SKYBOX_SIZE 1024
+
+// Binary cache of the six faces of a cube map, RGBA8 texels in the order of
+// the GL cube map targets (+x, -x, +y, -y, +z, -z), starting 16 bytes aligned
+#define SKYBOX_CACHE_MAGIC 0x45425543 // "CUBE"
+#define SKYBOX_CACHE_VERSION 1
+
+struct SkyboxCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash; // hash of the equirectangular image
+	uint32_t faceSize; // width and height of each face
+	uint32_t faceOffset; // byte offset of the first face
+	uint32_t reserved[6];
+};
+
+// Resample an equirectangular image (mapped like the planet spheres) into
+// six faces of size x size texels, one face per task on the pool
+void equirect_to_cube(
+	const Image &src,
+	int size,
+	std::vector<unsigned char> &faces,
+	ThreadPool &pool
+);
+
+// Validate a mapped cache, or a packed copy of one, against the source hash
+// and point faces into it
+bool read_skybox_cache(
+	const unsigned char *data,
+	size_t fileSize,
+	uint64_t sourceHash,
+	int &size,
+	const unsigned char *&faces
+);
+
+// Lay the six faces out as a cache file in memory
+void encode_skybox_cache(
+	uint64_t sourceHash,
+	int size,
+	const std::vector<unsigned char> &faces,
+	std::vector<unsigned char> &bytes
+);
+
+// Write the six faces into a cache file
+bool write_skybox_cache(
+	const std::string &fname,
+	uint64_t sourceHash,
+	int size,
+	const std::vector<unsigned char> &faces
+);
@@ -0,0 +1,447 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "sphere_mesh.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+bool load_sphere_off(const std::string &filename, Eigen::MatrixXf &V, Eigen::MatrixXi &F) {
+	std::ifstream in(filename);
+	std::string token;
+	int nv, nf, ne;
+	if (!(in >> token >> nv >> nf >> ne) || token != "OFF" || nv <= 0 || nf <= 0) {
+		return false;
+	}
+	V.resize(3, nv);
+	F.resize(3, nf);
+	// get all the vertices
+	for (int i = 0; i < nv; ++i) {
+		in >> V(0, i) >> V(1, i) >> V(2, i);
+	}
+	// get all the faces, triangles only
+	int s;
+	for (int i = 0; i < nf; ++i) {
+		in >> s >> F(0, i) >> F(1, i) >> F(2, i);
+		if (!in || s != 3 || F.col(i).minCoeff() < 0 || F.col(i).maxCoeff() >= nv) {
+			return false;
+		}
+	}
+	return true;
+}
+
+double find_radius_center(const MeshData &m, Eigen::Vector3f &c) {
+	if (m.V.cols() == 0) {
+		return 0; // error
+	}
+	// the middle of the bounding box and half its largest side
+	Eigen::Vector3f lo = m.V.rowwise().minCoeff();
+	Eigen::Vector3f hi = m.V.rowwise().maxCoeff();
+	c = (lo + hi) / 2;
+	return (hi - lo).maxCoeff() / 2;
+}
+
+// key of a welded vertex, compared bit by bit
+// so corners duplicated on the texture seam stay apart
+struct WeldKey {
+	float k[5];
+
+	bool operator==(const WeldKey &other) const {
+		return memcmp(k, other.k, sizeof(k)) == 0;
+	}
+};
+
+struct WeldKeyHash {
+	size_t operator()(const WeldKey &key) const {
+		// FNV-1a over the raw bytes
+		const unsigned char *bytes = reinterpret_cast<const unsigned char *>(key.k);
+		size_t h = 2166136261u;
+		for (size_t i = 0; i < sizeof(key.k); i++) {
+			h = (h ^ bytes[i]) * 16777619u;
+		}
+		return h;
+	}
+};
+
+void weld_vertices(MeshData *m) {
+	assert(m->V.cols() == m->T.cols() && m->V.cols() == m->N.cols());
+	int corners = m->V.cols();
+	std::unordered_map<WeldKey, int, WeldKeyHash> lookup;
+	lookup.reserve(corners);
+	Eigen::MatrixXf V(3, corners), N(3, corners), T(2, corners);
+	m->F.resize(3, corners / 3);
+	int count = 0;
+	for (int i = 0; i < corners; i++) {
+		WeldKey key = {{m->V(0, i), m->V(1, i), m->V(2, i), m->T(0, i), m->T(1, i)}};
+		auto found = lookup.find(key);
+		if (found == lookup.end()) {
+			V.col(count) = m->V.col(i);
+			N.col(count) = m->N.col(i);
+			T.col(count) = m->T.col(i);
+			found = lookup.insert(std::make_pair(key, count++)).first;
+		}
+		m->F(i % 3, i / 3) = found->second;
+	}
+	m->V = V.leftCols(count);
+	m->N = N.leftCols(count);
+	m->T = T.leftCols(count);
+}
+
+// Tom Forsyth's linear-speed vertex cache optimisation
+// https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+static const int VERTEX_CACHE_SIZE = 32;
+
+static float vertex_cache_score(int cachePosition, int liveTriangles) {
+	if (liveTriangles == 0) {
+		return -1.0f; // no triangle needs this vertex anymore
+	}
+	float score = 0.0f;
+	if (cachePosition >= 0) {
+		if (cachePosition < 3) {
+			// the last triangle used it, keep a fixed score
+			// so the same triangle is not picked twice
+			score = 0.75f;
+		} else {
+			float scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+			score = pow(1.0f - (cachePosition - 3) * scaler, 1.5f);
+		}
+	}
+	// favour vertices with few triangles left to get rid of them
+	score += 2.0f * pow((float) liveTriangles, -0.5f);
+	return score;
+}
+
+void optimize_vertex_cache(Eigen::MatrixXi &F, int vertexCount) {
+	int faceCount = F.cols();
+	if (faceCount == 0) {
+		return;
+	}
+	// triangles using each vertex, stored as one flat list
+	std::vector<int> live(vertexCount, 0);
+	for (int i = 0; i < F.size(); i++) {
+		live[F.data()[i]]++;
+	}
+	std::vector<int> offset(vertexCount + 1, 0);
+	for (int v = 0; v < vertexCount; v++) {
+		offset[v + 1] = offset[v] + live[v];
+	}
+	std::vector<int> adjacency(F.size());
+	std::vector<int> fill(offset.begin(), offset.end() - 1);
+	for (int f = 0; f < faceCount; f++) {
+		for (int k = 0; k < 3; k++) {
+			adjacency[fill[F(k, f)]++] = f;
+		}
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	std::vector<float> faceScore(faceCount, 0.0f);
+	std::vector<bool> emitted(faceCount, false);
+	for (int v = 0; v < vertexCount; v++) {
+		vertexScore[v] = vertex_cache_score(-1, live[v]);
+	}
+	for (int f = 0; f < faceCount; f++) {
+		faceScore[f] = vertexScore[F(0, f)] + vertexScore[F(1, f)] + vertexScore[F(2, f)];
+	}
+
+	Eigen::MatrixXi out(3, faceCount);
+	std::vector<int> cache, next;
+	cache.reserve(VERTEX_CACHE_SIZE + 3);
+	next.reserve(VERTEX_CACHE_SIZE + 3);
+	int best = -1;
+	for (int n = 0; n < faceCount; n++) {
+		if (best < 0) {
+			// nothing in the cache touches a live triangle, scan them all
+			float bestScore = -1.0f;
+			for (int f = 0; f < faceCount; f++) {
+				if (!emitted[f] && faceScore[f] > bestScore) {
+					bestScore = faceScore[f];
+					best = f;
+				}
+			}
+		}
+		// emit the triangle
+		out.col(n) = F.col(best);
+		emitted[best] = true;
+		// drop it from the adjacency of its vertices
+		for (int k = 0; k < 3; k++) {
+			int v = F(k, best);
+			int *first = &adjacency[offset[v]];
+			int *last = first + live[v] - 1;
+			for (int *it = first; it <= last; it++) {
+				if (*it == best) {
+					std::swap(*it, *last);
+					break;
+				}
+			}
+			live[v]--;
+		}
+		// push its vertices to the front of the cache
+		next.clear();
+		for (int k = 0; k < 3; k++) {
+			next.push_back(F(k, best));
+		}
+		for (int v : cache) {
+			if (v != next[0] && v != next[1] && v != next[2]) {
+				next.push_back(v);
+			}
+		}
+		// rescore the cached and evicted vertices
+		for (int i = 0; i < (int) next.size(); i++) {
+			int v = next[i];
+			cachePosition[v] = i < VERTEX_CACHE_SIZE ? i : -1;
+			vertexScore[v] = vertex_cache_score(cachePosition[v], live[v]);
+		}
+		// rescore the live triangles around them and pick the best
+		best = -1;
+		float bestScore = -1.0f;
+		for (int v : next) {
+			for (int i = offset[v]; i < offset[v] + live[v]; i++) {
+				int f = adjacency[i];
+				faceScore[f] = vertexScore[F(0, f)] + vertexScore[F(1, f)] + vertexScore[F(2, f)];
+				if (faceScore[f] > bestScore) {
+					bestScore = faceScore[f];
+					best = f;
+				}
+			}
+		}
+		if (next.size() > VERTEX_CACHE_SIZE) {
+			next.resize(VERTEX_CACHE_SIZE);
+		}
+		cache.swap(next);
+	}
+	F = out;
+}
+
+void optimize_vertex_fetch(MeshData *m) {
+	// number the vertices in the order the triangles reach them
+	std::vector<int> remap(m->V.cols(), -1);
+	int count = 0;
+	for (int i = 0; i < m->F.size(); i++) {
+		int &v = m->F.data()[i];
+		if (remap[v] < 0) {
+			remap[v] = count++;
+		}
+		v = remap[v];
+	}
+	Eigen::MatrixXf V(3, count), N(3, count), T(2, count);
+	for (int v = 0; v < (int) remap.size(); v++) {
+		if (remap[v] >= 0) {
+			V.col(remap[v]) = m->V.col(v);
+			N.col(remap[v]) = m->N.col(v);
+			T.col(remap[v]) = m->T.col(v);
+		}
+	}
+	m->V = V;
+	m->N = N;
+	m->T = T;
+}
+
+bool build_sphere_mesh(const std::string &fname, MeshData *m) {
+	Eigen::MatrixXf vertices;
+	Eigen::MatrixXi faces;
+	if (!load_sphere_off(fname, vertices, faces)) {
+		return false;
+	}
+	// calculate normals
+	Eigen::MatrixXf normals = Eigen::MatrixXf::Zero(3, vertices.cols());
+	for (int i = 0; i < faces.cols(); i++) {
+		// get three vertices
+		Eigen::Vector3f v1 = vertices.col(faces(0, i));
+		Eigen::Vector3f v2 = vertices.col(faces(1, i));
+		Eigen::Vector3f v3 = vertices.col(faces(2, i));
+		// add the surface normal to its corners
+		Eigen::Vector3f n = (v2 - v1).cross(v3 - v1).normalized();
+		normals.block<3, 1>(0, faces(0, i)) += n;
+		normals.block<3, 1>(0, faces(1, i)) += n;
+		normals.block<3, 1>(0, faces(2, i)) += n;
+	}
+	normals.colwise().normalize();
+	// expand the faces into one vertex per corner
+	// so the texture seam can be fixed per triangle
+	m->V.resize(3, 3 * faces.cols());
+	m->N.resize(3, 3 * faces.cols());
+	for (int i = 0; i < faces.cols(); i++) {
+		for (int k = 0; k < 3; k++) {
+			m->V.col(3 * i + k) = vertices.col(faces(k, i));
+			m->N.col(3 * i + k) = normals.col(faces(k, i));
+		}
+	}
+	// scale the sphere to radius 0.5 and move it to the origin, baked into
+	// the positions so the cache needs no transformation
+	Eigen::Vector3f center;
+	float scale = 0.5 / find_radius_center(*m, center);
+	m->V = (m->V.colwise() - center) * scale;
+	// the texture coordinates are the same for every planet
+	generate_texcoord(m);
+	// weld the corners back into an indexed mesh
+	weld_vertices(m);
+	optimize_vertex_cache(m->F, m->V.cols());
+	optimize_vertex_fetch(m);
+	return true;
+}
+
+float sphere_lod_error(int lod) {
+	// the icosahedron edge spans 63.4 degrees and each subdivision halves it;
+	// the centers of the flat triangles sink deepest, an edge / sqrt(3) from
+	// their corners. The midpoints pushed out onto the sphere stretch the
+	// triangles in the middle of each face, they sink up to 1.42 times
+	// deeper (measured on the levels)
+	float edge = 1.10715f / float(1 << sphere_lod_subdivisions(lod));
+	return 1.42f * (1.0f - std::cos(edge / std::sqrt(3.0f)));
+}
+
+static int coarsest_lod(float radiusPixels, float maxError) {
+	for (int lod = 0; lod < SPHERE_LODS; lod++) {
+		if (sphere_lod_error(lod) * radiusPixels <= maxError) {
+			return lod;
+		}
+	}
+	return SPHERE_LODS - 1;
+}
+
+int pick_sphere_lod(float radiusPixels, int current, float maxError, float hysteresis) {
+	int finer = coarsest_lod(radiusPixels, maxError);
+	if (finer >= current) {
+		return finer;
+	}
+	// only drop levels well clear of the threshold, so a body hovering
+	// around it does not switch back and forth
+	return std::min(current, coarsest_lod(radiusPixels, maxError * hysteresis));
+}
+
+uint64_t sphere_lod_hash(int lod) {
+	uint32_t key[2] = { SPHERE_GENERATOR_VERSION, (uint32_t) sphere_lod_subdivisions(lod) };
+	return hash_bytes(key, sizeof(key));
+}
+
+std::string sphere_lod_name(int lod) {
+	char name[32];
+	snprintf(name, sizeof(name), "sphere.lod%d", lod);
+	return name;
+}
+
+// index of the normalized midpoint of an edge, shared by both of its triangles
+static int midpoint(std::vector<Eigen::Vector3f> &points, std::map<std::pair<int, int>, int> &midpoints, int a, int b) {
+	std::pair<int, int> edge(std::min(a, b), std::max(a, b));
+	auto found = midpoints.find(edge);
+	if (found != midpoints.end()) {
+		return found->second;
+	}
+	points.push_back((points[a] + points[b]).normalized());
+	int index = (int) points.size() - 1;
+	midpoints[edge] = index;
+	return index;
+}
+
+// the mapping of the textures: v from the bottom pole up, u around y from -x
+// through -z, +x and +z, as the equirectangular images are laid out
+static Eigen::Vector2f sphere_uv(const Eigen::Vector3f &n) {
+	float u = std::atan2(-n[2], -n[0]) / (2.0f * M_PI);
+	if (u < 0.0f) {
+		u += 1.0f;
+	}
+	float v = std::acos(std::min(std::max(-n[1], -1.0f), 1.0f)) / M_PI;
+	return Eigen::Vector2f(u, v);
+}
+
+void generate_texcoord(MeshData *m) {
+	m->T.resize(2, m->V.cols());
+	for (int i = 0; i < m->V.cols(); i++) {
+		// the sphere is already centered at the origin
+		m->T.block<2, 1>(0, i) = sphere_uv(m->V.col(i).normalized());
+	}
+	// a triangle across the seam takes its corners left of it past u = 1,
+	// like the generated levels
+	for (int i = 0; i + 2 < m->V.cols(); i += 3) {
+		float lo = m->T.block<1, 3>(0, i).minCoeff();
+		float hi = m->T.block<1, 3>(0, i).maxCoeff();
+		if (hi - lo > 0.5f) {
+			for (int k = i; k < i + 3; k++) {
+				if (m->T(0, k) < 0.5f) {
+					m->T(0, k) += 1.0f;
+				}
+			}
+		}
+	}
+}
+
+void build_icosphere(int subdivisions, MeshData *m) {
+	// the icosahedron, counter-clockwise seen from outside
+	const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+	std::vector<Eigen::Vector3f> points = {
+		Eigen::Vector3f(-1, t, 0), Eigen::Vector3f(1, t, 0), Eigen::Vector3f(-1, -t, 0), Eigen::Vector3f(1, -t, 0),
+		Eigen::Vector3f(0, -1, t), Eigen::Vector3f(0, 1, t), Eigen::Vector3f(0, -1, -t), Eigen::Vector3f(0, 1, -t),
+		Eigen::Vector3f(t, 0, -1), Eigen::Vector3f(t, 0, 1), Eigen::Vector3f(-t, 0, -1), Eigen::Vector3f(-t, 0, 1),
+	};
+	for (Eigen::Vector3f &p : points) {
+		p.normalize();
+	}
+	std::vector<int> triangles = {
+		0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11,
+		1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+		3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9,
+		4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1,
+	};
+	// split every triangle in four, the new corners pushed onto the sphere
+	for (int level = 0; level < subdivisions; level++) {
+		std::map<std::pair<int, int>, int> midpoints;
+		std::vector<int> next;
+		next.reserve(4 * triangles.size());
+		for (size_t i = 0; i < triangles.size(); i += 3) {
+			int a = triangles[i], b = triangles[i + 1], c = triangles[i + 2];
+			int ab = midpoint(points, midpoints, a, b);
+			int bc = midpoint(points, midpoints, b, c);
+			int ca = midpoint(points, midpoints, c, a);
+			int split[12] = { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca };
+			next.insert(next.end(), split, split + 12);
+		}
+		triangles.swap(next);
+	}
+
+	// one vertex per corner first, so the seam can be fixed per triangle
+	int corners = (int) triangles.size();
+	m->V.resize(3, corners);
+	m->N.resize(3, corners);
+	m->T.resize(2, corners);
+	for (int i = 0; i < corners; i += 3) {
+		Eigen::Vector2f uv[3];
+		for (int k = 0; k < 3; k++) {
+			uv[k] = sphere_uv(points[triangles[i + k]]);
+		}
+		// a triangle across the seam takes its corners left of it past u = 1,
+		// the textures repeat horizontally
+		float lo = std::min(std::min(uv[0][0], uv[1][0]), uv[2][0]);
+		float hi = std::max(std::max(uv[0][0], uv[1][0]), uv[2][0]);
+		if (hi - lo > 0.5f) {
+			for (int k = 0; k < 3; k++) {
+				if (uv[k][0] < 0.5f) {
+					uv[k][0] += 1.0f;
+				}
+			}
+		}
+		// u means nothing at a pole, the corner takes the middle of the other two
+		for (int k = 0; k < 3; k++) {
+			const Eigen::Vector3f &p = points[triangles[i + k]];
+			if (p[0] * p[0] + p[2] * p[2] < 1e-10f) {
+				uv[k][0] = 0.5f * (uv[(k + 1) % 3][0] + uv[(k + 2) % 3][0]);
+			}
+		}
+		for (int k = 0; k < 3; k++) {
+			// the normal of a sphere is its direction from the center
+			const Eigen::Vector3f &n = points[triangles[i + k]];
+			m->V.block<3, 1>(0, i + k) = 0.5f * n;
+			m->N.block<3, 1>(0, i + k) = n;
+			m->T.block<2, 1>(0, i + k) = uv[k];
+		}
+	}
+	weld_vertices(m);
+	optimize_vertex_cache(m->F, m->V.cols());
+	optimize_vertex_fetch(m);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <string>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+// Levels of the sphere chain, the first with 80 triangles and each next one
+// with four times as many, up to 81920
+#define SPHERE_LODS 6
+// subdivisions of the icosahedron for the first level
+#define SPHERE_LOD_FIRST_SUBDIVISION 1
+// the bundled sphere under the data folder, and its name in the asset pack
+#define SPHERE_OFF_NAME "sphere.off"
+// where the sphere of a body comes from: the chain, its level picked from
+// the size on screen, or the bundled sphere at every size
+#define SPHERE_SOURCE_CHAIN 0
+#define SPHERE_SOURCE_OFF 1
+// changes whenever the generator does, the cached levels are keyed on it
+#define SPHERE_GENERATOR_VERSION 1
+
+// CPU side mesh arrays, only kept while a geometry is being built
+struct MeshData {
+	Eigen::MatrixXf V; // vertices
+	Eigen::MatrixXf T; // store the texture uv coordinates
+	Eigen::MatrixXf N; // store vertex normals
+	Eigen::MatrixXi F; // triangle indices into V, T and N
+};
+
+// read an .off file of triangles, false if it is missing, malformed or
+// indexes past its vertices
+bool load_sphere_off(const std::string &filename, Eigen::MatrixXf &V, Eigen::MatrixXi &F);
+// return the radius and set the center
+double find_radius_center(const MeshData &m, Eigen::Vector3f &c);
+// build the indexed sphere of radius 0.5 at the origin from an .off file,
+// false if the file cannot be read
+bool build_sphere_mesh(const std::string &fname, MeshData *m);
+// generate texture coordinates
+void generate_texcoord(MeshData *m);
+// merge the corners sharing both position and uv into indexed vertices
+void weld_vertices(MeshData *m);
+// reorder triangles for the post-transform vertex cache
+void optimize_vertex_cache(Eigen::MatrixXi &F, int vertexCount);
+// reorder vertices in the order the triangles first use them
+void optimize_vertex_fetch(MeshData *m);
+
+// subdivisions of the icosahedron for a level of the chain
+inline int sphere_lod_subdivisions(int lod) {
+	return SPHERE_LOD_FIRST_SUBDIVISION + lod;
+}
+// triangles of a level of the chain
+inline int sphere_lod_triangles(int lod) {
+	return 20 << (2 * sphere_lod_subdivisions(lod));
+}
+// largest distance between a level and the true sphere, a fraction of the radius
+float sphere_lod_error(int lod);
+// coarsest level whose silhouette strays at most maxError pixels from a
+// sphere radiusPixels wide, staying at current unless a coarser level
+// would stray less than hysteresis * maxError; finest if none is enough
+int pick_sphere_lod(float radiusPixels, int current, float maxError, float hysteresis);
+// key of a level in the caches, from the generator and its parameters
+uint64_t sphere_lod_hash(int lod);
+// name of a level in the caches and the asset pack, "sphere.lod<n>"
+std::string sphere_lod_name(int lod);
+// build an indexed icosphere of radius 0.5 at the origin, subdividing each
+// triangle of an icosahedron in four that many times; the normals are
+// exact and the triangles across the texture seam get their own vertices
+void build_icosphere(int subdivisions, MeshData *m);
@@ -0,0 +1,413 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "texture_loader.h"
+#include "mipmap.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+////////////////////////////////////////////////////////////////////////////////
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// block rows encoded by one task, small enough to spread a single texture
+// over every worker
+#define ENCODE_BAND_ROWS 16
+
+static double elapsed_ms(const Clock::time_point &start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static std::string base_name(const std::string &fname) {
+	return fname.substr(fname.find_last_of("/\\") + 1);
+}
+
+// internal format of the texture array
+static GLenum gl_format(int format) {
+	switch (format) {
+		case TEXTURE_FORMAT_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case TEXTURE_FORMAT_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		default: return GL_RGBA8;
+	}
+}
+
+// average of the texels of src each placeholder texel covers
+static void shrink_placeholder(const Image &src, std::vector<unsigned char> &dst) {
+	dst.resize(4 * PLACEHOLDER_WIDTH * PLACEHOLDER_HEIGHT);
+	for (int y = 0; y < PLACEHOLDER_HEIGHT; y++) {
+		int y0 = y * src.height / PLACEHOLDER_HEIGHT, y1 = std::max((y + 1) * src.height / PLACEHOLDER_HEIGHT, y0 + 1);
+		for (int x = 0; x < PLACEHOLDER_WIDTH; x++) {
+			int x0 = x * src.width / PLACEHOLDER_WIDTH, x1 = std::max((x + 1) * src.width / PLACEHOLDER_WIDTH, x0 + 1);
+			unsigned int sum[4] = { 0, 0, 0, 0 };
+			for (int v = y0; v < y1; v++) {
+				const unsigned char *p = src.row(v) + 4 * x0;
+				for (int u = x0; u < x1; u++, p += 4) {
+					for (int n = 0; n < 4; n++) {
+						sum[n] += p[n];
+					}
+				}
+			}
+			unsigned int count = (x1 - x0) * (y1 - y0);
+			for (int n = 0; n < 4; n++) {
+				dst[4 * (y * PLACEHOLDER_WIDTH + x) + n] = (unsigned char) ((sum[n] + count / 2) / count);
+			}
+		}
+	}
+}
+
+void TextureLoader::init(GLuint a, GLuint p, int w, int h, int l, int f, const std::string &dir, const AssetPack *assets) {
+	array = a;
+	placeholders = p;
+	width = w;
+	height = h;
+	levels = std::min(std::max(l, 1), mip_levels(w, h));
+	format = f;
+	cacheDir = dir;
+	pack = assets;
+	started = Clock::now();
+}
+
+int TextureLoader::request(const std::string &dataDir, const std::string &name) {
+	if (pool == NULL) {
+		pool = new ThreadPool();
+	}
+	Job *job = new Job();
+	int layer = layers++;
+	job->layer = layer;
+	job->fname = dataDir + name;
+	job->name = name;
+	pool->submit([this, job] {
+		job->start = Clock::now();
+		if (load(job)) {
+			complete(job);
+		}
+	});
+	return layer;
+}
+
+void TextureLoader::complete(Job *job) {
+	job->decodeMs = elapsed_ms(job->start);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done.push_back(job);
+	}
+	decoded.notify_one();
+}
+
+bool TextureLoader::load(Job *job) {
+	// a packed chain needs neither the image file nor the cache
+	const AssetPackEntry *entry = pack != NULL ? pack->find(job->name) : NULL;
+	if (entry != NULL && entry->format == ASSET_MIPS &&
+		read_mip_cache(pack->data(*entry), entry->size, entry->sourceHash, format, width, height, levels, job->chain)) {
+		job->loaded = job->cached = job->packed = true;
+		return true;
+	}
+
+	// the cache is keyed by the image file, read anyway to hash it
+	MappedFile source;
+	job->loaded = source.open(job->fname);
+	if (!job->loaded) {
+		return true;
+	}
+	job->hash = hash_bytes(source.data, source.size);
+	job->cacheName = cacheDir + base_name(job->fname) + "." + texture_format_name(format) + ".mips";
+	job->cached = job->cache.open(job->cacheName) &&
+		read_mip_cache(job->cache.data, job->cache.size, job->hash, format, width, height, levels, job->chain);
+	if (job->cached) {
+		return true;
+	}
+	job->cache.close();
+
+	Image image;
+	job->loaded = load_image(job->fname, image);
+	if (!job->loaded) {
+		return true;
+	}
+	// something to show while the chain is built
+	Job *preview = new Job();
+	preview->layer = job->layer;
+	preview->placeholder = true;
+	preview->fname = job->fname;
+	preview->loaded = true;
+	preview->start = job->start;
+	shrink_placeholder(image, preview->built);
+	preview->chain = preview->built.data();
+	complete(preview);
+
+	// every layer of the array has the same size
+	if (image.width != width || image.height != height) {
+		Image resized;
+		resample_image(image, resized, width, height);
+		image.swap(resized);
+	}
+	// the cache always holds the full chain, whatever is uploaded
+	int full = mip_levels(width, height);
+	if (format == TEXTURE_FORMAT_RGBA8) {
+		build_mip_chain(image, full, job->built);
+		job->chain = job->built.data();
+		store(job, full);
+		return true;
+	}
+	build_mip_chain(image, full, job->rgba);
+	image.release();
+	encode(job, full);
+	return false;
+}
+
+void TextureLoader::encode(Job *job, int chainLevels) {
+	job->built.resize(mip_chain_bytes(width, height, chainLevels, format));
+	job->chain = job->built.data();
+	int bands = 0;
+	for (int l = 0; l < chainLevels; l++) {
+		bands += (mip_size(height, l) + 4 * ENCODE_BAND_ROWS - 1) / (4 * ENCODE_BAND_ROWS);
+	}
+	job->bands = bands;
+	// any worker takes the next band, the last one to finish hands the job over
+	for (int l = 0; l < chainLevels; l++) {
+		int w = mip_size(width, l), h = mip_size(height, l);
+		const unsigned char *src = job->rgba.data() + mip_chain_bytes(width, height, l);
+		unsigned char *dst = job->built.data() + mip_chain_bytes(width, height, l, format);
+		int rows = (h + 3) / 4;
+		for (int first = 0; first < rows; first += ENCODE_BAND_ROWS) {
+			int last = std::min(first + ENCODE_BAND_ROWS, rows);
+			pool->submit([this, job, chainLevels, src, dst, w, h, first, last] {
+				compress_blocks(format, src, w, h, first, last, dst);
+				if (--job->bands == 0) {
+					std::vector<unsigned char>().swap(job->rgba);
+					store(job, chainLevels);
+					complete(job);
+				}
+			});
+		}
+	}
+}
+
+void TextureLoader::store(Job *job, int chainLevels) {
+	if (!write_mip_cache(job->cacheName, job->hash, format, width, height, chainLevels, job->built)) {
+		fprintf(stderr, "Failed to write mip chain cache %s\n", job->cacheName.c_str());
+	}
+}
+
+void TextureLoader::start(GLFWwindow *shared) {
+	// allocate every level of every layer before the first upload
+	glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+	for (int l = 0; l < levels; l++) {
+		int w = mip_size(width, l), h = mip_size(height, l);
+		if (format == TEXTURE_FORMAT_RGBA8) {
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, l, GL_RGBA8, w, h, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		} else {
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, l, gl_format(format), w, h, layers, 0,
+				GLsizei(layers * texture_level_bytes(format, w, h)), NULL);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	// longitude wraps around, the seam triangles reach past u = 1
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// trilinear, between the two levels closest to the footprint of a pixel
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, placeholders);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, PLACEHOLDER_WIDTH, PLACEHOLDER_HEIGHT, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	states.assign(layers, LAYER_EMPTY);
+	remaining = layers;
+	failed = false;
+	nextBuffer = 0;
+	context = shared;
+	if (context != NULL) {
+		// the storage must exist before the other context writes into it
+		glFlush();
+		stopping = false;
+		thread = std::thread(&TextureLoader::run, this);
+	} else {
+		glGenBuffers(UPLOAD_BUFFERS, buffers);
+	}
+}
+
+void TextureLoader::run() {
+	glfwMakeContextCurrent(context);
+	glGenBuffers(UPLOAD_BUFFERS, buffers);
+	while (true) {
+		Job *job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			decoded.wait(lock, [this] { return stopping || !done.empty(); });
+			if (done.empty()) {
+				break;
+			}
+			job = done.front();
+			done.pop_front();
+		}
+		Upload upload = this->upload(*job);
+		delete job;
+		std::lock_guard<std::mutex> lock(mutex);
+		uploaded.push_back(upload);
+	}
+	glDeleteBuffers(UPLOAD_BUFFERS, buffers);
+	glfwMakeContextCurrent(NULL);
+}
+
+void TextureLoader::poll() {
+	if (states.empty()) {
+		return;
+	}
+	if (context == NULL) {
+		// no upload thread, one upload a frame
+		Job *job = NULL;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!done.empty()) {
+				job = done.front();
+				done.pop_front();
+			}
+		}
+		if (job != NULL) {
+			inflight.push_back(upload(*job));
+			delete job;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		inflight.insert(inflight.end(), uploaded.begin(), uploaded.end());
+		uploaded.clear();
+	}
+	for (size_t i = 0; i < inflight.size(); ) {
+		Upload &u = inflight[i];
+		// a zero timeout only asks, the frame goes on if it is not done
+		if (u.fence != 0) {
+			GLenum status = glClientWaitSync(u.fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+				i++;
+				continue;
+			}
+			glDeleteSync(u.fence);
+		}
+		if (!u.loaded) {
+			fprintf(stderr, "Failed to load texture image %s!\n", u.name.c_str());
+			failed = true;
+			remaining--;
+		} else if (u.placeholder) {
+			states[u.layer] = std::max(states[u.layer], LAYER_PLACEHOLDER);
+		} else {
+			states[u.layer] = LAYER_RESIDENT;
+			remaining--;
+			printf("%s\n", u.report.c_str());
+		}
+		if (remaining == 0 && !u.placeholder && !failed) {
+			printf("All textures resident %.1f ms after the first request\n", elapsed_ms(started));
+		}
+		inflight.erase(inflight.begin() + i);
+	}
+}
+
+bool TextureLoader::wait() {
+	while (remaining > 0) {
+		poll();
+		if (remaining > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	return !failed;
+}
+
+void TextureLoader::stop() {
+	// the workers may still hand jobs over
+	delete pool;
+	pool = NULL;
+	if (thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		decoded.notify_all();
+		thread.join();
+	} else if (context == NULL && !states.empty()) {
+		glDeleteBuffers(UPLOAD_BUFFERS, buffers);
+	}
+	for (Job *job : done) {
+		delete job;
+	}
+	done.clear();
+	inflight.insert(inflight.end(), uploaded.begin(), uploaded.end());
+	uploaded.clear();
+	for (Upload &u : inflight) {
+		if (u.fence != 0) {
+			glDeleteSync(u.fence);
+		}
+	}
+	inflight.clear();
+	states.clear();
+}
+
+size_t TextureLoader::bytes() const {
+	return layers * mip_chain_bytes(width, height, levels, format);
+}
+
+TextureLoader::Upload TextureLoader::upload(const Job &job) {
+	Upload u;
+	u.layer = job.layer;
+	u.placeholder = job.placeholder;
+	u.loaded = job.loaded;
+	u.fence = 0;
+	u.name = base_name(job.fname);
+	if (!job.loaded) {
+		return u;
+	}
+	Clock::time_point start = Clock::now();
+	size_t bytes = job.placeholder ? job.built.size() : mip_chain_bytes(width, height, levels, format);
+
+	// a fresh store for the buffer, the previous upload from it may still be reading
+	GLuint buffer = buffers[nextBuffer];
+	nextBuffer = (nextBuffer + 1) % UPLOAD_BUFFERS;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+	void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (mapped == NULL) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		u.loaded = false;
+		return u;
+	}
+	memcpy(mapped, job.chain, bytes);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	// the pointers are offsets into the buffer
+	if (job.placeholder) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, placeholders);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, job.layer, PLACEHOLDER_WIDTH, PLACEHOLDER_HEIGHT, 1,
+			GL_RGBA, GL_UNSIGNED_BYTE, (const GLvoid *) 0);
+	} else {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+		for (int l = 0; l < levels; l++) {
+			int w = mip_size(width, l), h = mip_size(height, l);
+			const GLvoid *offset = (const GLvoid *) mip_chain_bytes(width, height, l, format);
+			if (format == TEXTURE_FORMAT_RGBA8) {
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, job.layer, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, offset);
+			} else {
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, job.layer, w, h, 1, gl_format(format),
+					GLsizei(texture_level_bytes(format, w, h)), offset);
+			}
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	u.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	// the fence has to reach the GPU before another context can see it signal
+	glFlush();
+
+	char report[256];
+	snprintf(report, sizeof(report), "%s: layer %d %s in %.1f ms, %d %s levels queued in %.1f ms",
+		u.name.c_str(), job.layer, job.packed ? "mapped from pack" : job.cached ? "mapped from cache" : "built",
+		job.decodeMs, levels, texture_format_name(format), elapsed_ms(start));
+	u.report = report;
+	return u;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "asset_pack.h"
+#include "image.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include <glad/glad.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+struct GLFWwindow;
+
+// Size of the low resolution placeholder of each layer
+#define PLACEHOLDER_WIDTH 64
+#define PLACEHOLDER_HEIGHT 32
+
+// Pixel unpack buffers the uploads cycle through
+#define UPLOAD_BUFFERS 2
+
+// What a layer of the texture array holds so far
+#define LAYER_EMPTY 0
+#define LAYER_PLACEHOLDER 1 // only its layer of the placeholder array
+#define LAYER_RESIDENT 2
+
+// Decodes texture images, builds their mip chains and encodes them to blocks
+// on a worker pool into the layers of one texture array; the chains are
+// cached next to each other, keyed by the image file and the format.
+// Chains found in the asset pack skip all of it and upload from the mapping.
+// An upload thread on a shared context streams them through pixel buffers,
+// the render thread only polls their fences and never waits on them
+class TextureLoader {
+public:
+	TextureLoader()
+		: pool(NULL), array(0), placeholders(0), width(0), height(0), levels(1), format(0), layers(0), pack(NULL),
+		context(NULL), stopping(false), remaining(0), failed(false) { }
+	~TextureLoader() { stop(); }
+
+	// Set the texture array, the array of placeholders, the size every image
+	// is resampled to, the number of mip levels, the TEXTURE_FORMAT_* of the
+	// array, the directory of the mip chain caches and the pack to look the
+	// chains up in first, if any
+	void init(GLuint array, GLuint placeholders, int width, int height, int levels, int format,
+		const std::string &cacheDir, const AssetPack *pack = NULL);
+
+	// Queue the image dataDir + name, name is also its entry in the pack;
+	// returns its layer in the array
+	int request(const std::string &dataDir, const std::string &name);
+
+	// Allocate the arrays once every layer is requested and start uploading
+	// on a thread current on context, a window sharing the objects of the
+	// render context; without one the uploads happen in poll(), one a call
+	void start(GLFWwindow *context);
+
+	// Swap in the layers whose uploads completed, never blocks
+	void poll();
+
+	// Poll until every layer is resident, false if any of them failed to load
+	bool wait();
+
+	// Finish the queued work and stop the upload thread, before the
+	// contexts are destroyed
+	void stop();
+
+	// LAYER_* of a layer, as of the last poll()
+	int layer_state(int layer) const { return states[layer]; }
+
+	// Mip levels of each layer
+	int level_count() const { return levels; }
+
+	// TEXTURE_FORMAT_* of the array
+	int texel_format() const { return format; }
+
+	// Bytes of every level of every layer
+	size_t bytes() const;
+
+private:
+	// A mip chain or a placeholder waiting for its upload
+	struct Job {
+		int layer;
+		bool placeholder;
+		std::string fname;
+		std::string name; // under the data folder
+		MappedFile cache; // holds the chain on a cache hit
+		std::vector<unsigned char> built; // holds the chain on a miss
+		std::vector<unsigned char> rgba; // the chain before block compression
+		const unsigned char *chain;
+		uint64_t hash;
+		std::string cacheName;
+		std::atomic<int> bands; // block rows still being encoded
+		bool loaded;
+		bool cached;
+		bool packed;
+		std::chrono::high_resolution_clock::time_point start;
+		double decodeMs;
+	};
+
+	// An upload the GPU may still be working on
+	struct Upload {
+		int layer;
+		bool placeholder;
+		bool loaded;
+		GLsync fence;
+		std::string name;
+		std::string report;
+	};
+
+	ThreadPool *pool;
+	std::mutex mutex;
+	std::condition_variable decoded;
+	std::deque<Job *> done; // built, waiting for the upload thread
+	std::deque<Upload> uploaded; // submitted, waiting for their fences
+
+	GLuint array;
+	GLuint placeholders;
+	int width;
+	int height;
+	int levels;
+	int format;
+	int layers;
+	std::string cacheDir;
+	const AssetPack *pack;
+
+	GLFWwindow *context;
+	std::thread thread;
+	bool stopping;
+	GLuint buffers[UPLOAD_BUFFERS];
+	int nextBuffer;
+
+	// render thread only
+	std::vector<int> states;
+	std::vector<Upload> inflight;
+	int remaining; // layers not resident yet
+	bool failed;
+	std::chrono::high_resolution_clock::time_point started;
+
+	// Decode or map the chain of a job, false if it went on to be encoded
+	bool load(Job *job);
+	// Encode the levels of a job in bands of block rows on the pool
+	void encode(Job *job, int chainLevels);
+	// Cache a built chain
+	void store(Job *job, int chainLevels);
+	// Hand a job over to the uploads
+	void complete(Job *job);
+
+	// Upload thread
+	void run();
+	// Copy a job into the next pixel buffer and upload it from there
+	Upload upload(const Job &job);
+
+	TextureLoader(const TextureLoader &);
+	TextureLoader &operator=(const TextureLoader &);
+};
@@ -0,0 +1,57 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "thread_pool.h"
+#include <algorithm>
+////////////////////////////////////////////////////////////////////////////////
+
+ThreadPool::ThreadPool(unsigned threads) : busy(0), stopping(false) {
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (unsigned i = 0; i < threads; i++) {
+		workers.push_back(std::thread(&ThreadPool::run, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::submit(const std::function<void()> &task) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(task);
+	}
+	wake.notify_one();
+}
+
+void ThreadPool::wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return tasks.empty() && busy == 0; });
+}
+
+void ThreadPool::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+		if (tasks.empty()) {
+			return; // stopping and nothing left to do
+		}
+		std::function<void()> task = tasks.front();
+		tasks.pop_front();
+		busy++;
+		lock.unlock();
+		task();
+		lock.lock();
+		busy--;
+		if (tasks.empty() && busy == 0) {
+			idle.notify_all();
+		}
+	}
+}
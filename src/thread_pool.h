@@ -0,0 +1,43 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// A fixed set of worker threads running queued tasks
+class ThreadPool {
+public:
+	// Start the workers, 0 means one per hardware thread
+	explicit ThreadPool(unsigned threads = 0);
+
+	// Finish the queued tasks and join the workers
+	~ThreadPool();
+
+	// Queue a task for the workers
+	void submit(const std::function<void()> &task);
+
+	// Block until the queue is empty and no task is running
+	void wait();
+
+	// Number of worker threads
+	unsigned size() const { return (unsigned) workers.size(); }
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()> > tasks;
+	std::mutex mutex;
+	std::condition_variable wake; // signals new tasks or shutdown
+	std::condition_variable idle; // signals the pool ran dry
+	unsigned busy;
+	bool stopping;
+
+	void run();
+
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+};
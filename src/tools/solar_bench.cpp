@@ -0,0 +1,515 @@
+////////////////////////////////////////////////////////////////////////////////
+// Headless benchmarks of the simulation, no window or GL needed
+//
+// usage: solar-bench kepler [--bodies n] [--seconds s]
+//   checks the Kepler solvers and the orbit table against reference values,
+//   then reports how many bodies a second each instruction set evaluates
+//        solar-bench ephemeris [--span s]
+//   fits the Chebyshev tables of the scene, checks them against the closed
+//   form and times a year of lookups against solving it
+//        solar-bench nbody [--particles n] [--steps k] [--threads t]
+//                          [--block-particles n]
+//   checks the Barnes-Hut forces against a direct sum and the leapfrog
+//   against the energy of the bodies, reports how many interactions a
+//   second the steps sum on 1, 2, 4 ... t threads, then counts the forces a
+//   year of block steps evaluates against global steps
+////////////////////////////////////////////////////////////////////////////////
+#include "ephemeris.h"
+#include "ephemeris_table.h"
+#include "kepler.h"
+#include "nbody.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+static const double PI = 3.14159265358979323846;
+
+// the eccentric anomaly by bisection in long double, slow and certain
+static double reference_kepler(double M, double e) {
+	long double lo = -PI - 1.0, hi = PI + 1.0;
+	for (int i = 0; i < 200; i++) {
+		long double mid = 0.5L * (lo + hi);
+		if (mid - e * std::sin(mid) - M < 0.0L) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return (double) (0.5L * (lo + hi));
+}
+
+static double angle_error(double a, double b) {
+	double d = std::fmod(std::fabs(a - b), 2.0 * PI);
+	return std::min(d, 2.0 * PI - d);
+}
+
+static int isas() {
+	return cpu_best_isa() + 1;
+}
+
+// every instruction set against the textbook cases and a dense grid of
+// anomalies and eccentricities up to 0.99
+static bool check_kepler() {
+	struct Case {
+		const char *source;
+		double M, e, E; // degrees
+	};
+	static const Case cases[] = {
+		{ "Meeus, example 30.a", 5.0, 0.1, 5.554589253 },
+		{ "Vallado, example 2-1", 235.4 - 360.0, 0.4, 220.512074767522 - 360.0 },
+	};
+	bool ok = true;
+	for (const Case &c : cases) {
+		double E = solve_kepler(c.M * PI / 180.0, c.e) * 180.0 / PI;
+		bool pass = std::fabs(E - c.E) < 1e-8;
+		printf("  %-22s E = %.9f, expected %.9f %s\n", c.source, E, c.E, pass ? "ok" : "FAILED");
+		ok = ok && pass;
+	}
+
+	std::vector<double> M, e, sinE, cosE, reference;
+	for (int j = 0; j < 100; j++) {
+		for (int i = 0; i < 1000; i++) {
+			M.push_back(-PI + 2.0 * PI * i / 1000.0);
+			e.push_back(j * 0.01);
+			reference.push_back(reference_kepler(M.back(), e.back()));
+		}
+	}
+	sinE.resize(M.size());
+	cosE.resize(M.size());
+	for (int isa = 0; isa < isas(); isa++) {
+		solve_kepler(M.data(), e.data(), (int) M.size(), sinE.data(), cosE.data(), isa);
+		double worst = 0.0;
+		for (size_t i = 0; i < M.size(); i++) {
+			worst = std::max(worst, angle_error(std::atan2(sinE[i], cosE[i]), reference[i]));
+		}
+		bool pass = worst < 1e-12;
+		printf("  %-22s worst error %.2e rad over %d orbits %s\n",
+			cpu_isa_name(isa), worst, (int) M.size(), pass ? "ok" : "FAILED");
+		ok = ok && pass;
+	}
+	return ok;
+}
+
+// the batches against the body by body evaluation, and circular orbits
+// against the cycles they had before the elements
+static bool check_orbits() {
+	const BodyElements *elements = solar_system_elements();
+	bool ok = true;
+	for (int isa = 0; isa < isas(); isa++) {
+		OrbitTable table;
+		table.init(elements, BODY_COUNT, isa);
+		double worst = 0.0;
+		for (double t = 0.0; t < 1e7; t = t * 3.0 + 0.7) {
+			BodyState states[BODY_COUNT];
+			table.evaluate(t, states);
+			for (int b = 0; b < BODY_COUNT; b++) {
+				BodyState s = body_state(elements, b, t);
+				for (int k = 0; k < 3; k++) {
+					worst = std::max(worst, std::fabs(s.position[k] - states[b].position[k]));
+				}
+			}
+		}
+		BodyElements circle = { -1, 10.0, 0, 0, 0, 0, 0, 20.0, 0 };
+		for (int i = 0; i < 100; i++) {
+			double t = i * 0.37, angle = 2.0 * PI * t / 20.0;
+			OrbitTable one;
+			one.init(&circle, 1, isa);
+			BodyState s;
+			one.evaluate(t, &s);
+			worst = std::max(worst, std::fabs(s.position[0] - 10.0 * std::cos(angle)));
+			worst = std::max(worst, std::fabs(s.position[2] + 10.0 * std::sin(angle)));
+		}
+		bool pass = worst < 1e-9;
+		printf("  %-22s orbit table off by %.2e %s\n", cpu_isa_name(isa), worst, pass ? "ok" : "FAILED");
+		ok = ok && pass;
+	}
+	return ok;
+}
+
+// calls per second of f, repeated for about the given seconds
+template <typename F>
+static double rate(double seconds, F f) {
+	f();
+	long calls = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	double elapsed = 0.0;
+	do {
+		f();
+		calls++;
+		elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	} while (elapsed < seconds);
+	return calls / elapsed;
+}
+
+static int bench_kepler(int argc, char **argv) {
+	int bodies = 4096;
+	double seconds = 1.0;
+	for (int i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "--bodies") == 0 && i + 1 < argc) {
+			bodies = std::max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+			seconds = std::max(0.01, atof(argv[++i]));
+		}
+	}
+
+	printf("accuracy\n");
+	bool ok = check_kepler();
+	ok = check_orbits() && ok;
+
+	// asteroid like orbits, the same for every instruction set
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	std::vector<BodyElements> elements(bodies);
+	std::vector<double> M(bodies), e(bodies), sinE(bodies), cosE(bodies);
+	for (int i = 0; i < bodies; i++) {
+		BodyElements &b = elements[i];
+		b.parent = -1;
+		b.semiMajorAxis = 10.0 + 40.0 * unit(random);
+		b.eccentricity = 0.3 * unit(random);
+		b.inclination = 0.3 * unit(random);
+		b.node = 2.0 * PI * unit(random);
+		b.periapsis = 2.0 * PI * unit(random);
+		b.meanAnomaly = 2.0 * PI * unit(random) - PI;
+		b.revolutionCycle = 10.0 + 3000.0 * unit(random);
+		b.rotationCycle = 10.0;
+		M[i] = b.meanAnomaly;
+		e[i] = b.eccentricity;
+	}
+	std::vector<BodyState> states(bodies);
+
+	printf("throughput, %d bodies a call\n", bodies);
+	for (int isa = 0; isa < isas(); isa++) {
+		double solves = rate(seconds, [&] {
+			solve_kepler(M.data(), e.data(), bodies, sinE.data(), cosE.data(), isa);
+		});
+		OrbitTable table;
+		table.init(elements.data(), bodies, isa);
+		double t = 0.0;
+		double evaluations = rate(seconds, [&] {
+			table.evaluate(t, states.data());
+			t += 0.01;
+		});
+		printf("  %-8s solve_kepler %8.1f M bodies/s, orbit table %8.1f M bodies/s\n",
+			cpu_isa_name(isa), solves * bodies / 1e6, evaluations * bodies / 1e6);
+	}
+	return ok ? 0 : 1;
+}
+
+static double elapsed_us(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static int bench_ephemeris(int argc, char **argv) {
+	double span = EPHEMERIS_SPAN;
+	for (int i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "--span") == 0 && i + 1 < argc) {
+			span = std::max(1.0, atof(argv[++i]));
+		}
+	}
+	const BodyElements *elements = solar_system_elements();
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<unsigned char> bytes;
+	encode_ephemeris_cache(elements, BODY_COUNT, 0.0, span, bytes);
+	double fitUs = elapsed_us(start);
+	EphemerisTable table;
+	if (!table.init(bytes.data(), bytes.size(), ephemeris_hash(elements, BODY_COUNT, 0.0, span))) {
+		fprintf(stderr, "The table does not read back\n");
+		return 1;
+	}
+	printf("%d bodies over %.0f s fit in %.1f ms, %.1f KB\n", BODY_COUNT, span, fitUs / 1000.0, bytes.size() / 1024.0);
+
+	// off the nodes, where a fit strays the most
+	double worst = 0.0;
+	int worstBody = 0;
+	for (int i = 0; i < 200000; i++) {
+		double t = span * (i + 0.318) / 200000;
+		double p[BODY_COUNT][3];
+		table.positions(t, p);
+		for (int b = 0; b < BODY_COUNT; b++) {
+			BodyState s = body_state(elements, b, t);
+			for (int k = 0; k < 3; k++) {
+				double error = std::fabs(s.position[k] - p[b][k]);
+				if (error > worst) {
+					worst = error;
+					worstBody = b;
+				}
+			}
+		}
+	}
+	bool ok = worst < 1e-6;
+	printf("worst error %.2e scene units, body %d %s\n", worst, worstBody, ok ? "ok" : "FAILED");
+
+	// every frame of a year of the earth at 60 frames a second
+	const int frames = 60 * EARTH_REVOLUTION_CYCLE;
+	double p[BODY_COUNT][3], sum = 0.0, bestTable = 1e30, bestSolve = 1e30;
+	OrbitTable orbits;
+	orbits.init(elements, BODY_COUNT);
+	BodyState states[BODY_COUNT];
+	for (int run = 0; run < 20; run++) {
+		start = std::chrono::high_resolution_clock::now();
+		for (int f = 0; f < frames; f++) {
+			table.positions(f / 60.0, p);
+			sum += p[BODY_EARTH][0];
+		}
+		bestTable = std::min(bestTable, elapsed_us(start));
+		start = std::chrono::high_resolution_clock::now();
+		for (int f = 0; f < frames; f++) {
+			orbits.evaluate(f / 60.0, states);
+			sum += states[BODY_EARTH].position[0];
+		}
+		bestSolve = std::min(bestSolve, elapsed_us(start));
+	}
+	// kept, or the lookups would be optimized away
+	volatile double sink = sum;
+	(void) sink;
+	printf("a year of frames, %d lookups of every body: table %.1f us, Kepler %.1f us\n",
+		frames, bestTable, bestSolve);
+	return ok ? 0 : 1;
+}
+
+// the pull of particles [first, last) at particle i, summed one by one
+static void direct_sum(const NBodySystem &s, int i, int first, int last, double a[3]) {
+	a[0] = a[1] = a[2] = 0.0;
+	for (int j = first; j < last; j++) {
+		if (j == i) {
+			continue;
+		}
+		double dx = s.x[j] - s.x[i], dy = s.y[j] - s.y[i], dz = s.z[j] - s.z[i];
+		double r2 = dx * dx + dy * dy + dz * dz + NBODY_SOFTENING2;
+		double f = s.mass[j] / (r2 * std::sqrt(r2));
+		a[0] += f * dx;
+		a[1] += f * dy;
+		a[2] += f * dz;
+	}
+}
+
+static double norm(const double v[3]) {
+	return std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+// kinetic and potential energy of the massive bodies
+static double energy(const NBodySystem &s) {
+	double e = 0.0;
+	for (int i = 0; i < s.massive; i++) {
+		e += 0.5 * s.mass[i] * (s.vx[i] * s.vx[i] + s.vy[i] * s.vy[i] + s.vz[i] * s.vz[i]);
+		for (int j = 0; j < i; j++) {
+			double dx = s.x[j] - s.x[i], dy = s.y[j] - s.y[i], dz = s.z[j] - s.z[i];
+			e -= s.mass[i] * s.mass[j] / std::sqrt(dx * dx + dy * dy + dz * dz);
+		}
+	}
+	return e;
+}
+
+// worst distance of the bodies and 99th percentile of the particles from
+// where a reference run has them
+static void position_errors(const NBodySystem &s, const NBodySystem &reference, double &bodies, double &particles) {
+	std::vector<double> errors;
+	bodies = 0.0;
+	for (int i = 0; i < s.size(); i++) {
+		double d[3] = { s.x[i] - reference.x[i], s.y[i] - reference.y[i], s.z[i] - reference.z[i] };
+		if (i < s.massive) {
+			bodies = std::max(bodies, norm(d));
+		} else {
+			errors.push_back(norm(d));
+		}
+	}
+	std::sort(errors.begin(), errors.end());
+	particles = errors.empty() ? 0.0 : errors[errors.size() * 99 / 100];
+}
+
+// a year of block steps against global steps of the finest block step any
+// body took and coarser, all against global steps four times finer still.
+// Every evaluation builds the tree, however few bodies it pulls, so the
+// trees and the time count next to the forces, against the coarsest global
+// steps with no more error, give or take a percent
+static void bench_blocks(int particles, unsigned threads) {
+	ThreadPool pool(threads);
+	NBodySystem start;
+	solar_nbody(particles, 0.0, 1, start);
+	const int blocks = 16;
+	const double block = (double) EARTH_REVOLUTION_CYCLE / blocks;
+	NBodySystem blocked = start;
+	int finest = 0;
+	auto begin = std::chrono::high_resolution_clock::now();
+	for (int k = 0; k < blocks; k++) {
+		blocked.block_step(block, &pool);
+		for (int l : blocked.level) {
+			finest = std::max(finest, l);
+		}
+	}
+	double blockedSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+	std::vector<int> levels(NBODY_LEVELS, 0);
+	for (int l : blocked.level) {
+		levels[l]++;
+	}
+	printf("block steps of %.3f s, bodies a level at the end:", block);
+	for (int l = 0; l <= finest; l++) {
+		printf(" %d", levels[l]);
+	}
+	printf("\n");
+
+	double dt = std::ldexp(block, -finest);
+	NBodySystem reference = start;
+	for (int k = 0; k < 4 * blocks << finest; k++) {
+		reference.step(0.25 * dt, &pool);
+	}
+	double bodies, swarm;
+	position_errors(blocked, reference, bodies, swarm);
+	printf("  %-22s %10.0f forces %6.0f trees %7.1f ms a year, error of the bodies %.2e, of the particles %.2e\n",
+		"block", (double) blocked.evaluations, (double) blocked.builds, 1e3 * blockedSeconds, bodies, swarm);
+	double blockedBodies = bodies, blockedSwarm = swarm;
+	// the coarsest global step as accurate in both, and in the particles alone
+	int matched[2] = { -1, -1 };
+	double forces[3], builds[3], times[3];
+	for (int coarser = 0; coarser < 3; coarser++) {
+		NBodySystem global = start;
+		begin = std::chrono::high_resolution_clock::now();
+		for (int k = 0; k < blocks << (finest - coarser); k++) {
+			global.step(std::ldexp(dt, coarser), &pool);
+		}
+		times[coarser] = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+		forces[coarser] = (double) global.evaluations;
+		builds[coarser] = (double) global.builds;
+		position_errors(global, reference, bodies, swarm);
+		char name[32];
+		snprintf(name, sizeof(name), "global of %.4f s", std::ldexp(dt, coarser));
+		printf("  %-22s %10.0f forces %6.0f trees %7.1f ms a year, error of the bodies %.2e, of the particles %.2e\n",
+			name, forces[coarser], builds[coarser], 1e3 * times[coarser], bodies, swarm);
+		if (swarm <= 1.01 * blockedSwarm) {
+			matched[1] = coarser;
+			if (bodies <= 1.01 * blockedBodies) {
+				matched[0] = coarser;
+			}
+		}
+	}
+	const char *what[2] = { "in both", "in the particles" };
+	for (int k = 0; k < 2; k++) {
+		int c = matched[k];
+		if (c < 0) {
+			printf("  no global step is as accurate %s as the block steps\n", what[k]);
+			continue;
+		}
+		printf("  against the global step of %.4f s, as accurate %s: forces x%.2f, trees x%.2f, time x%.2f\n",
+			std::ldexp(dt, c), what[k], forces[c] / blocked.evaluations, builds[c] / blocked.builds,
+			times[c] / blockedSeconds);
+	}
+}
+
+static int bench_nbody(int argc, char **argv) {
+	int particles = 100000, steps = 4, blockParticles = 1000;
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+			particles = std::max(0, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+			steps = std::max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			threads = (unsigned) std::max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--block-particles") == 0 && i + 1 < argc) {
+			blockParticles = std::max(0, atoi(argv[++i]));
+		}
+	}
+	NBodySystem start;
+	solar_nbody(particles, 0.0, 1, start);
+	printf("%d massive bodies, %d particles, theta %.2f, %s\n", start.massive, particles, start.theta,
+		cpu_isa_name(cpu_best_isa()));
+
+	// the pull of the swarm from the tree against the sum over every
+	// particle, on particles spread over the tree
+	bool ok = true;
+	{
+		ThreadPool pool(threads);
+		NBodySystem s = start;
+		s.accelerate(&pool);
+		int samples = std::min(particles, 500);
+		std::vector<double> errors;
+		double worstTotal = 0.0;
+		for (int k = 0; k < samples; k++) {
+			int i = s.massive + (int) ((long long) k * particles / samples);
+			double massive[3], swarm[3];
+			direct_sum(s, i, 0, s.massive, massive);
+			direct_sum(s, i, s.massive, s.size(), swarm);
+			double tree[3] = { s.ax[i] - massive[0], s.ay[i] - massive[1], s.az[i] - massive[2] };
+			double error[3] = { tree[0] - swarm[0], tree[1] - swarm[1], tree[2] - swarm[2] };
+			double total[3] = { massive[0] + swarm[0], massive[1] + swarm[1], massive[2] + swarm[2] };
+			errors.push_back(norm(error) / norm(swarm));
+			worstTotal = std::max(worstTotal, norm(error) / norm(total));
+		}
+		if (samples > 0) {
+			std::sort(errors.begin(), errors.end());
+			double median = errors[errors.size() / 2], p99 = errors[errors.size() * 99 / 100];
+			ok = p99 < 5e-2 && worstTotal < 1e-6;
+			printf("pull of the swarm, relative error: median %.2e, 99th percentile %.2e; of the whole pull, worst %.2e %s\n",
+				median, p99, worstTotal, ok ? "ok" : "FAILED");
+		}
+	}
+
+	// the bodies alone for a century of the earth, the leapfrog keeps their
+	// energy from drifting off
+	{
+		NBodySystem s;
+		solar_nbody(0, 0.0, 1, s);
+		double e0 = energy(s);
+		int years = 100, count = (int) (years * EARTH_REVOLUTION_CYCLE / NBODY_STEP);
+		double worst = 0.0;
+		for (int k = 0; k < count; k++) {
+			s.step(NBODY_STEP, NULL);
+			worst = std::max(worst, std::fabs(energy(s) / e0 - 1.0));
+		}
+		bool conserved = worst < 1e-5;
+		ok = ok && conserved;
+		printf("energy of the bodies over %d years, %d steps: worst drift %.2e %s\n", years, count, worst,
+			conserved ? "ok" : "FAILED");
+	}
+
+	// the same steps from the same start on more and more workers
+	printf("throughput, %d steps of %.3f s\n", steps, NBODY_STEP);
+	double single = 0.0;
+	for (unsigned t = 1;; t = std::min(threads, 2 * t)) {
+		ThreadPool pool(t);
+		NBodySystem s = start;
+		s.accelerate(&pool);
+		uint64_t before = s.interactions;
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (int k = 0; k < steps; k++) {
+			s.step(NBODY_STEP, &pool);
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+		double rate = (s.interactions - before) / seconds;
+		if (t == 1) {
+			single = rate;
+		}
+		printf("  %3u threads %9.1f ms a step %9.1f M interactions/s  x%.2f\n",
+			t, 1000.0 * seconds / steps, rate / 1e6, rate / single);
+		if (t == threads) {
+			break;
+		}
+	}
+
+	bench_blocks(blockParticles, threads);
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+	if (argc >= 2 && strcmp(argv[1], "kepler") == 0) {
+		return bench_kepler(argc - 2, argv + 2);
+	}
+	if (argc >= 2 && strcmp(argv[1], "ephemeris") == 0) {
+		return bench_ephemeris(argc - 2, argv + 2);
+	}
+	if (argc >= 2 && strcmp(argv[1], "nbody") == 0) {
+		return bench_nbody(argc - 2, argv + 2);
+	}
+	fprintf(stderr, "usage: %s kepler [--bodies n] [--seconds s]\n", argv[0]);
+	fprintf(stderr, "       %s ephemeris [--span s]\n", argv[0]);
+	fprintf(stderr, "       %s nbody [--particles n] [--steps k] [--threads t] [--block-particles n]\n", argv[0]);
+	return 1;
+}
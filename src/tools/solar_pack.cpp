@@ -0,0 +1,236 @@
+////////////////////////////////////////////////////////////////////////////////
+// Bakes every derived asset into one pack: the bundled sphere mesh and the
+// levels of the sphere chain, the mip chain of each planet texture, the
+// skybox cube map and the tables of the orbits, laid out exactly as the
+// caches of the viewer hold them
+//
+// usage: solar-pack <data folder> <pack> [--texture-format rgba8|bc1|bc3]
+//                   [--ephemeris-span seconds]
+////////////////////////////////////////////////////////////////////////////////
+#include "asset_pack.h"
+#include "block_compress.h"
+#include "ephemeris_table.h"
+#include "image.h"
+#include "mapped_file.h"
+#include "mesh_cache.h"
+#include "mipmap.h"
+#include "skybox.h"
+#include "sphere_mesh.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+// the equirectangular image the skybox is converted from, every other
+// image of the texture folder is a planet texture
+#define SKYBOX_IMAGE "textures/stars_milky_way.png"
+
+static bool ends_with(const std::string &s, const std::string &suffix) {
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// names of the .png files of a folder, sorted
+static std::vector<std::string> list_images(const std::string &dir) {
+	std::vector<std::string> names;
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE search = FindFirstFileA((dir + "*.png").c_str(), &found);
+	if (search != INVALID_HANDLE_VALUE) {
+		do {
+			names.push_back(found.cFileName);
+		} while (FindNextFileA(search, &found));
+		FindClose(search);
+	}
+#else
+	DIR *d = opendir(dir.c_str());
+	if (d != NULL) {
+		while (struct dirent *e = readdir(d)) {
+			if (ends_with(e->d_name, ".png")) {
+				names.push_back(e->d_name);
+			}
+		}
+		closedir(d);
+	}
+#endif
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+static bool hash_file(const std::string &fname, uint64_t &hash) {
+	MappedFile source;
+	if (!source.open(fname)) {
+		return false;
+	}
+	hash = hash_bytes(source.data, source.size);
+	return true;
+}
+
+// the bundled sphere, keyed on the content of its .off file
+static bool pack_sphere_off(const std::string &dataDir, std::vector<unsigned char> &bytes, uint64_t &hash) {
+	MeshData sphere;
+	if (!hash_file(dataDir + SPHERE_OFF_NAME, hash) || !build_sphere_mesh(dataDir + SPHERE_OFF_NAME, &sphere)) {
+		return false;
+	}
+	encode_mesh_cache(hash, sphere.V, sphere.N, sphere.T, sphere.F, bytes);
+	return true;
+}
+
+// a level of the chain, keyed on the generator
+static void pack_sphere(int lod, std::vector<unsigned char> &bytes) {
+	MeshData sphere;
+	build_icosphere(sphere_lod_subdivisions(lod), &sphere);
+	encode_mesh_cache(sphere_lod_hash(lod), sphere.V, sphere.N, sphere.T, sphere.F, bytes);
+}
+
+static bool pack_skybox(const std::string &fname, ThreadPool &pool, std::vector<unsigned char> &bytes, uint64_t &hash) {
+	Image image;
+	if (!hash_file(fname, hash) || !load_image(fname, image)) {
+		return false;
+	}
+	std::vector<unsigned char> faces;
+	equirect_to_cube(image, SKYBOX_SIZE, faces, pool);
+	encode_skybox_cache(hash, SKYBOX_SIZE, faces, bytes);
+	return true;
+}
+
+// the full chain of a texture resampled to the layer size, as the viewer builds it
+static bool pack_texture(const std::string &fname, int format, std::vector<unsigned char> &bytes, uint64_t &hash) {
+	Image image;
+	if (!hash_file(fname, hash) || !load_image(fname, image)) {
+		return false;
+	}
+	int width = TEXTURE_LAYER_WIDTH, height = TEXTURE_LAYER_HEIGHT;
+	if (image.width != width || image.height != height) {
+		Image resized;
+		resample_image(image, resized, width, height);
+		image.swap(resized);
+	}
+	int levels = mip_levels(width, height);
+	std::vector<unsigned char> rgba, chain;
+	build_mip_chain(image, levels, rgba);
+	image.release();
+	if (format == TEXTURE_FORMAT_RGBA8) {
+		chain.swap(rgba);
+	} else {
+		chain.resize(mip_chain_bytes(width, height, levels, format));
+		for (int l = 0; l < levels; l++) {
+			int w = mip_size(width, l), h = mip_size(height, l);
+			compress_blocks(format, rgba.data() + mip_chain_bytes(width, height, l), w, h, 0, (h + 3) / 4,
+				chain.data() + mip_chain_bytes(width, height, l, format));
+		}
+	}
+	encode_mip_cache(hash, format, width, height, levels, chain, bytes);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <data folder> <pack> [--texture-format rgba8|bc1|bc3] [--ephemeris-span seconds]\n", argv[0]);
+		return 1;
+	}
+	std::string dataDir = argv[1];
+	if (!ends_with(dataDir, "/") && !ends_with(dataDir, "\\")) {
+		dataDir += "/";
+	}
+	std::string output = argv[2];
+	// the viewer defaults to bc1 as well
+	int format = TEXTURE_FORMAT_BC1;
+	// the viewer has to ask for the same span to use the tables
+	double span = EPHEMERIS_SPAN;
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "--texture-format") == 0 && i + 1 < argc) {
+			const char *name = argv[++i];
+			format = -1;
+			for (int f : { TEXTURE_FORMAT_RGBA8, TEXTURE_FORMAT_BC1, TEXTURE_FORMAT_BC3 }) {
+				if (strcmp(name, texture_format_name(f)) == 0) {
+					format = f;
+				}
+			}
+			if (format < 0) {
+				fprintf(stderr, "Unknown texture format %s\n", name);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--ephemeris-span") == 0 && i + 1 < argc) {
+			span = atof(argv[++i]);
+		}
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+
+	AssetPackWriter writer;
+	std::mutex mutex;
+	bool ok = true;
+	std::vector<unsigned char> bytes;
+	uint64_t hash;
+	if (pack_sphere_off(dataDir, bytes, hash)) {
+		writer.add(SPHERE_OFF_NAME, ASSET_MESH, hash, bytes);
+	} else {
+		fprintf(stderr, "Failed to read %s%s, the bundled sphere stays unpacked\n", dataDir.c_str(), SPHERE_OFF_NAME);
+	}
+	for (int lod = 0; lod < SPHERE_LODS; lod++) {
+		pack_sphere(lod, bytes);
+		writer.add(sphere_lod_name(lod), ASSET_MESH, sphere_lod_hash(lod), bytes);
+	}
+	if (span > 0.0) {
+		const BodyElements *elements = solar_system_elements();
+		encode_ephemeris_cache(elements, BODY_COUNT, 0.0, span, bytes);
+		writer.add("ephemeris", ASSET_EPHEMERIS, ephemeris_hash(elements, BODY_COUNT, 0.0, span), bytes);
+	}
+
+	ThreadPool pool;
+	if (pack_skybox(dataDir + SKYBOX_IMAGE, pool, bytes, hash)) {
+		writer.add(SKYBOX_IMAGE, ASSET_CUBE, hash, bytes);
+	} else {
+		fprintf(stderr, "Failed to load %s, the skybox stays unpacked\n", SKYBOX_IMAGE);
+	}
+
+	// one texture a worker, each encodes its own blocks
+	for (const std::string &image : list_images(dataDir + "textures/")) {
+		std::string name = "textures/" + image;
+		if (name == SKYBOX_IMAGE) {
+			continue;
+		}
+		pool.submit([&, name] {
+			std::vector<unsigned char> chain;
+			uint64_t chainHash;
+			bool built = pack_texture(dataDir + name, format, chain, chainHash);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!built) {
+				fprintf(stderr, "Failed to load texture image %s\n", name.c_str());
+				ok = false;
+			} else if (!writer.add(name, ASSET_MIPS, chainHash, chain)) {
+				fprintf(stderr, "Cannot pack %s, its name is too long\n", name.c_str());
+				ok = false;
+			}
+		});
+	}
+	pool.wait();
+	if (!ok) {
+		return 1;
+	}
+
+	if (!writer.write(output)) {
+		fprintf(stderr, "Failed to write %s\n", output.c_str());
+		return 1;
+	}
+	AssetPack pack;
+	if (!pack.open(output)) {
+		fprintf(stderr, "Failed to map %s back\n", output.c_str());
+		return 1;
+	}
+	printf("%u assets, %s textures, %.1f MB written to %s in %.1f s\n",
+		pack.size(), texture_format_name(format), pack.bytes() / (1024.0 * 1024.0), output.c_str(),
+		std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+	return 0;
+}
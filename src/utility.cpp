@@ -1,48 +1,5 @@
 #include "index.h"
 
-void load_sphere_off(const std::string &filename, Eigen::MatrixXf &V, Eigen::MatrixXi &F) {
-    std::ifstream in(filename);
-    std::string token;
-    in >> token;
-    int nv, nf, ne;
-    in >> nv >> nf >> ne;
-    V.resize(3, nv);
-    F.resize(3, nf);
-    // get all the vertices
-    for (int i = 0; i < nv; ++i) {
-        in >> V(0, i) >> V(1, i) >> V(2, i);
-    }
-    // get all the faces
-    int s;
-    for (int i = 0; i < nf; ++i) {
-        in >> s >> F(0, i) >> F(1, i) >> F(2, i);
-        assert(s == 3);
-    }
-}
-
-double find_radius_center(const Mesh &m, Eigen::Vector3f &c) {
-    if (m.V.cols() == 0) {
-        return 0; // error
-    }
-    // go through all the vertices
-    double max_x = m.V.col(0)[0], min_x = m.V.col(0)[0];
-    double max_y = m.V.col(0)[1], min_y = m.V.col(0)[1];
-    double max_z = m.V.col(0)[2], min_z = m.V.col(0)[2];
-    for (int i = 1; i < m.V.cols(); i++) {
-        if (max_x < m.V.col(i)[0]) max_x = m.V.col(i)[0];
-        if (min_x > m.V.col(i)[0]) min_x = m.V.col(i)[0];
-        if (max_y < m.V.col(i)[1]) max_y = m.V.col(i)[1];
-        if (min_y > m.V.col(i)[1]) min_y = m.V.col(i)[1];
-        if (max_z < m.V.col(i)[2]) max_z = m.V.col(i)[2];
-        if (min_z > m.V.col(i)[2]) min_z = m.V.col(i)[2];
-    }
-
-    // assign center
-    c << (max_x + min_x) / 2, (max_y + min_y) / 2, (max_z + min_z) / 2;
-    // return accumulate radius
-    return max(max_x - min_x, max(max_y - min_y, max_z - min_z)) / 2;
-}
-
 Eigen::Matrix4f orthographic(
 	double right, 
 	double left, 
@@ -113,14 +70,17 @@ void update_camera_view() {
 		0.0f, 0.0f, 0.0f, 1.0f;
 	// apply rotations
 	position = hv * rv * position;
-	// apply transofmration
-	position = CameraModel * position;
-	// calculate up vector
+	// carried along with the earth, wherever the orbit tables put it
 	if (Scene == SCENE_EARTH_FOCUS) {
-		CameraLookAt = Planets[2].center;
+		Eigen::Matrix4f earth = body_frame(BODY_EARTH, SimulationTime);
+		CameraModel = earth * CameraAnchor;
+		CameraLookAt = earth.block<3, 1>(0, 3);
 	} else {
 		CameraLookAt = Sun.center;
 	}
+	// apply transofmration
+	position = CameraModel * position;
+	// calculate up vector
 	CameraPosition << position[0], position[1], position[2];
 	Eigen::Vector3f look = (CameraLookAt - CameraPosition).normalized();
 	Eigen::Vector3f worldUp(0.0f, (double) pow(-1, floor((V_radian + (M_PI/2)) / M_PI)), 0.0f);
@@ -156,5 +116,7 @@ void focus_on_earth() {
         0.0f, 1.0f, 0.0f, CameraLookAt[1],
         0.0f, 0.0f, 1.0f, CameraLookAt[2],
         0.0f, 0.0f, 0.0f, 1.0f;
+	// kept where it is in the frame of the earth from now on
+	CameraAnchor = body_frame(BODY_EARTH, SimulationTime).inverse() * CameraModel;
     update_camera_view();
 }
\ No newline at end of file